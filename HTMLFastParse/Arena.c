@@ -0,0 +1,175 @@
+//
+//  Arena.c
+//  HTMLFastParse
+//
+//  Copyright © 2026 CarbonDev. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "Arena.h"
+
+//Every allocation is aligned to this so that any of our structs can be placed in the arena
+#define ARENA_ALIGNMENT 16
+#define ARENA_ALIGN(size) (((size) + (ARENA_ALIGNMENT - 1)) & ~((size_t)ARENA_ALIGNMENT - 1))
+#define ARENA_DEFAULT_BLOCK_SIZE 4096
+
+struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t capacity;
+    size_t used;
+};
+
+//The data section starts after the (aligned) header
+#define ARENA_BLOCK_DATA(block) ((unsigned char *)(block) + ARENA_ALIGN(sizeof(struct ArenaBlock)))
+
+struct Arena {
+    struct ArenaBlock *head;
+    struct ArenaBlock *current;
+    size_t blockSize;
+
+    //The most recent allocation, which can be grown in place by arenaRealloc
+    void *lastAllocation;
+};
+
+static struct ArenaBlock* createArenaBlock(size_t capacity) {
+    struct ArenaBlock *block = malloc(ARENA_ALIGN(sizeof(struct ArenaBlock)) + capacity);
+    if (!block) {
+        return NULL;
+    }
+    block->next = NULL;
+    block->capacity = capacity;
+    block->used = 0;
+    return block;
+}
+
+/**
+ Create a new arena
+
+ @param blockSize The size of each backing block. Zero selects a default. Allocations larger than this get a block of their own.
+ @return The arena, or NULL if the first block could not be allocated
+ */
+struct Arena* createArena(size_t blockSize) {
+    struct Arena *arena = malloc(sizeof(struct Arena));
+    if (!arena) {
+        return NULL;
+    }
+    arena->blockSize = blockSize > 0 ? ARENA_ALIGN(blockSize) : ARENA_DEFAULT_BLOCK_SIZE;
+    arena->head = createArenaBlock(arena->blockSize);
+    arena->current = arena->head;
+    arena->lastAllocation = NULL;
+    if (!arena->head) {
+        free(arena);
+        return NULL;
+    }
+    return arena;
+}
+
+/**
+ Allocate memory from the arena. The memory lives until the arena is reset or destroyed.
+
+ @param arena The arena, or NULL to use malloc
+ @param size The number of bytes required
+ @return The memory or NULL on failure
+ */
+void* arenaAlloc(struct Arena* arena, size_t size) {
+    if (!arena) {
+        return malloc(size);
+    }
+
+    size_t alignedSize = ARENA_ALIGN(size > 0 ? size : 1);
+    struct ArenaBlock *block = arena->current;
+    //Walk forward through blocks retained by a previous reset before we grow the chain
+    while (block->used + alignedSize > block->capacity) {
+        if (block->next && block->next->capacity >= alignedSize) {
+            block = block->next;
+            block->used = 0;
+        } else {
+            size_t capacity = alignedSize > arena->blockSize ? alignedSize : arena->blockSize;
+            struct ArenaBlock *newBlock = createArenaBlock(capacity);
+            if (!newBlock) {
+                return NULL;
+            }
+            //Insert after the current block so that retained blocks are still reachable
+            newBlock->next = block->next;
+            block->next = newBlock;
+            block = newBlock;
+        }
+    }
+    arena->current = block;
+
+    void *allocation = ARENA_BLOCK_DATA(block) + block->used;
+    block->used += alignedSize;
+    arena->lastAllocation = allocation;
+    return allocation;
+}
+
+/**
+ Grow (or shrink) an allocation. The most recent allocation is resized in place when the block has room, otherwise the contents are copied into a fresh allocation.
+
+ @param arena The arena, or NULL to use realloc
+ @param pointer The existing allocation (may be NULL)
+ @param oldSize The size originally requested for pointer
+ @param newSize The new size
+ @return The resized memory or NULL on failure (in which case pointer is left untouched)
+ */
+void* arenaRealloc(struct Arena* arena, void* pointer, size_t oldSize, size_t newSize) {
+    if (!arena) {
+        return realloc(pointer, newSize);
+    }
+
+    if (pointer && pointer == arena->lastAllocation) {
+        struct ArenaBlock *block = arena->current;
+        size_t offset = (unsigned char *)pointer - ARENA_BLOCK_DATA(block);
+        size_t alignedSize = ARENA_ALIGN(newSize > 0 ? newSize : 1);
+        if (offset + alignedSize <= block->capacity) {
+            block->used = offset + alignedSize;
+            return pointer;
+        }
+    }
+
+    void *allocation = arenaAlloc(arena, newSize);
+    if (allocation && pointer) {
+        memcpy(allocation, pointer, oldSize < newSize ? oldSize : newSize);
+    }
+    return allocation;
+}
+
+/**
+ Release an allocation. This is a no-op for arenas since everything is released by resetArena.
+
+ @param arena The arena, or NULL to use free
+ @param pointer The allocation
+ */
+void arenaFree(struct Arena* arena, void* pointer) {
+    if (!arena) {
+        free(pointer);
+    }
+}
+
+/**
+ Release every allocation made from the arena. The blocks are kept so that the next parse doesn't need to go back to malloc.
+
+ @param arena The arena
+ */
+void resetArena(struct Arena* arena) {
+    if (!arena) {
+        return;
+    }
+    arena->head->used = 0;
+    arena->current = arena->head;
+    arena->lastAllocation = NULL;
+}
+
+void destroyArena(struct Arena* arena) {
+    if (!arena) {
+        return;
+    }
+    struct ArenaBlock *block = arena->head;
+    while (block) {
+        struct ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    free(arena);
+}
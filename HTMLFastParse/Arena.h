@@ -0,0 +1,27 @@
+//
+//  Arena.h
+//  HTMLFastParse
+//
+//  Copyright © 2026 CarbonDev. All rights reserved.
+//
+
+#ifndef Arena_h
+#define Arena_h
+
+#include <stdio.h>
+
+/**
+ A bump allocator which owns every allocation made during a parse. Resetting the arena releases all of them at once and keeps the underlying blocks around for the next parse.
+
+ Every function here accepts a NULL arena, in which case it falls back to the system allocator. This lets the parser be written once against the arena API while keeping the arena opt-in.
+ */
+struct Arena;
+
+struct Arena* createArena(size_t blockSize);
+void* arenaAlloc(struct Arena* arena, size_t size);
+void* arenaRealloc(struct Arena* arena, void* pointer, size_t oldSize, size_t newSize);
+void arenaFree(struct Arena* arena, void* pointer);
+void resetArena(struct Arena* arena);
+void destroyArena(struct Arena* arena);
+
+#endif /* Arena_h */
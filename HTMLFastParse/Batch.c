@@ -0,0 +1,413 @@
+//
+//  Batch.c
+//  HTMLFastParse
+//
+//  Copyright © 2026 CarbonDev. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "Batch.h"
+#include "C_HTML_Parser.h"
+#include "UTF8.h"
+
+/**
+ A block the results are copied into. It is built up with offsets rather than pointers since growing it may move it.
+ */
+struct t_batch_output {
+    char *block;
+    size_t blockSize;
+    size_t used;
+};
+
+/**
+ Reserve space at the end of the output block
+
+ @param output The output block
+ @param size The number of bytes required
+ @param alignment The alignment the bytes need (a power of two)
+ @param offset (returned) The offset of the reserved bytes
+ @return false if the block could not be grown
+ */
+static bool reserveOutput(struct t_batch_output *output, size_t size, size_t alignment, size_t *offset) {
+    size_t start = (output->used + (alignment - 1)) & ~(alignment - 1);
+    if (start + size > output->blockSize) {
+        size_t newBlockSize = output->blockSize * 2;
+        while (newBlockSize < start + size) newBlockSize *= 2;
+        char *newBlock = realloc(output->block, newBlockSize);
+        if (!newBlock) {
+            return false;
+        }
+        output->block = newBlock;
+        output->blockSize = newBlockSize;
+    }
+    output->used = start + size;
+    *offset = start;
+    return true;
+}
+
+/**
+ Parse one document in the scratch arena and copy the result into the output block
+
+ @param output The output block
+ @param result (returned) The result, with offsets into the output block in place of pointers
+ @param input The document
+ @param scratchArena The arena everything but the result is allocated from. It is reset first
+ @return false if there was no memory to parse the document or grow the output block
+ */
+static bool appendParseResult(struct t_batch_output *output, struct t_parse_result *result, const struct t_html_input *input, struct Arena *scratchArena) {
+    resetArena(scratchArena);
+
+    const char *displayText;
+    size_t displayTextSize;
+    int numberOfHumanVisibleCharacters = 0;
+    int numberOfFormats = 0;
+    struct t_format *formats;
+    struct t_link_table links;
+    
+    //Bad UTF-8 is replaced before anything reads the input, so the display text is always valid and its visible length is what NSString counts
+    struct t_html_input repairedInput;
+    char *repaired = repairUTF8(input->input, input->inputLength, &repairedInput.inputLength, scratchArena);
+    if (repaired) {
+        repairedInput.input = repaired;
+        input = &repairedInput;
+    }
+    
+    //Plain text is copied straight from the input, skipping the tokenizer and flattening
+    struct t_format plainTextRun;
+    struct t_parse_result plainText;
+    if (parsePlainText(input->input, input->inputLength, &plainTextRun, &plainText)) {
+        displayText = plainText.displayText;
+        displayTextSize = input->inputLength + 1;
+        numberOfHumanVisibleCharacters = plainText.numberOfHumanVisibleCharacters;
+        formats = plainText.formats;
+        numberOfFormats = plainText.numberOfFormats;
+        links = plainText.links;
+    } else {
+        int numberOfTags = 0;
+        struct t_tag *tags = arenaAlloc(scratchArena, (maximumNumberOfTags(input->input, input->inputLength) + 1) * sizeof(struct t_tag));
+        if (!tags) {
+            return false;
+        }
+        displayText = tokenizeHTMLWithArena((char *)input->input, input->inputLength, tags, &numberOfTags, &numberOfHumanVisibleCharacters, scratchArena);
+        if (!displayText) {
+            return false;
+        }
+        
+        formats = arenaAlloc(scratchArena, (maximumNumberOfSimplifiedTags(numberOfTags, numberOfHumanVisibleCharacters) + 1) * sizeof(struct t_format));
+        if (!formats || !makeAttributesLinearWithArena(tags, numberOfTags, formats, &numberOfFormats, &links, numberOfHumanVisibleCharacters, scratchArena)) {
+            return false;
+        }
+        displayTextSize = strlen(displayText) + 1;
+    }
+
+    size_t displayTextOffset;
+    size_t formatsOffset = 0;
+    if (!reserveOutput(output, displayTextSize, 1, &displayTextOffset)) {
+        return false;
+    }
+    memcpy(output->block + displayTextOffset, displayText, displayTextSize - 1);
+    output->block[displayTextOffset + displayTextSize - 1] = 0x00;
+    if (numberOfFormats > 0) {
+        if (!reserveOutput(output, numberOfFormats * sizeof(struct t_format), _Alignof(struct t_format), &formatsOffset)) {
+            return false;
+        }
+        memcpy(output->block + formatsOffset, formats, numberOfFormats * sizeof(struct t_format));
+    }
+    
+    //The link table is already a single allocation, so it's copied as is with its pointers turned into offsets from the start of the array
+    size_t linksOffset = 0;
+    if (links.numberOfURLs > 0) {
+        const char *lastURL = links.urls[links.numberOfURLs - 1];
+        size_t linksSize = (lastURL + strlen(lastURL) + 1) - (const char *)links.urls;
+        if (!reserveOutput(output, linksSize, _Alignof(char *), &linksOffset)) {
+            return false;
+        }
+        char **urls = (char **)(output->block + linksOffset);
+        memcpy(urls, links.urls, linksSize);
+        for (int i = 0; i < links.numberOfURLs; i++) {
+            urls[i] = (char *)(uintptr_t)(links.urls[i] - (char *)links.urls);
+        }
+    }
+
+    result->displayText = (char *)(uintptr_t)displayTextOffset;
+    result->numberOfHumanVisibleCharacters = numberOfHumanVisibleCharacters;
+    result->formats = (struct t_format *)(uintptr_t)formatsOffset;
+    result->numberOfFormats = numberOfFormats;
+    result->links.urls = (char **)(uintptr_t)linksOffset;
+    result->links.numberOfURLs = links.numberOfURLs;
+    return true;
+}
+
+/**
+ Turn the offsets in a result from appendParseResult into pointers, once the block they point into won't move again
+
+ @param result The result
+ @param base Where offset 0 now lives
+ */
+static void relocateParseResult(struct t_parse_result *result, char *base) {
+    result->displayText = base + (uintptr_t)result->displayText;
+    result->formats = result->numberOfFormats > 0 ? (struct t_format *)(base + (uintptr_t)result->formats) : NULL;
+    if (result->links.numberOfURLs > 0) {
+        result->links.urls = (char **)(base + (uintptr_t)result->links.urls);
+        for (int i = 0; i < result->links.numberOfURLs; i++) {
+            result->links.urls[i] = (char *)result->links.urls + (uintptr_t)result->links.urls[i];
+        }
+    } else {
+        result->links.urls = NULL;
+    }
+}
+
+/**
+ Parse many documents at once. The Stack, scratch buffers and working memory are set up once and reused for every document, which saves most of the fixed cost of parsing short documents one at a time. Documents which aren't valid UTF-8 are repaired (see repairUTF8) before they are parsed.
+
+ @param inputs The documents
+ @param numberOfInputs The number of documents
+ @param scratchArena The arena to use for working memory, which will be reset as the batch is parsed. Pass NULL to have one created for just this batch
+ @return The results in the same order as the inputs. Everything (the display text, formats and link table of every result) lives in this one block, so free() it once you are done. NULL on failure
+ */
+struct t_parse_result * parseHTMLBatch(const struct t_html_input inputs[], int numberOfInputs, struct Arena *scratchArena) {
+    if (numberOfInputs <= 0) {
+        return NULL;
+    }
+
+    struct Arena *ownedArena = NULL;
+    if (!scratchArena) {
+        ownedArena = scratchArena = createArena(0);
+        if (!scratchArena) {
+            return NULL;
+        }
+    }
+
+    //Most documents are about as long as their display text, so start with room for that
+    struct t_batch_output output;
+    output.used = numberOfInputs * sizeof(struct t_parse_result);
+    output.blockSize = output.used;
+    for (int i = 0; i < numberOfInputs; i++) {
+        output.blockSize += inputs[i].inputLength + 1;
+    }
+    output.block = malloc(output.blockSize);
+
+    bool success = output.block != NULL;
+    for (int i = 0; success && i < numberOfInputs; i++) {
+        struct t_parse_result result;
+        success = appendParseResult(&output, &result, &inputs[i], scratchArena);
+        if (success) {
+            ((struct t_parse_result *)output.block)[i] = result;
+        }
+    }
+    destroyArena(ownedArena);
+    if (!success) {
+        free(output.block);
+        return NULL;
+    }
+
+    //The block won't move again, so turn the offsets into pointers
+    struct t_parse_result *results = (struct t_parse_result *)output.block;
+    for (int i = 0; i < numberOfInputs; i++) {
+        relocateParseResult(&results[i], output.block);
+    }
+    return results;
+}
+
+/**
+ A thread working through a batch. The documents it still has to parse are the range [next, end). It takes documents from the front, and once it runs out it steals half of the remaining range from the back of another worker.
+ */
+struct t_batch_worker {
+    pthread_t thread;
+    bool isThreadRunning;
+    
+    pthread_mutex_t lock;
+    int next;
+    int end;
+    
+    //Everything the worker parses goes in its own output block, they are stitched together at the end
+    struct t_batch_output output;
+    struct Arena *scratchArena;
+    bool success;
+    
+    struct t_batch_job *job;
+    int index;
+};
+
+struct t_batch_job {
+    const struct t_html_input *inputs;
+    //The result of each document, relative to the output block of the worker which parsed it
+    struct t_parse_result *results;
+    int *resultWorkers;
+    
+    struct t_batch_worker *workers;
+    int numberOfWorkers;
+};
+
+//Take the next document from the front of a worker's range. Returns -1 if it is empty
+static int takeDocument(struct t_batch_worker *worker) {
+    int index = -1;
+    pthread_mutex_lock(&worker->lock);
+    if (worker->next < worker->end) {
+        index = worker->next++;
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return index;
+}
+
+//Move half of the remaining range of another worker onto an (empty) worker. Returns false once there is nothing left anywhere
+static bool stealDocuments(struct t_batch_worker *worker) {
+    struct t_batch_job *job = worker->job;
+    for (int i = 1; i < job->numberOfWorkers; i++) {
+        struct t_batch_worker *victim = &job->workers[(worker->index + i) % job->numberOfWorkers];
+        pthread_mutex_lock(&victim->lock);
+        int remaining = victim->end - victim->next;
+        int stolen = (remaining + 1) / 2;
+        victim->end -= stolen;
+        int stolenStart = victim->end;
+        pthread_mutex_unlock(&victim->lock);
+        
+        if (stolen > 0) {
+            pthread_mutex_lock(&worker->lock);
+            worker->next = stolenStart;
+            worker->end = stolenStart + stolen;
+            pthread_mutex_unlock(&worker->lock);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void* runBatchWorker(void *context) {
+    struct t_batch_worker *worker = context;
+    struct t_batch_job *job = worker->job;
+    do {
+        int index;
+        while (worker->success && (index = takeDocument(worker)) >= 0) {
+            worker->success = appendParseResult(&worker->output, &job->results[index], &job->inputs[index], worker->scratchArena);
+            job->resultWorkers[index] = worker->index;
+        }
+    } while (worker->success && stealDocuments(worker));
+    return NULL;
+}
+
+//Starting a thread costs about as much as parsing a handful of comments, so don't bother for less than this many documents per thread
+#define MINIMUM_DOCUMENTS_PER_THREAD 16
+
+/**
+ Get the number of worker threads to use by default
+
+ @param numberOfInputs The number of documents in the batch
+ @return One per online CPU, unless the batch is too small to make that worthwhile
+ */
+static int defaultNumberOfThreads(int numberOfInputs) {
+    long numberOfCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+    int numberOfThreads = numberOfCPUs > 0 ? (int)numberOfCPUs : 1;
+    int usefulNumberOfThreads = numberOfInputs / MINIMUM_DOCUMENTS_PER_THREAD;
+    if (numberOfThreads > usefulNumberOfThreads) {
+        numberOfThreads = usefulNumberOfThreads;
+    }
+    return numberOfThreads > 0 ? numberOfThreads : 1;
+}
+
+/**
+ Parse many documents at once, spread across several threads. Each thread has its own scratch arena and threads which run out of documents steal them from the others, so one very long document doesn't hold up the rest of the batch.
+
+ @param inputs The documents
+ @param numberOfInputs The number of documents
+ @param numberOfThreads The number of threads to use, including the calling thread. Pass 0 to use one per CPU (fewer for small batches)
+ @return The results in the same order as the inputs, in a single block just like parseHTMLBatch. free() it once you are done. NULL on failure
+ */
+struct t_parse_result * parseHTMLBatchInParallel(const struct t_html_input inputs[], int numberOfInputs, int numberOfThreads) {
+    if (numberOfInputs <= 0) {
+        return NULL;
+    }
+    if (numberOfThreads <= 0) {
+        numberOfThreads = defaultNumberOfThreads(numberOfInputs);
+    }
+    if (numberOfThreads > numberOfInputs) {
+        numberOfThreads = numberOfInputs;
+    }
+    if (numberOfThreads == 1) {
+        return parseHTMLBatch(inputs, numberOfInputs, NULL);
+    }
+    
+    struct t_batch_job job;
+    job.inputs = inputs;
+    job.results = malloc(numberOfInputs * sizeof(struct t_parse_result));
+    job.resultWorkers = malloc(numberOfInputs * sizeof(int));
+    job.workers = calloc(numberOfThreads, sizeof(struct t_batch_worker));
+    job.numberOfWorkers = numberOfThreads;
+    bool success = job.results && job.resultWorkers && job.workers;
+    
+    //Start everyone off with an equal share of the documents
+    for (int w = 0; success && w < numberOfThreads; w++) {
+        struct t_batch_worker *worker = &job.workers[w];
+        worker->job = &job;
+        worker->index = w;
+        worker->next = (int)((long)numberOfInputs * w / numberOfThreads);
+        worker->end = (int)((long)numberOfInputs * (w + 1) / numberOfThreads);
+        pthread_mutex_init(&worker->lock, NULL);
+        
+        worker->output.used = 0;
+        worker->output.blockSize = 1;
+        for (int i = worker->next; i < worker->end; i++) {
+            worker->output.blockSize += inputs[i].inputLength + 1;
+        }
+        worker->output.block = malloc(worker->output.blockSize);
+        worker->scratchArena = createArena(0);
+        worker->success = worker->output.block && worker->scratchArena;
+    }
+    
+    //The calling thread is worker 0. If a thread can't be started its documents are simply stolen by the others
+    if (success) {
+        for (int w = 1; w < numberOfThreads; w++) {
+            struct t_batch_worker *worker = &job.workers[w];
+            worker->isThreadRunning = pthread_create(&worker->thread, NULL, runBatchWorker, worker) == 0;
+        }
+        runBatchWorker(&job.workers[0]);
+    }
+    
+    //Stitch the output blocks together behind the results array
+    size_t blockSize = numberOfInputs * sizeof(struct t_parse_result);
+    size_t *segmentStarts = job.workers ? malloc(numberOfThreads * sizeof(size_t)) : NULL;
+    success = success && segmentStarts;
+    for (int w = 0; job.workers && w < numberOfThreads; w++) {
+        struct t_batch_worker *worker = &job.workers[w];
+        if (worker->isThreadRunning) {
+            pthread_join(worker->thread, NULL);
+        }
+        success = success && worker->success;
+        if (segmentStarts) {
+            segmentStarts[w] = (blockSize + (_Alignof(max_align_t) - 1)) & ~(_Alignof(max_align_t) - 1);
+            blockSize = segmentStarts[w] + worker->output.used;
+        }
+    }
+    
+    char *block = success ? malloc(blockSize) : NULL;
+    if (block) {
+        for (int w = 0; w < numberOfThreads; w++) {
+            memcpy(block + segmentStarts[w], job.workers[w].output.block, job.workers[w].output.used);
+        }
+        struct t_parse_result *results = (struct t_parse_result *)block;
+        for (int i = 0; i < numberOfInputs; i++) {
+            results[i] = job.results[i];
+            relocateParseResult(&results[i], block + segmentStarts[job.resultWorkers[i]]);
+        }
+    }
+    
+    for (int w = 0; job.workers && w < numberOfThreads; w++) {
+        struct t_batch_worker *worker = &job.workers[w];
+        if (worker->job) {
+            pthread_mutex_destroy(&worker->lock);
+        }
+        free(worker->output.block);
+        destroyArena(worker->scratchArena);
+    }
+    free(segmentStarts);
+    free(job.workers);
+    free(job.resultWorkers);
+    free(job.results);
+    return (struct t_parse_result *)block;
+}
@@ -0,0 +1,27 @@
+//
+//  Batch.h
+//  HTMLFastParse
+//
+//  Copyright © 2026 CarbonDev. All rights reserved.
+//
+
+#ifndef Batch_h
+#define Batch_h
+
+#include <stdio.h>
+#include "t_parse_result.h"
+#include "Arena.h"
+
+/**
+ One document in a batch
+ */
+struct t_html_input {
+    const char *input;
+    //The number of bytes to read, excluding the null byte
+    size_t inputLength;
+};
+
+struct t_parse_result * parseHTMLBatch(const struct t_html_input inputs[], int numberOfInputs, struct Arena *scratchArena);
+struct t_parse_result * parseHTMLBatchInParallel(const struct t_html_input inputs[], int numberOfInputs, int numberOfThreads);
+
+#endif /* Batch_h */
@@ -0,0 +1,54 @@
+//
+//  CPUFeatures.h
+//  HTMLFastParse
+//
+//  Copyright © 2026 CarbonDev. All rights reserved.
+//
+
+#ifndef CPUFeatures_h
+#define CPUFeatures_h
+
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/*
+ The vector instruction sets the scanners, validators and encoders are written for. Every x86 target we build for has SSE2, so only AVX2 and SSSE3 need checking at run time. Every ARM64 target has NEON
+ */
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__))
+#define CPU_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define CPU_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if CPU_X86
+static inline bool cpuSupportsSSSE3(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("ssse3");
+}
+
+static inline bool cpuSupportsAVX2(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+#endif
+
+/*
+ Runtime dispatch. nameImplementation starts out pointing at a resolver which swaps in best (an expression which picks the implementation for this CPU) on first use and then calls it.
+ Racing threads will all store the same pointer so no locking is needed. The pointer is atomic (relaxed, which is a plain load/store) so that this is well defined when parsing on several threads.
+
+ For example, RUNTIME_DISPATCH(scan, size_t, (const char *text, size_t length), (text, length), cpuSupportsAVX2() ? scanAVX2 : scanSSE2) declares scanImplementation, which the public function then calls through with CALL_DISPATCHED(scan, (text, length))
+ */
+#define RUNTIME_DISPATCH(name, returnType, parameters, arguments, best) \
+typedef returnType (*name##Function) parameters; \
+static returnType name##Resolve parameters; \
+static _Atomic(name##Function) name##Implementation = name##Resolve; \
+static returnType name##Resolve parameters { \
+    atomic_store_explicit(&name##Implementation, best, memory_order_relaxed); \
+    return atomic_load_explicit(&name##Implementation, memory_order_relaxed) arguments; \
+}
+
+#define CALL_DISPATCHED(name, arguments) atomic_load_explicit(&name##Implementation, memory_order_relaxed) arguments
+
+#endif /* CPUFeatures_h */
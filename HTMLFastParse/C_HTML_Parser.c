@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <limits.h>
+#include <stdint.h>
 
 #include "C_HTML_Parser.h"
 #include "t_tag.h"
@@ -17,6 +18,8 @@
 #include "Stack.h"
 #include "entities.h"
 #include "base64.h"
+#include "Arena.h"
+#include "TextScan.h"
 
 //Disable printf
 #define ENABLE_HTML_FASTPARSE_DEBUG 0
@@ -28,13 +31,28 @@
 //Enable reddit tune. Comment this out to remove them
 #define reddit_mode 1;
 
-#define EXPAND_IF_TOO_SMALL(addr, buffer_size, filled_size, new_bytes) do { \
-if (filled_size + new_bytes >= buffer_size) \
-    addr = realloc(addr, buffer_size * 2); \
-} while(0);
+//Grow a buffer geometrically until it can hold at least required_size bytes. If there's no memory the buffer is left as it was and on_failure runs
+#define ENSURE_CAPACITY(arena, addr, buffer_size, required_size, on_failure) do { \
+if ((size_t)(required_size) > (buffer_size)) { \
+    size_t new_buffer_size = (buffer_size) * 2; \
+    while (new_buffer_size < (size_t)(required_size)) new_buffer_size *= 2; \
+    void *new_addr = arenaRealloc(arena, addr, buffer_size, new_buffer_size); \
+    if (!new_addr) { \
+        on_failure; \
+    } \
+    addr = new_addr; \
+    buffer_size = new_buffer_size; \
+} \
+} while(0)
+
+//Initial sizes for the buffers which grow with the input rather than being sized for the worst case
+#define INITIAL_SCRATCH_BUFFER_SIZE 64
+#define INITIAL_TAG_STACK_CAPACITY 16
 
 //Used for encoding the table out of band links
 static const char DATA_URI_PREFIX[] = "data:text/html;charset=utf-8;base64,";
+//Used instead when tables are captured lazily, followed by the table's "start,length" in the input
+static const char TABLE_SOURCE_URI_PREFIX[] = "x-table-source:";
 static const char VIEW_TABLE_TEXT[] = "[View table]\n";
 
 
@@ -69,63 +87,586 @@ int getVisibleByteEffectForCharacter(unsigned char character) {
 }
 
 /**
- Tokenize and extract tag info from the input and then output the cleaned string alongside a tag array with relevant position info
+ Get the number of t_tag structs that tokenizeHTML can write for a given input. Every tag is started by a '<' so this is an upper bound which can be used to size the completedTags buffer
  
  @param input Input text as a char array
  @param inputLength The number of characters (as bytes) to read, excluding the null byte!
- @param completedTags (returned) The array to write the t_format structs to (provides position and tag info). Tags positions are character relative, not byte relative! Usable in NSAttributedString etc
- @param numberOfTags (returned) The number of tags discovered
- @return The displayed text buffer
+ @return The maximum number of tags tokenizeHTML will emit
  */
-char * tokenizeHTML(char *input, size_t inputLength, struct t_tag *completedTags, int *numberOfTags, int *numberOfHumanVisibleCharacters) {
-    size_t displayTextBufferSize = (strnlen(input, inputLength) + 1) * sizeof(char);
-    char *displayText = malloc(displayTextBufferSize);
-    //A stack used for processing tags. The stack size allocates space for x number of POINTERS. Ie this is not creating an overflow vulnerability AFAIK
-    struct Stack* htmlTags = createStack((int)inputLength);
-    //Completed / filled tags
-    //struct t_format completedTags[(int)inputLength];
-    int completedTagsPosition = 0;
+int maximumNumberOfTags(const char *input, size_t inputLength) {
+    int count = 0;
+    const char *end = input + inputLength;
+    for (const char *current = input; (current = memchr(current, '<', end - current)); current++) {
+        count++;
+    }
+    return count;
+}
+
+/**
+ Get the number of t_format structs that makeAttributesLinear can write. Styles can only change where a tag starts or ends so there are at most two boundaries per tag, and never more runs than there are characters.
+ 
+ @param numberOfTags The number of tags returned by tokenizeHTML
+ @param displayTextLength The number of visible characters returned by tokenizeHTML
+ @return The maximum number of simplified tags makeAttributesLinear will emit
+ */
+int maximumNumberOfSimplifiedTags(int numberOfTags, int displayTextLength) {
+    long maximumRuns = 2 * (long)numberOfTags + 1;
+    return maximumRuns < displayTextLength ? (int)maximumRuns : displayTextLength;
+}
+
+//Does the tag text start with a string literal
+#define TAG_HAS_PREFIX(tagText, tagTextLength, literal) ((tagTextLength) >= sizeof(literal) - 1 && memcmp(tagText, literal, sizeof(literal) - 1) == 0)
+
+static inline bool isTagWhitespace(char character) {
+    return character == ' ' || character == '\t' || character == '\n' || character == '\r' || character == '\f';
+}
+
+/**
+ Work out what a tag is from its text. This is done once, when the tag is read, so nothing after the tokenizer has to compare tag names
+ 
+ @param tagText The text between the angle brackets
+ @param tagTextLength The length of tagText
+ @return The t_tag_kind
+ */
+static unsigned char kindForTag(const char *tagText, size_t tagTextLength) {
+    if (tagTextLength == 0) {
+        return TAG_KIND_OTHER;
+    }
+    
+    //switch on the first character to minimize string comparisons
+    switch (tagText[0]) {
+        case 'a':
+            if (TAG_HAS_PREFIX(tagText, tagTextLength, "a href=")) {
+                return TAG_KIND_LINK;
+            }
+            break;
+        case 'b':
+            if (TAG_HAS_PREFIX(tagText, tagTextLength, "blockquote")) {
+                return TAG_KIND_BLOCKQUOTE;
+            }
+            break;
+        case 'c':
+            if (TAG_HAS_PREFIX(tagText, tagTextLength, "code")) {
+                return TAG_KIND_CODE;
+            }
+            break;
+        case 'd':
+            if (TAG_HAS_PREFIX(tagText, tagTextLength, "del")) {
+                return TAG_KIND_DEL;
+            }
+            break;
+        case 'e':
+            if (TAG_HAS_PREFIX(tagText, tagTextLength, "em")) {
+                return TAG_KIND_EM;
+            }
+            break;
+        case 'h':
+            if (tagTextLength >= 2 && tagText[1] >= '1' && tagText[1] <= '6') {
+                return TAG_KIND_H1 + (tagText[1] - '1');
+            }
+            break;
+        case 'l':
+            if (TAG_HAS_PREFIX(tagText, tagTextLength, "li")) {
+                return TAG_KIND_LIST_ITEM;
+            }
+            break;
+        case 'o':
+            if (TAG_HAS_PREFIX(tagText, tagTextLength, "ol")) {
+                return TAG_KIND_ORDERED_LIST;
+            }
+            break;
+        case 's':
+            if (TAG_HAS_PREFIX(tagText, tagTextLength, "strong")) {
+                return TAG_KIND_STRONG;
+            } else if (TAG_HAS_PREFIX(tagText, tagTextLength, "sup")) {
+                return TAG_KIND_SUP;
+            }
+            break;
+        case 't':
+            if (TAG_HAS_PREFIX(tagText, tagTextLength, "table")) {
+                return TAG_KIND_TABLE;
+            } else if (tagTextLength >= 2 && (tagTextLength == 2 || isTagWhitespace(tagText[2]))) {
+                //The whole name has to match here, "thead" isn't a cell
+                switch (tagText[1]) {
+                    case 'r':
+                        return TAG_KIND_TABLE_ROW;
+                    case 'h':
+                        return TAG_KIND_TABLE_HEADER_CELL;
+                    case 'd':
+                        return TAG_KIND_TABLE_DATA_CELL;
+                    default:
+                        break;
+                }
+            }
+            break;
+        case 'u':
+            if (TAG_HAS_PREFIX(tagText, tagTextLength, "ul")) {
+                return TAG_KIND_UNORDERED_LIST;
+            }
+            break;
+        default:
+            break;
+    }
+    return TAG_KIND_OTHER;
+}
+
+/**
+ Find the values of the attributes we record (see t_tag_attribute) in a tag's text
+ 
+ @param tagText The text between the angle brackets
+ @param tagTextLength The length of tagText
+ @param attributes (returned) The value spans, indexed by t_tag_attribute. Must start zeroed
+ @return true if any attribute was found
+ */
+static bool findTagAttributes(const char *tagText, size_t tagTextLength, struct t_tag_span attributes[TAG_ATTRIBUTE_COUNT]) {
+    bool found = false;
+    //Skip the tag name
+    size_t position = 0;
+    while (position < tagTextLength && !isTagWhitespace(tagText[position])) {
+        position++;
+    }
+    
+    while (position < tagTextLength) {
+        while (position < tagTextLength && isTagWhitespace(tagText[position])) {
+            position++;
+        }
+        size_t nameStart = position;
+        while (position < tagTextLength && !isTagWhitespace(tagText[position]) && tagText[position] != '=') {
+            position++;
+        }
+        size_t nameLength = position - nameStart;
+        if (position >= tagTextLength || tagText[position] != '=') {
+            //An attribute without a value (or a stray '/'), which we don't record
+            continue;
+        }
+        
+        //Values are quoted with either kind of quote or run up to the next whitespace
+        position++;
+        char quote = 0x00;
+        if (position < tagTextLength && (tagText[position] == '"' || tagText[position] == '\'')) {
+            quote = tagText[position];
+            position++;
+        }
+        size_t valueStart = position;
+        if (quote) {
+            const char *closingQuote = memchr(tagText + position, quote, tagTextLength - position);
+            position = closingQuote ? (size_t)(closingQuote - tagText) : tagTextLength;
+        } else {
+            while (position < tagTextLength && !isTagWhitespace(tagText[position])) {
+                position++;
+            }
+        }
+        
+        int attribute = -1;
+        if (nameLength == 4 && memcmp(tagText + nameStart, "href", 4) == 0) {
+            attribute = TAG_ATTRIBUTE_HREF;
+        } else if (nameLength == 5 && memcmp(tagText + nameStart, "title", 5) == 0) {
+            attribute = TAG_ATTRIBUTE_TITLE;
+        } else if (nameLength == 5 && memcmp(tagText + nameStart, "align", 5) == 0) {
+            attribute = TAG_ATTRIBUTE_ALIGN;
+        }
+        //The first one wins if an attribute is repeated
+        if (attribute >= 0 && attributes[attribute].start == 0) {
+            attributes[attribute].start = (unsigned int)valueStart;
+            attributes[attribute].length = (unsigned int)(position - valueStart);
+            found = true;
+        }
+        //Step over the closing quote
+        if (quote && position < tagTextLength) {
+            position++;
+        }
+    }
+    return found;
+}
+
+/**
+ Fill in a tag from its text. Only links and tags with attributes we record keep a copy of the text, every other tag is described by its kind alone
+ 
+ @param tag The tag
+ @param tagText The null terminated text between the angle brackets
+ @param tagTextLength The length of tagText
+ @param isInTable Tags inside a table are handled out of band so only links, which can outlive a badly nested table, need their attributes
+ @param arena The arena to copy the text into
+ @return false if there was no memory for the copy. The tag then has no text and none of its attributes
+ */
+static bool describeTag(struct t_tag *tag, const char *tagText, size_t tagTextLength, bool isInTable, struct Arena *arena) {
+    tag->kind = kindForTag(tagText, tagTextLength);
+    bool hasAttributes = (!isInTable || tag->kind == TAG_KIND_LINK) && findTagAttributes(tagText, tagTextLength, tag->attributes);
+    if (tag->kind == TAG_KIND_LINK || hasAttributes) {
+        tag->tag = arenaAlloc(arena, tagTextLength + 1);
+        if (!tag->tag) {
+            return false;
+        }
+        memcpy(tag->tag, tagText, tagTextLength + 1);
+        
+        //Terminate each value where it ends (on its closing quote or the whitespace after it) so it can be used as a string without copying
+        for (int attribute = 0; attribute < TAG_ATTRIBUTE_COUNT; attribute++) {
+            if (tag->attributes[attribute].start > 0) {
+                tag->tag[tag->attributes[attribute].start + tag->attributes[attribute].length] = 0x00;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ Look up an attribute of a tag. Only the attributes in t_tag_attribute are recorded
+ 
+ @param tag The tag
+ @param attribute The attribute
+ @param length (returned, optional) The length of the value
+ @return The null terminated value, which points into the tag's text, or NULL if the tag doesn't have the attribute
+ */
+const char * tagAttribute(const struct t_tag *tag, enum t_tag_attribute attribute, size_t *length) {
+    if (!tag->tag || attribute >= TAG_ATTRIBUTE_COUNT || tag->attributes[attribute].start == 0) {
+        return NULL;
+    }
+    if (length) {
+        *length = tag->attributes[attribute].length;
+    }
+    return tag->tag + tag->attributes[attribute].start;
+}
+
+/**
+ All of the tokenizer's state. Everything which has to survive between two calls to feedTokenizer lives here so that the input can arrive in pieces
+ */
+struct Tokenizer {
+    struct Arena *arena;
+    
+    //The display text. Kept null terminated after every feed
+    char *displayText;
+    size_t displayTextBufferSize;
+    int stringCopyPosition;
+    //Used for applying tokens, DO NOT USE FOR MEMORY WORK. This is used because NSString handles multibyte characters as single characters and not as multiple like we have to
+    int stringVisiblePosition;
+    
+    //Completed / filled tags. Unless this was handed to us by tokenizeHTML it grows as tags are completed
+    struct t_tag *completedTags;
+    size_t completedTagsBufferSize;
+    int completedTagsPosition;
+    bool ownsCompletedTags;
+    
+    //A stack used for processing tags. It grows with the nesting depth so it starts small
+    struct Stack* htmlTags;
+    //Set when the stack had no room for the tag being read (only when memory runs out). Such tags are skipped along with their closing tags so the rest of the nesting stays intact
+    bool isTagUntracked;
+    int numberOfUntrackedTags;
+    bool didDropTags;
+    //Set when a buffer couldn't grow. The input up to that point is kept and the rest is ignored
+    bool isOutOfMemory;
     
     //Used to track if we are currently reading the label of an HTML tag
-    bool isInTag = false;
-    char *tagNameCharArray = malloc(inputLength * sizeof(char) + 1); //+1 for a null byte
-    char *tagNameBuffer = &tagNameCharArray[0];//Hack to get our buffer on the stack because it's a very fast allocation
-    int tagNameCopyPosition = 0;
+    bool isInTag;
+    //The scratch buffers grow to fit the longest tag/entity instead of being sized to the whole input
+    char *tagNameBuffer;
+    size_t tagNameBufferSize;
+    int tagNameCopyPosition;
+    //A '<' was the last byte of a chunk so we can't tell if it opens a tag until the next byte arrives
+    bool isOpeningTagPending;
+    //The offset of the most recent '<' and, when that tag started in an earlier chunk, its raw bytes so far
+    size_t tagStart;
+    char *tagCarryBuffer;
+    size_t tagCarryBufferSize;
+    size_t tagCarryLength;
     
     //If we are reading a table, skip normal behavior since tables are handled out of band
-    bool isInTable = false;
-    //The index of the first byte of the table tag
-    int tableStartI = 0;
+    bool isInTable;
+    //Only record where tables are instead of encoding them. The caller keeps the input to encode a table if it's opened
+    bool capturesTablesLazily;
+    //The offset of the first byte of the table tag
+    size_t tableStart;
+    //The raw table bytes from earlier chunks. Unused when tables are captured lazily
+    char *tableBuffer;
+    size_t tableBufferSize;
+    size_t tableLength;
     
     //Used to track if we are currently reading an HTML entity
-    bool isInHTMLEntity = false;
-    char *htmlEntityCharArray = malloc(inputLength * sizeof(char) + 1); //+1 for a null byte
-    char *htmlEntityBuffer = &htmlEntityCharArray[0];//Hack to get our buffer on the stack because it's a very fast allocation
-    int htmlEntityCopyPosition = 0;
-    
-    int stringCopyPosition = 0;
-    //Used for applying tokens, DO NOT USE FOR MEMORY WORK. This is used because NSString handles multibyte characters as single characters and not as multiple like we have to
-    int stringVisiblePosition = 0;
+    bool isInHTMLEntity;
+    char *htmlEntityBuffer;
+    size_t htmlEntityBufferSize;
+    int htmlEntityCopyPosition;
     
-    char previous = 0x00;
+    char previous;
     //The current index label (i.e. 1,2,3) of the list, USHRT_MAX for unordered
-    unsigned short currentListValue = 0x00;
+    unsigned short currentListValue;
+    
+    //The number of input bytes fed so far, which is the offset of the next chunk
+    size_t inputPosition;
+    bool isFinished;
+    
+    //Previews stop reading once the text is longer than this (INT_MAX otherwise) and cut it back to this length
+    int maximumVisibleCharacters;
+    bool isTruncated;
+};
+
+/**
+ Append bytes to a scratch buffer, growing it as needed
+
+ @param arena The arena which owns the buffer, or NULL
+ @param buffer The buffer (may point to NULL)
+ @param bufferSize The current size of the buffer
+ @param length The number of bytes in use, updated after the append
+ @return false if there was no memory to grow the buffer, in which case nothing is appended
+ */
+static bool appendToBuffer(struct Arena *arena, char **buffer, size_t *bufferSize, size_t *length, const char *bytes, size_t count) {
+    if (count == 0) {
+        return true;
+    }
+    if (!*buffer) {
+        size_t initialSize = count > INITIAL_SCRATCH_BUFFER_SIZE ? count : INITIAL_SCRATCH_BUFFER_SIZE;
+        *buffer = arenaAlloc(arena, initialSize);
+        if (!*buffer) {
+            return false;
+        }
+        *bufferSize = initialSize;
+    } else {
+        ENSURE_CAPACITY(arena, *buffer, *bufferSize, *length + count, return false);
+    }
+    memcpy(*buffer + *length, bytes, count);
+    *length += count;
+    return true;
+}
+
+/**
+ Set up a tokenizer
+
+ @param tokenizer The tokenizer
+ @param displayTextBufferSize The initial size of the display text buffer. tokenizeHTML knows the whole input up front so it can size this exactly
+ @param completedTags A buffer to write the completed tags to which is large enough for every tag, or NULL to have the tokenizer grow its own
+ @param options A combination of t_tokenizer_options
+ @param arena The arena which owns the results, or NULL to use malloc
+ @return false if there was no memory. The tokenizer is then out of memory from the start, feeding it does nothing and it can only be destroyed
+ */
+static bool initTokenizer(struct Tokenizer *tokenizer, size_t displayTextBufferSize, struct t_tag *completedTags, unsigned int options, struct Arena *arena) {
+    memset(tokenizer, 0, sizeof(struct Tokenizer));
+    tokenizer->arena = arena;
+    tokenizer->capturesTablesLazily = (options & TOKENIZER_OPTION_LAZY_TABLES) != 0;
+    tokenizer->displayTextBufferSize = displayTextBufferSize > 0 ? displayTextBufferSize : 1;
+    tokenizer->displayText = arenaAlloc(arena, tokenizer->displayTextBufferSize);
+    tokenizer->completedTags = completedTags;
+    tokenizer->ownsCompletedTags = completedTags == NULL;
+    tokenizer->htmlTags = createStack(INITIAL_TAG_STACK_CAPACITY, arena);
+    tokenizer->tagNameBufferSize = INITIAL_SCRATCH_BUFFER_SIZE;
+    tokenizer->tagNameBuffer = arenaAlloc(arena, tokenizer->tagNameBufferSize);
+    tokenizer->htmlEntityBufferSize = INITIAL_SCRATCH_BUFFER_SIZE;
+    tokenizer->htmlEntityBuffer = arenaAlloc(arena, tokenizer->htmlEntityBufferSize);
+    tokenizer->maximumVisibleCharacters = INT_MAX;
+    if (!tokenizer->displayText || !tokenizer->htmlTags || !tokenizer->tagNameBuffer || !tokenizer->htmlEntityBuffer) {
+        tokenizer->isOutOfMemory = tokenizer->didDropTags = true;
+        return false;
+    }
+    tokenizer->displayText[0] = 0x00;
+    return true;
+}
+
+//Like a failed push, a tag which there's no memory to keep is dropped and the feed reports it
+static void appendCompletedTag(struct Tokenizer *tokenizer, struct t_tag tag) {
+    if (tokenizer->ownsCompletedTags) {
+        size_t requiredSize = (tokenizer->completedTagsPosition + 1) * sizeof(struct t_tag);
+        if (!tokenizer->completedTags) {
+            tokenizer->completedTags = arenaAlloc(tokenizer->arena, INITIAL_TAG_STACK_CAPACITY * sizeof(struct t_tag));
+            if (!tokenizer->completedTags) {
+                goto DROP;
+            }
+            tokenizer->completedTagsBufferSize = INITIAL_TAG_STACK_CAPACITY * sizeof(struct t_tag);
+        } else {
+            ENSURE_CAPACITY(tokenizer->arena, tokenizer->completedTags, tokenizer->completedTagsBufferSize, requiredSize, goto DROP);
+        }
+    }
+    tokenizer->completedTags[tokenizer->completedTagsPosition] = tag;
+    tokenizer->completedTagsPosition++;
+    return;
+    
+DROP:
+    arenaFree(tokenizer->arena, tag.tag);
+    arenaFree(tokenizer->arena, tag.tableData);
+    tokenizer->didDropTags = true;
+}
+
+/**
+ Create a tokenizer for input which arrives in chunks (from the network, for example). Feed it each chunk in order with feedTokenizer and then call finishTokenizer. tokenizeHTML is the same thing with a single chunk.
+
+ @param arena The arena which owns the tokenizer and its results. Pass NULL to use malloc
+ @return The tokenizer, or NULL if there is no memory for it
+ */
+struct Tokenizer* createTokenizer(struct Arena *arena) {
+    return createTokenizerWithOptions(TOKENIZER_OPTION_NONE, arena);
+}
+
+/**
+ Create a tokenizer for input which arrives in chunks, with options
+
+ @param options A combination of t_tokenizer_options
+ @param arena The arena which owns the tokenizer and its results. Pass NULL to use malloc
+ @return The tokenizer, or NULL if there is no memory for it
+ */
+struct Tokenizer* createTokenizerWithOptions(unsigned int options, struct Arena *arena) {
+    struct Tokenizer *tokenizer = arenaAlloc(arena, sizeof(struct Tokenizer));
+    if (!tokenizer) {
+        return NULL;
+    }
+    if (!initTokenizer(tokenizer, INITIAL_SCRATCH_BUFFER_SIZE, NULL, options, arena)) {
+        destroyTokenizer(tokenizer);
+        return NULL;
+    }
+    return tokenizer;
+}
+
+/**
+ Create a tokenizer which only reads enough input for a preview. Once the text is longer than maximumVisibleCharacters it is cut back to that length, the rest of the input is ignored and the tags which are still open are closed at the cut so their formatting is kept
+
+ @param maximumVisibleCharacters The length of the preview
+ @param options A combination of t_tokenizer_options
+ @param arena The arena which owns the tokenizer and its results. Pass NULL to use malloc
+ @return The tokenizer, or NULL if there is no memory for it
+ */
+struct Tokenizer* createPreviewTokenizer(int maximumVisibleCharacters, unsigned int options, struct Arena *arena) {
+    struct Tokenizer *tokenizer = createTokenizerWithOptions(options, arena);
+    if (!tokenizer) {
+        return NULL;
+    }
+    tokenizer->maximumVisibleCharacters = maximumVisibleCharacters > 0 ? maximumVisibleCharacters : 0;
+    return tokenizer;
+}
+
+/**
+ Cut the display text back to the preview length. The text only ever runs past it by the last thing that was added, so this walks back from the end one character at a time
+
+ @param tokenizer The tokenizer, whose display text has already been written back
+ */
+static void truncateTokenizer(struct Tokenizer *tokenizer) {
+    int maximumVisibleCharacters = tokenizer->maximumVisibleCharacters;
+    while (tokenizer->stringVisiblePosition > maximumVisibleCharacters && tokenizer->stringCopyPosition > 0) {
+        //Continuation bytes have no effect, so keep going until the start of the character
+        int effect = 0;
+        while (effect == 0 && tokenizer->stringCopyPosition > 0) {
+            tokenizer->stringCopyPosition--;
+            effect = getVisibleByteEffectForCharacter(tokenizer->displayText[tokenizer->stringCopyPosition]);
+        }
+        tokenizer->stringVisiblePosition -= effect;
+    }
+    tokenizer->displayText[tokenizer->stringCopyPosition] = 0x00;
+    
+    //A table's link also covers the text added for it, which may have been cut
+    unsigned int cut = tokenizer->stringVisiblePosition;
+    for (int i = 0; i < tokenizer->completedTagsPosition; i++) {
+        struct t_tag *tag = &tokenizer->completedTags[i];
+        tag->startPosition = tag->startPosition > cut ? cut : tag->startPosition;
+        tag->endPosition = tag->endPosition > cut ? cut : tag->endPosition;
+    }
+    tokenizer->isTruncated = true;
+}
+
+/**
+ Whether a preview tokenizer has cut its text short
+
+ @param tokenizer The tokenizer
+ @return true once the text has reached the preview length and some of it was left out
+ */
+bool tokenizerIsTruncated(struct Tokenizer *tokenizer) {
+    return tokenizer->isTruncated;
+}
+
+/**
+ Tokenize the next chunk of input. Chunks may be split anywhere, including in the middle of a tag, entity or multibyte character, and the result is the same as tokenizing their concatenation in one go.
+ 
+ Once this returns the display text and completed tags so far are available from tokenizerDisplayText and tokenizerCompletedTags. A tag is only completed once it is closed.
+
+ @param tokenizer The tokenizer
+ @param chunk The next part of the input
+ @param chunkLength The number of bytes in the chunk
+ @return false once memory has run out. If a tag couldn't be tracked it is left out and the text and other tags are unaffected. If a buffer couldn't grow the results stop at that point in the input and later chunks are ignored
+ */
+bool feedTokenizer(struct Tokenizer *tokenizer, const char *chunk, size_t chunkLength) {
+    if (tokenizer->isFinished || tokenizer->isTruncated || tokenizer->isOutOfMemory || chunkLength == 0) {
+        return !tokenizer->didDropTags;
+    }
+    
+    //Work on locals in the loop, writes to the text buffers would otherwise force the compiler to reload all of our state after every byte
+    struct Arena *arena = tokenizer->arena;
+    size_t chunkStart = tokenizer->inputPosition;
+    char *displayText = tokenizer->displayText;
+    size_t displayTextBufferSize = tokenizer->displayTextBufferSize;
+    int stringCopyPosition = tokenizer->stringCopyPosition;
+    int stringVisiblePosition = tokenizer->stringVisiblePosition;
+    struct Stack* htmlTags = tokenizer->htmlTags;
+    bool isInTag = tokenizer->isInTag;
+    char *tagNameBuffer = tokenizer->tagNameBuffer;
+    size_t tagNameBufferSize = tokenizer->tagNameBufferSize;
+    int tagNameCopyPosition = tokenizer->tagNameCopyPosition;
+    bool isInTable = tokenizer->isInTable;
+    bool isInHTMLEntity = tokenizer->isInHTMLEntity;
+    char *htmlEntityBuffer = tokenizer->htmlEntityBuffer;
+    size_t htmlEntityBufferSize = tokenizer->htmlEntityBufferSize;
+    int htmlEntityCopyPosition = tokenizer->htmlEntityCopyPosition;
+    char previous = tokenizer->previous;
+    unsigned short currentListValue = tokenizer->currentListValue;
+    int maximumVisibleCharacters = tokenizer->maximumVisibleCharacters;
+    
+    //Every byte of input produces at most one byte of output, the places that can write more make room for themselves
+    ENSURE_CAPACITY(arena, displayText, displayTextBufferSize, stringCopyPosition + chunkLength + 1, goto OUT_OF_MEMORY);
+    
+    if (tokenizer->isOpeningTagPending) {
+        tokenizer->isOpeningTagPending = false;
+        if (chunk[0] != '/') {
+            struct t_tag format = {.startPosition = stringVisiblePosition, .endPosition = stringVisiblePosition};
+            if (!push(htmlTags, format)) {
+                tokenizer->isTagUntracked = tokenizer->didDropTags = true;
+            }
+        }
+    }
     
-    for (int i = 0; i < inputLength; i++) {
-        char current = input[i];
+    for (size_t i = 0; i < chunkLength; i++) {
+        //Fast paths: plain text is bulk copied and table contents are skipped without looking at each byte
+        if (!isInTag && !isInHTMLEntity) {
+            if (!isInTable) {
+                //A preview is done as soon as it has more text than it needs. Tables are read to the end first so that their link still works
+                if (stringVisiblePosition > maximumVisibleCharacters) {
+                    break;
+                }
+                //No character is more than 4 bytes, so a preview never needs to copy more than this to get past its length
+                size_t scanLength = chunkLength - i;
+                size_t remainingVisibleCharacters = (size_t)(maximumVisibleCharacters - stringVisiblePosition);
+                if (remainingVisibleCharacters < scanLength / 4) {
+                    scanLength = 4 * (remainingVisibleCharacters + 1);
+                }
+                int runVisibleCharacters = 0;
+                size_t runLength = scanTextRun(&chunk[i], scanLength, &runVisibleCharacters);
+                if (runLength > 0) {
+                    memcpy(&displayText[stringCopyPosition], &chunk[i], runLength);
+                    stringCopyPosition += runLength;
+                    stringVisiblePosition += runVisibleCharacters;
+                    previous = chunk[i + runLength - 1];
+                    i += runLength;
+                    if (i >= chunkLength || stringVisiblePosition > maximumVisibleCharacters) {
+                        break;
+                    }
+                }
+            } else {
+                i += scanToTagDelimiter(&chunk[i], chunkLength - i);
+                if (i >= chunkLength) {
+                    break;
+                }
+            }
+        }
+        
+        char current = chunk[i];
         if (current == '<') {
             isInTag = true;
             tagNameCopyPosition = 0;
+            tokenizer->tagStart = chunkStart + i;
+            tokenizer->isTagUntracked = false;
             
             //If there's a next character (data validation) and it's NOT '/' (i.e. we're an open tag) we want to create a new formatter on the stack
-            if (i+1 < inputLength && input[i+1] != '/') {
-                struct t_tag format;
-                format.tag = NULL;
-                format.tableDataLength = 0;
-                format.tableData = NULL;
-                format.startPosition = stringVisiblePosition;
-                format.endPosition = stringVisiblePosition;
-                push(htmlTags, format);
+            if (i+1 < chunkLength) {
+                if (chunk[i+1] != '/') {
+                    struct t_tag format = {.startPosition = stringVisiblePosition, .endPosition = stringVisiblePosition};
+                    if (!push(htmlTags, format)) {
+                        tokenizer->isTagUntracked = tokenizer->didDropTags = true;
+                    }
+                }
+            } else {
+                tokenizer->isOpeningTagPending = true;
             }
             
         } else if (current == '>') {
@@ -134,8 +675,18 @@ char * tokenizeHTML(char *input, size_t inputLength, struct t_tag *completedTags
             //Terminate the buffer
             tagNameBuffer[tagNameCopyPosition] = 0x00;
             
+            if (tokenizer->isTagUntracked) {
+                //There was no room on the stack for this tag, so skip it and remember to skip its closing tag too
+                tokenizer->isTagUntracked = false;
+                if (!(tagNameCopyPosition > 0 && tagNameBuffer[tagNameCopyPosition-1] == '/')) {
+                    tokenizer->numberOfUntrackedTags++;
+                }
+            } else if (tagNameBuffer[0] == '/' && tokenizer->numberOfUntrackedTags > 0) {
+                //The most recent untracked tag is the innermost one, so this closes it
+                tokenizer->numberOfUntrackedTags--;
+            }
             //Are we a closing HTML tag (i.e. the first character in our tag is a '/')
-            if (tagNameBuffer[0] == '/') {
+            else if (tagNameBuffer[0] == '/') {
                 //We are a closing tag, commit
                 struct t_tag* formatP = pop(htmlTags);
                 //Make sure we didn't get a NULL from popping an empty stack
@@ -145,18 +696,36 @@ char * tokenizeHTML(char *input, size_t inputLength, struct t_tag *completedTags
                     //Table commit
                     if (isInTable && strncmp(tagNameBuffer, "/table", 6) == 0) {
                         isInTable = false;
-                        size_t expectedEncodeSize = i - tableStartI + 1;
-                        char *base64Table = malloc(Base64encode_len(expectedEncodeSize));
-                        size_t encodedLength = Base64encode(base64Table, (input + tableStartI), expectedEncodeSize);
-                        if (base64Table) {
-                            format.tableDataLength = encodedLength;
+                        format.tableSourceStart = tokenizer->tableStart;
+                        format.tableSourceLength = chunkStart + i + 1 - tokenizer->tableStart;
+                        if (!tokenizer->capturesTablesLazily) {
+                            //The table is still in this chunk unless it started in an earlier one
+                            const char *table;
+                            size_t expectedEncodeSize;
+                            if (tokenizer->tableStart >= chunkStart) {
+                                table = chunk + (tokenizer->tableStart - chunkStart);
+                                expectedEncodeSize = i - (tokenizer->tableStart - chunkStart) + 1;
+                            } else {
+                                if (!appendToBuffer(arena, &tokenizer->tableBuffer, &tokenizer->tableBufferSize, &tokenizer->tableLength, chunk, i + 1)) {
+                                    arenaFree(arena, format.tag);
+                                    goto OUT_OF_MEMORY;
+                                }
+                                table = tokenizer->tableBuffer;
+                                expectedEncodeSize = tokenizer->tableLength;
+                            }
+                            tokenizer->tableLength = 0;
+                            char *base64Table = arenaAlloc(arena, Base64encode_len(expectedEncodeSize));
+                            if (!base64Table) {
+                                arenaFree(arena, format.tag);
+                                goto OUT_OF_MEMORY;
+                            }
+                            format.tableDataLength = Base64encode(base64Table, table, expectedEncodeSize);
                             format.tableData = base64Table;
                         }
                     }
                     
                     format.endPosition = stringVisiblePosition;
-                    completedTags[completedTagsPosition] = format;
-                    completedTagsPosition++;
+                    appendCompletedTag(tokenizer, format);
                 }
             }
             //Are we a self closing tag like <br/> or <hr/>?
@@ -177,41 +746,42 @@ char * tokenizeHTML(char *input, size_t inputLength, struct t_tag *completedTags
 #endif
                     } else {
                         //We're not a known case, add the tag into the extracted tag array
-                        long tagNameLength = (tagNameCopyPosition + 1) * sizeof(char);
-                        char *newTagBuffer = malloc(tagNameLength);
-                        strncpy(newTagBuffer, tagNameBuffer, tagNameLength);
-                        
-                        formatP->tag = newTagBuffer;
+                        if (!describeTag(formatP, tagNameBuffer, tagNameCopyPosition, isInTable, arena)) {
+                            //Put it back so that it is dropped along with the unfinished tag
+                            push(htmlTags, *formatP);
+                            goto OUT_OF_MEMORY;
+                        }
                         formatP->startPosition = stringVisiblePosition;
                         formatP->endPosition = stringVisiblePosition;
                         
-                        completedTags[completedTagsPosition] = *formatP;
-                        completedTagsPosition++;
+                        appendCompletedTag(tokenizer, *formatP);
                     }
                 }
             } else {
                 //No -- so let's push the operation onto our stack
-                //We've ended the tag definition, so pull the tag from the buffer and push that on to the stack
-                long tagNameLength = (tagNameCopyPosition + 1) * sizeof(char);
-                char *newTagBuffer = malloc(tagNameLength);
-                memset(newTagBuffer, 0x0, tagNameLength);
-                strncpy(newTagBuffer, tagNameBuffer, tagNameLength);
                 struct t_tag* formatP = pop(htmlTags);
                 //Make sure we didn't get a NULL from popping an empty stack
                 //If we end up failing here the text will be horribly mangled however "broken formatting" IMHO is better than a full crash or a sec issue
                 if (formatP) {
-                    formatP->tag = newTagBuffer;
+                    //We've ended the tag definition, so work out what the tag is and push that on to the stack
+                    bool isDescribed = describeTag(formatP, tagNameBuffer, tagNameCopyPosition, isInTable, arena);
+                    //The pop just made room so this can't fail
                     push(htmlTags, *formatP);
+                    if (!isDescribed) {
+                        goto OUT_OF_MEMORY;
+                    }
+                    unsigned char kind = formatP->kind;
                     
                     //Add textual descriptors for order/unordered lists
-                    if (strncmp(newTagBuffer, "ol", 2) == 0) {
+                    if (kind == TAG_KIND_ORDERED_LIST) {
                         //Ordered list
                         currentListValue = 1;
-                    } else if (strncmp(newTagBuffer, "ul", 2) == 0) {
+                    } else if (kind == TAG_KIND_UNORDERED_LIST) {
                         //Unordered list
                         currentListValue = USHRT_MAX;
-                    } else if (strncmp(newTagBuffer, "li", 2) == 0) {
-                        //Apply current list index
+                    } else if (kind == TAG_KIND_LIST_ITEM) {
+                        //Apply current list index. The label can be longer than the tag it replaces so make room for it (and the rest of the chunk) first
+                        ENSURE_CAPACITY(arena, displayText, displayTextBufferSize, stringCopyPosition + sizeof("65535. ") + (chunkLength - i), goto OUT_OF_MEMORY);
                         if (currentListValue == USHRT_MAX) {
                             stringVisiblePosition += 2;
                             displayText[stringCopyPosition++] = 0xE2;
@@ -225,21 +795,27 @@ char * tokenizeHTML(char *input, size_t inputLength, struct t_tag *completedTags
                             currentListValue++;
                         }
                     //We check that we aren't already in a table as nested tables are not supported directly (handled out of band)
-                    } else if (!isInTable && strncmp(tagNameBuffer, "table", 5) == 0) {
+                    } else if (!isInTable && kind == TAG_KIND_TABLE) {
                         isInTable = true;
-                        tableStartI = i - tagNameCopyPosition - 1;
+                        //The table starts at its '<'. The tag name can't be used to find it since entities in the tag are decoded
+                        size_t tableStart = tokenizer->tagStart;
+                        tokenizer->tableStart = tableStart;
+                        //If the tag started in an earlier chunk, its start is only left in the carry buffer
+                        tokenizer->tableLength = 0;
+                        if (tableStart < chunkStart && !tokenizer->capturesTablesLazily) {
+                            if (!appendToBuffer(arena, &tokenizer->tableBuffer, &tokenizer->tableBufferSize, &tokenizer->tableLength, tokenizer->tagCarryBuffer, tokenizer->tagCarryLength)) {
+                                goto OUT_OF_MEMORY;
+                            }
+                        }
                         
                         size_t tablePromptTextWithoutNull = sizeof(VIEW_TABLE_TEXT) - 1;
                         //Since VIEW_TABLE_TEXT is LONGER than the text we're replacing, we can't guarantee it fits.
-                        EXPAND_IF_TOO_SMALL(displayText, displayTextBufferSize, stringCopyPosition, tablePromptTextWithoutNull);
+                        ENSURE_CAPACITY(arena, displayText, displayTextBufferSize, stringCopyPosition + tablePromptTextWithoutNull + (chunkLength - i), goto OUT_OF_MEMORY);
                         memcpy(displayText + stringCopyPosition, VIEW_TABLE_TEXT, tablePromptTextWithoutNull);
                         stringCopyPosition += tablePromptTextWithoutNull;
                         stringVisiblePosition += tablePromptTextWithoutNull;
                         previous = '\n';
                     }
-
-                } else {
-                    free(newTagBuffer);
                 }
             }
             tagNameCopyPosition = 0;
@@ -247,24 +823,26 @@ char * tokenizeHTML(char *input, size_t inputLength, struct t_tag *completedTags
             //We are starting an HTML entity;
             isInHTMLEntity = true;
             htmlEntityCopyPosition = 0;
+            ENSURE_CAPACITY(arena, htmlEntityBuffer, htmlEntityBufferSize, 1, goto OUT_OF_MEMORY);
             htmlEntityBuffer[htmlEntityCopyPosition] = '&';
             htmlEntityCopyPosition++;
         } else if (isInHTMLEntity == true && current == ';' && !isInTable) {
             //We are finishing an HTML entity
             isInHTMLEntity = false;
+            ENSURE_CAPACITY(arena, htmlEntityBuffer, htmlEntityBufferSize, htmlEntityCopyPosition + 1, goto OUT_OF_MEMORY);
             htmlEntityBuffer[htmlEntityCopyPosition] = ';';
             htmlEntityCopyPosition++;
-            htmlEntityBuffer[htmlEntityCopyPosition] = 0x00;
-            htmlEntityCopyPosition++;
             
             //Are we decoding into a tag (i.e. into the url portion of <a href='http://test/forks?t=yes&f=no'/>
             if (isInTag) {
-                //Yes!
-                size_t numberDecodedBytes = decode_html_entities_utf8(&tagNameBuffer[tagNameCopyPosition], htmlEntityBuffer);
+                //Yes! Decoding never grows the entity so this is enough room for the decoded bytes and the null
+                ENSURE_CAPACITY(arena, tagNameBuffer, tagNameBufferSize, tagNameCopyPosition + htmlEntityCopyPosition + 1, goto OUT_OF_MEMORY);
+                size_t numberDecodedBytes = decode_html_entity_utf8(&tagNameBuffer[tagNameCopyPosition], htmlEntityBuffer, htmlEntityCopyPosition);
                 tagNameCopyPosition += numberDecodedBytes;
             }else {
                 //Expand into regular text
-                size_t numberDecodedBytes = decode_html_entities_utf8(&displayText[stringCopyPosition], htmlEntityBuffer);
+                ENSURE_CAPACITY(arena, displayText, displayTextBufferSize, stringCopyPosition + htmlEntityCopyPosition + (chunkLength - i), goto OUT_OF_MEMORY);
+                size_t numberDecodedBytes = decode_html_entity_utf8(&displayText[stringCopyPosition], htmlEntityBuffer, htmlEntityCopyPosition);
                 for (unsigned long decodedI = 0; decodedI < numberDecodedBytes; decodedI++) {
                     //Add the visual effect for each character. This lets us also handle when decode sends back a tag it can't decode.
                     //Also helpful incase we have codes which decode to multiple characters, which could happen
@@ -277,9 +855,12 @@ char * tokenizeHTML(char *input, size_t inputLength, struct t_tag *completedTags
             //copy in to the right buffer
             //this is a priority list (i.e. decoding an entity before going in to a tag before going in to visible)
             if (isInHTMLEntity) {
+                ENSURE_CAPACITY(arena, htmlEntityBuffer, htmlEntityBufferSize, htmlEntityCopyPosition + 1, goto OUT_OF_MEMORY);
                 htmlEntityBuffer[htmlEntityCopyPosition] = current;
                 htmlEntityCopyPosition++;
             } else if (isInTag) {
+                //+1 so that there is always room to terminate the buffer
+                ENSURE_CAPACITY(arena, tagNameBuffer, tagNameBufferSize, tagNameCopyPosition + 2, goto OUT_OF_MEMORY);
                 tagNameBuffer[tagNameCopyPosition] = current;
                 tagNameCopyPosition++;
             } else if (isInTable) {
@@ -303,285 +884,1115 @@ char * tokenizeHTML(char *input, size_t inputLength, struct t_tag *completedTags
         }
     }
     
+    //Keep whatever the next chunk may need from this one: the raw bytes of an open table and of an unfinished tag (which may turn out to be a table)
+    if (isInTable && !tokenizer->capturesTablesLazily) {
+        if (tokenizer->tableStart >= chunkStart) {
+            tokenizer->tableLength = 0;
+            if (!appendToBuffer(arena, &tokenizer->tableBuffer, &tokenizer->tableBufferSize, &tokenizer->tableLength, chunk + (tokenizer->tableStart - chunkStart), chunkLength - (tokenizer->tableStart - chunkStart))) {
+                goto OUT_OF_MEMORY;
+            }
+        } else if (!appendToBuffer(arena, &tokenizer->tableBuffer, &tokenizer->tableBufferSize, &tokenizer->tableLength, chunk, chunkLength)) {
+            goto OUT_OF_MEMORY;
+        }
+    }
+    if (isInTag) {
+        if (tokenizer->tagStart >= chunkStart) {
+            tokenizer->tagCarryLength = 0;
+            if (!appendToBuffer(arena, &tokenizer->tagCarryBuffer, &tokenizer->tagCarryBufferSize, &tokenizer->tagCarryLength, chunk + (tokenizer->tagStart - chunkStart), chunkLength - (tokenizer->tagStart - chunkStart))) {
+                goto OUT_OF_MEMORY;
+            }
+        } else if (!appendToBuffer(arena, &tokenizer->tagCarryBuffer, &tokenizer->tagCarryBufferSize, &tokenizer->tagCarryLength, chunk, chunkLength)) {
+            goto OUT_OF_MEMORY;
+        }
+    }
+    
+    goto WRITE_BACK;
+    
+OUT_OF_MEMORY:
+    //Keep what was read so far, every write above made room for the terminator before writing
+    tokenizer->isOutOfMemory = tokenizer->didDropTags = true;
+    
+WRITE_BACK:
+    displayText[stringCopyPosition] = 0x00;
+    
+    tokenizer->inputPosition = chunkStart + chunkLength;
+    tokenizer->displayText = displayText;
+    tokenizer->displayTextBufferSize = displayTextBufferSize;
+    tokenizer->stringCopyPosition = stringCopyPosition;
+    tokenizer->stringVisiblePosition = stringVisiblePosition;
+    tokenizer->isInTag = isInTag;
+    tokenizer->tagNameBuffer = tagNameBuffer;
+    tokenizer->tagNameBufferSize = tagNameBufferSize;
+    tokenizer->tagNameCopyPosition = tagNameCopyPosition;
+    tokenizer->isInTable = isInTable;
+    tokenizer->isInHTMLEntity = isInHTMLEntity;
+    tokenizer->htmlEntityBuffer = htmlEntityBuffer;
+    tokenizer->htmlEntityBufferSize = htmlEntityBufferSize;
+    tokenizer->htmlEntityCopyPosition = htmlEntityCopyPosition;
+    tokenizer->previous = previous;
+    tokenizer->currentListValue = currentListValue;
+    if (stringVisiblePosition > maximumVisibleCharacters && !isInTag && !isInTable && !isInHTMLEntity) {
+        truncateTokenizer(tokenizer);
+    }
+    return !tokenizer->didDropTags;
+}
+
+/**
+ The display text produced so far. It is null terminated and only valid until the next call to feedTokenizer or finishTokenizer
+
+ @param tokenizer The tokenizer
+ @param numberOfHumanVisibleCharacters (returned) The number of visible characters in the text
+ @return The display text, owned by the tokenizer
+ */
+const char * tokenizerDisplayText(struct Tokenizer *tokenizer, int *numberOfHumanVisibleCharacters) {
+    *numberOfHumanVisibleCharacters = tokenizer->stringVisiblePosition;
+    return tokenizer->displayText;
+}
+
+/**
+ The tags completed so far, in the order tokenizeHTML would return them. Later chunks only ever add tags to the end. Only valid until the next call to feedTokenizer or finishTokenizer.
+ 
+ makeAttributesLinear releases the tags it is given, so to flatten the text so far pass them to makeAttributesLinearWithArena with an arena, which leaves them intact.
+
+ @param tokenizer The tokenizer
+ @param numberOfTags (returned) The number of tags
+ @return The tags, owned by the tokenizer
+ */
+const struct t_tag * tokenizerCompletedTags(struct Tokenizer *tokenizer, int *numberOfTags) {
+    *numberOfTags = tokenizer->completedTagsPosition;
+    return tokenizer->completedTags;
+}
+
+//Drop the tags which were never finished (or close them at the cut of a preview). No more input can arrive after this
+static void closeTokenizer(struct Tokenizer *tokenizer) {
+    if (tokenizer->isFinished) {
+        return;
+    }
+    tokenizer->isFinished = true;
+    //A trailing '<' never gets to open a tag
+    tokenizer->isOpeningTagPending = false;
+    
+    //A preview which ran past its length inside a table or a tag at the very end of the input hasn't been cut yet
+    if (!tokenizer->isTruncated && tokenizer->stringVisiblePosition > tokenizer->maximumVisibleCharacters) {
+        truncateTokenizer(tokenizer);
+    }
+    
     //Check if the last tag is incomplete (i.e. "blah blah <tag") so we can remove the unfinished tag from the stack
-    if (tagNameCopyPosition > 0) {
+    if (tokenizer->tagNameCopyPosition > 0 && !tokenizer->isTagUntracked && tokenizer->htmlTags) {
         printf("!!! Found incomplete tag, popping and continuing...");
-        pop(htmlTags);
+        //Memory can run out after a tag was described but before the tag name was cleared, leaving it with text
+        struct t_tag *incomplete = pop(tokenizer->htmlTags);
+        if (incomplete) {
+            arenaFree(tokenizer->arena, incomplete->tag);
+        }
+    }
+    
+    //A tokenizer which never got its buffers has no output and nothing open
+    if (!tokenizer->displayText || !tokenizer->htmlTags) {
+        return;
     }
     
     //and now terminate our output.
-    displayText[stringCopyPosition] = 0x00;
+    tokenizer->displayText[tokenizer->stringCopyPosition] = 0x00;
     
     //Run through the unclosed tags so we can either process them and or free them
-    while (!isEmpty(htmlTags)) {
-        struct t_tag* formatP = pop(htmlTags);
+    while (!isEmpty(tokenizer->htmlTags)) {
+        struct t_tag* formatP = pop(tokenizer->htmlTags);
         //Make sure we didn't get a NULL from popping an empty stack
         if (formatP != NULL) {
             struct t_tag in = *formatP;
-            printf("!!! UNCLOSED TAG: %s starts at %i ends at %i\n", in.tag, in.startPosition,in.endPosition);
-            free(in.tag);
+            if (tokenizer->isTruncated && in.startPosition < (unsigned int)tokenizer->stringVisiblePosition) {
+                //A preview was cut off inside this tag, it ends where the text does
+                in.endPosition = tokenizer->stringVisiblePosition;
+                appendCompletedTag(tokenizer, in);
+                continue;
+            }
+            printf("!!! UNCLOSED TAG: %i starts at %i ends at %i\n", in.kind, in.startPosition,in.endPosition);
+            arenaFree(tokenizer->arena, in.tag);
         }
     }
     
     //Now print out all tags
     
 #if ENABLE_HTML_FASTPARSE_DEBUG
-    for (int i = 0; i < completedTagsPosition; i++) {
-        struct t_tag inTag = completedTags[i];
-        printf("TAG: %s starts at %i ends at %i\n", inTag.tag, inTag.startPosition,inTag.endPosition);
+    for (int i = 0; i < tokenizer->completedTagsPosition; i++) {
+        struct t_tag inTag = tokenizer->completedTags[i];
+        printf("TAG: %i starts at %i ends at %i\n", inTag.kind, inTag.startPosition,inTag.endPosition);
     }
 #endif
-    
-    *numberOfTags = completedTagsPosition;
-    *numberOfHumanVisibleCharacters = stringVisiblePosition;
-    
-    //Release everything that's not necessary
-    prepareForFree(htmlTags);
-    free(htmlTags);
-    free(tagNameCharArray);
-    free(htmlEntityCharArray);
-    
-    return displayText;
 }
 
-void print_t_format(struct t_format format) {
-    printf("Format [%i,%i): Bold %i, Italic %i, Struck %i, Code %i, Exponent %i, Quote %i, H%i, ListNest %i LinkURL %s\n",format.startPosition, format.endPosition, FORMAT_TAG_GET_BIT_FIELD(format.formatTag, FORMAT_TAG_IS_BOLD), FORMAT_TAG_GET_BIT_FIELD(format.formatTag, FORMAT_TAG_IS_ITALICS), FORMAT_TAG_GET_BIT_FIELD(format.formatTag, FORMAT_TAG_IS_STRUCK), FORMAT_TAG_GET_BIT_FIELD(format.formatTag, FORMAT_TAG_IS_CODE), format.exponentLevel, format.quoteLevel, FORMAT_TAG_GET_H_LEVEL(format.formatTag), format.listNestLevel, format.linkURL);
+//Release everything that's not part of the result
+static void releaseTokenizerScratch(struct Tokenizer *tokenizer) {
+    struct Arena *arena = tokenizer->arena;
+    if (tokenizer->htmlTags) {
+        prepareForFree(tokenizer->htmlTags);
+    }
+    arenaFree(arena, tokenizer->htmlTags);
+    arenaFree(arena, tokenizer->tagNameBuffer);
+    arenaFree(arena, tokenizer->htmlEntityBuffer);
+    arenaFree(arena, tokenizer->tagCarryBuffer);
+    arenaFree(arena, tokenizer->tableBuffer);
+    tokenizer->htmlTags = NULL;
+    tokenizer->tagNameBuffer = tokenizer->htmlEntityBuffer = tokenizer->tagCarryBuffer = tokenizer->tableBuffer = NULL;
 }
 
+/**
+ Feed a tokenizer its whole input and hand over the results, for the functions which tokenize in one go
+
+ @param tokenizer The tokenizer, set up with initTokenizer
+ @param input Input text as a char array
+ @param inputLength The number of characters (as bytes) to read, excluding the null byte!
+ @param numberOfTags (returned) The number of tags discovered
+ @param numberOfHumanVisibleCharacters (returned) The number of visible characters in the display text
+ @return The displayed text buffer, or NULL if memory ran out at any point. Nothing is left to free then
+ */
+static char * tokenizeSingleChunk(struct Tokenizer *tokenizer, char *input, size_t inputLength, int *numberOfTags, int *numberOfHumanVisibleCharacters) {
+    feedTokenizer(tokenizer, input, inputLength);
+    closeTokenizer(tokenizer);
+    releaseTokenizerScratch(tokenizer);
+    
+    if (tokenizer->isOutOfMemory) {
+        //The tags array is the caller's, but what the tags point to isn't
+        for (int i = 0; i < tokenizer->completedTagsPosition; i++) {
+            arenaFree(tokenizer->arena, tokenizer->completedTags[i].tag);
+            arenaFree(tokenizer->arena, tokenizer->completedTags[i].tableData);
+        }
+        arenaFree(tokenizer->arena, tokenizer->displayText);
+        *numberOfTags = 0;
+        *numberOfHumanVisibleCharacters = 0;
+        return NULL;
+    }
+    *numberOfTags = tokenizer->completedTagsPosition;
+    *numberOfHumanVisibleCharacters = tokenizer->stringVisiblePosition;
+    return tokenizer->displayText;
+}
 
 /**
- Compare two t_formats. Returns 0 for the same, 1 if different in anyway
- 
- @param format1 The first t_format struct
- @param format2 The second t_format struct
- @return 0 or 1
+ Finish tokenizing and hand the results over to the caller. The results are the same as tokenizeHTML would give for the whole input.
+
+ @param tokenizer The tokenizer. It still needs to be destroyed afterwards
+ @param completedTags (returned) The completed tags, which the caller now owns (free the array and each tag as with tokenizeHTML). NULL if there are none
+ @param numberOfTags (returned) The number of tags
+ @param numberOfHumanVisibleCharacters (returned) The number of visible characters in the display text
+ @return The displayed text buffer, which the caller now owns
  */
-int t_format_cmp(struct t_format format1,struct t_format format2) {
-    //ints are 4 bytes, which covers all the packed properties and the other sizes
-    //this is packing safe (in theory) because chars never cause padding
-    //Tip from one of the LLVM people at WWDC`18
-    int format1Sum = *(((int*)&format1.formatTag));
-    int format2Sum = *(((int*)&format2.formatTag));
+char * finishTokenizer(struct Tokenizer *tokenizer, struct t_tag **completedTags, int *numberOfTags, int *numberOfHumanVisibleCharacters) {
+    closeTokenizer(tokenizer);
+    *completedTags = tokenizer->completedTags;
+    *numberOfTags = tokenizer->completedTagsPosition;
+    *numberOfHumanVisibleCharacters = tokenizer->stringVisiblePosition;
+    char *displayText = tokenizer->displayText;
+    
+    //The caller owns these now
+    tokenizer->completedTags = NULL;
+    tokenizer->completedTagsPosition = 0;
+    tokenizer->displayText = NULL;
+    return displayText;
+}
 
-    if (format1Sum != format2Sum) {
-        return 1;
-    } else if (format1.linkURL != format2.linkURL || (format1.linkURL != NULL && format2.linkURL != NULL && strcmp(format1.linkURL, format2.linkURL) != 0)) {
-        return 1;
-    } else {
-        return 0;
+/**
+ Destroy a tokenizer. If it was never finished, the results so far are released too
+
+ @param tokenizer The tokenizer
+ */
+void destroyTokenizer(struct Tokenizer *tokenizer) {
+    if (!tokenizer) {
+        return;
     }
+    struct Arena *arena = tokenizer->arena;
+    closeTokenizer(tokenizer);
+    releaseTokenizerScratch(tokenizer);
+    for (int i = 0; i < tokenizer->completedTagsPosition; i++) {
+        arenaFree(arena, tokenizer->completedTags[i].tag);
+        arenaFree(arena, tokenizer->completedTags[i].tableData);
+    }
+    arenaFree(arena, tokenizer->completedTags);
+    arenaFree(arena, tokenizer->displayText);
+    arenaFree(arena, tokenizer);
 }
 
+/**
+ Tokenize and extract tag info from the input and then output the cleaned string alongside a tag array with relevant position info
+ 
+ @param input Input text as a char array
+ @param inputLength The number of characters (as bytes) to read, excluding the null byte!
+ @param completedTags (returned) The array to write the t_format structs to (provides position and tag info). Tags positions are character relative, not byte relative! Usable in NSAttributedString etc. Must have room for maximumNumberOfTags(input, inputLength) tags
+ @param numberOfTags (returned) The number of tags discovered
+ @return The displayed text buffer, or NULL if there was no memory
+ */
+char * tokenizeHTML(char *input, size_t inputLength, struct t_tag *completedTags, int *numberOfTags, int *numberOfHumanVisibleCharacters) {
+    return tokenizeHTMLWithArena(input, inputLength, completedTags, numberOfTags, numberOfHumanVisibleCharacters, NULL);
+}
 
 /**
- Takes in overlapping t_format tags and simplifies them into 1D range suitable for use in NSAttributedString. Destroys inputTags in the process!
+ Tokenize and extract tag info from the input, placing every allocation (display text, tag names, table data and scratch space) in an arena
  
- @param inputTags Overlapping tags buffer (given by tokenizeHTML)
- @param numberOfInputTags The number of inputTags
- @param simplifiedTags (return) Simplified tags buffer (return value)
- @param numberOfSimplifiedTags (return) the number of found simplified tags
- @param displayTextLength The size of the text that we will be applying these tags to
+ @param input Input text as a char array
+ @param inputLength The number of characters (as bytes) to read, excluding the null byte!
+ @param completedTags (returned) The array to write the t_format structs to. The tag and table data they point to is owned by the arena
+ @param numberOfTags (returned) The number of tags discovered
+ @param arena The arena which owns the results. Pass NULL to use malloc, in which case the caller frees the results as with tokenizeHTML
+ @return The displayed text buffer, owned by the arena. NULL if there was no memory
  */
-void makeAttributesLinear(struct t_tag inputTags[], int numberOfInputTags, struct t_format simplifiedTags[], int* numberOfSimplifiedTags, int displayTextLength) {
-    //Create our state array
-    size_t bufferSize = displayTextLength * sizeof(struct t_format);
-    struct t_format *displayTextFormat = malloc(bufferSize);
-    //Init everything to zero in a single pass memory zero
-    memset(displayTextFormat, 0, bufferSize);
-    
-    //Apply format from each tag
+char * tokenizeHTMLWithArena(char *input, size_t inputLength, struct t_tag *completedTags, int *numberOfTags, int *numberOfHumanVisibleCharacters, struct Arena *arena) {
+    return tokenizeHTMLWithOptions(input, inputLength, completedTags, numberOfTags, numberOfHumanVisibleCharacters, TOKENIZER_OPTION_NONE, arena);
+}
+
+/**
+ Tokenize and extract tag info from the input, with options
+ 
+ @param input Input text as a char array
+ @param inputLength The number of characters (as bytes) to read, excluding the null byte!
+ @param completedTags (returned) The array to write the t_format structs to. Must have room for maximumNumberOfTags(input, inputLength) tags
+ @param numberOfTags (returned) The number of tags discovered
+ @param options A combination of t_tokenizer_options. With TOKENIZER_OPTION_LAZY_TABLES keep the input around for as long as its tables may be opened
+ @param arena The arena which owns the results. Pass NULL to use malloc, in which case the caller frees the results as with tokenizeHTML
+ @return The displayed text buffer, or NULL if there was no memory
+ */
+char * tokenizeHTMLWithOptions(char *input, size_t inputLength, struct t_tag *completedTags, int *numberOfTags, int *numberOfHumanVisibleCharacters, unsigned int options, struct Arena *arena) {
+    //The whole input is a single chunk, so the display text can be sized up front and the tags written straight into the caller's buffer
+    struct Tokenizer tokenizer;
+    initTokenizer(&tokenizer, inputLength + 1, completedTags, options, arena);
+    return tokenizeSingleChunk(&tokenizer, input, inputLength, numberOfTags, numberOfHumanVisibleCharacters);
+}
+
+/**
+ Tokenize only as much of the input as a preview needs. Once the text is longer than maximumVisibleCharacters it is cut back to that length and the rest of the input is never read. Tags which are still open at the cut are closed there so their formatting is kept
+ 
+ @param input Input text as a char array
+ @param inputLength The number of characters (as bytes) to read, excluding the null byte!
+ @param completedTags (returned) The array to write the t_format structs to. Must have room for maximumNumberOfTags(input, inputLength) tags
+ @param numberOfTags (returned) The number of tags discovered
+ @param maximumVisibleCharacters The length of the preview
+ @param isTruncated (returned) Whether any of the text was left out. May be NULL
+ @param options A combination of t_tokenizer_options
+ @param arena The arena which owns the results. Pass NULL to use malloc, in which case the caller frees the results as with tokenizeHTML
+ @return The displayed text buffer, or NULL if there was no memory
+ */
+char * tokenizeHTMLPreview(char *input, size_t inputLength, struct t_tag *completedTags, int *numberOfTags, int *numberOfHumanVisibleCharacters, int maximumVisibleCharacters, bool *isTruncated, unsigned int options, struct Arena *arena) {
+    struct Tokenizer tokenizer;
+    initTokenizer(&tokenizer, inputLength + 1, completedTags, options, arena);
+    tokenizer.maximumVisibleCharacters = maximumVisibleCharacters > 0 ? maximumVisibleCharacters : 0;
+    char *displayText = tokenizeSingleChunk(&tokenizer, input, inputLength, numberOfTags, numberOfHumanVisibleCharacters);
+    if (isTruncated) {
+        *isTruncated = displayText && tokenizer.isTruncated;
+    }
+    return displayText;
+}
+
+/**
+ Check whether the input is plain text: no tags, no entities and nothing else the tokenizer would change. Plain text is its own display text with a single unstyled run, so tokenizeHTML's buffers and makeAttributesLinear can be skipped entirely
+ 
+ @param input Input text as a char array
+ @param inputLength The number of characters (as bytes) to read, excluding the null byte!
+ @param run (returned) Storage for the single run, result's formats points here
+ @param result (returned) The parse result if the input is plain text. Its display text is input itself (borrowed, not copied) so it is only null terminated if input is and it lives only as long as input does. There are no links to free
+ @return true if the input is plain text, otherwise parse it as usual
+ */
+bool parsePlainText(const char *input, size_t inputLength, struct t_format *run, struct t_parse_result *result) {
+    int numberOfHumanVisibleCharacters = 0;
+    size_t position = 0;
+    while (position < inputLength) {
+        position += scanTextRun(&input[position], inputLength - position, &numberOfHumanVisibleCharacters);
+        if (position >= inputLength) {
+            break;
+        }
+        //scanTextRun stops at markup and at new lines, only the new lines can still be plain text
+        if (input[position] != '\n') {
+            return false;
+        }
+#ifdef reddit_mode
+        //The tokenizer drops this new line (see feedTokenizer)
+        if ((position > 0 && input[position - 1] == '\n') || numberOfHumanVisibleCharacters <= 1) {
+            return false;
+        }
+#endif
+        numberOfHumanVisibleCharacters++;
+        position++;
+    }
+    
+    memset(run, 0, sizeof(struct t_format));
+    run->endPosition = numberOfHumanVisibleCharacters;
+    
+    result->displayText = (char *)input;
+    result->numberOfHumanVisibleCharacters = numberOfHumanVisibleCharacters;
+    //Same as makeAttributesLinear, which has no runs to give for empty text
+    result->formats = run;
+    result->numberOfFormats = numberOfHumanVisibleCharacters > 0 ? 1 : 0;
+    result->links.urls = NULL;
+    result->links.numberOfURLs = 0;
+    return true;
+}
+
+/**
+ Write the link of a lazily captured table, which tableSourceForLinkURL reads back
+
+ @param url (returned) Where to write the link. May be NULL to find out how long it is
+ @param urlSize The number of bytes url has room for, including the null byte
+ @param start The byte offset of the table's raw HTML in the input
+ @param length The number of bytes of raw HTML
+ @return The length of the link, excluding the null byte
+ */
+size_t tableSourceLinkURL(char *url, size_t urlSize, size_t start, size_t length) {
+    return snprintf(url, urlSize, "%s%zu,%zu", TABLE_SOURCE_URI_PREFIX, start, length);
+}
+
+/**
+ Find the table a lazily captured table's link points to
+
+ @param linkURL A link URL from the link table
+ @param start (returned) The byte offset of the table's raw HTML in the input
+ @param length (returned) The number of bytes of raw HTML
+ @return true if the link is a lazily captured table
+ */
+bool tableSourceForLinkURL(const char *linkURL, size_t *start, size_t *length) {
+    size_t prefixWithoutNull = sizeof(TABLE_SOURCE_URI_PREFIX) - 1;
+    if (!linkURL || strncmp(linkURL, TABLE_SOURCE_URI_PREFIX, prefixWithoutNull) != 0) {
+        return false;
+    }
+    char *end;
+    const char *numbers = linkURL + prefixWithoutNull;
+    unsigned long long parsedStart = strtoull(numbers, &end, 10);
+    if (end == numbers || *end != ',') {
+        return false;
+    }
+    numbers = end + 1;
+    unsigned long long parsedLength = strtoull(numbers, &end, 10);
+    if (end == numbers || *end != 0x00) {
+        return false;
+    }
+    *start = (size_t)parsedStart;
+    *length = (size_t)parsedLength;
+    return true;
+}
+
+/**
+ Copy a lazily captured table's raw HTML out of the input
+
+ @param input The input the table was tokenized from
+ @param inputLength The number of bytes in the input
+ @param start The table's tableSourceStart
+ @param length The table's tableSourceLength
+ @return The null terminated HTML, which the caller frees. NULL if the table isn't inside the input
+ */
+char * tableHTMLForSource(const char *input, size_t inputLength, size_t start, size_t length) {
+    if (start > inputLength || length > inputLength - start) {
+        return NULL;
+    }
+    char *html = malloc(length + 1);
+    if (!html) {
+        return NULL;
+    }
+    memcpy(html, input + start, length);
+    html[length] = 0x00;
+    return html;
+}
+
+/**
+ Encode a lazily captured table as the same data URI link an eagerly captured table gets
+
+ @param input The input the table was tokenized from
+ @param inputLength The number of bytes in the input
+ @param start The table's tableSourceStart
+ @param length The table's tableSourceLength
+ @return The null terminated data URI, which the caller frees. NULL if the table isn't inside the input
+ */
+char * tableDataURIForSource(const char *input, size_t inputLength, size_t start, size_t length) {
+    if (start > inputLength || length > inputLength - start) {
+        return NULL;
+    }
+    size_t dataURIPrefixWithoutNull = sizeof(DATA_URI_PREFIX) - 1;
+    char *url = malloc(dataURIPrefixWithoutNull + Base64encode_len(length));
+    if (!url) {
+        return NULL;
+    }
+    memcpy(url, DATA_URI_PREFIX, dataURIPrefixWithoutNull);
+    Base64encode(url + dataURIPrefixWithoutNull, input + start, length);
+    return url;
+}
+
+void print_t_format(struct t_format format) {
+    printf("Format [%i,%i): Bold %i, Italic %i, Struck %i, Code %i, Exponent %i, Quote %i, H%i, ListNest %i Link %u\n",format.startPosition, format.endPosition, FORMAT_TAG_GET_BIT_FIELD(format.formatTag, FORMAT_TAG_IS_BOLD), FORMAT_TAG_GET_BIT_FIELD(format.formatTag, FORMAT_TAG_IS_ITALICS), FORMAT_TAG_GET_BIT_FIELD(format.formatTag, FORMAT_TAG_IS_STRUCK), FORMAT_TAG_GET_BIT_FIELD(format.formatTag, FORMAT_TAG_IS_CODE), format.exponentLevel, format.quoteLevel, FORMAT_TAG_GET_H_LEVEL(format.formatTag), format.listNestLevel, format.linkIndex);
+}
+
+
+/**
+ Compare two t_formats. Returns 0 for the same, 1 if different in anyway
+ 
+ @param format1 The first t_format struct
+ @param format2 The second t_format struct
+ @return 0 or 1
+ */
+int t_format_cmp(struct t_format format1,struct t_format format2) {
+    //Compared field by field, compilers combine the four byte compares into one
+    if (format1.formatTag != format2.formatTag || format1.exponentLevel != format2.exponentLevel || format1.quoteLevel != format2.quoteLevel || format1.listNestLevel != format2.listNestLevel) {
+        return 1;
+    } else if (format1.linkIndex != format2.linkIndex) {
+        //Link URLs are deduplicated so the same URL always has the same index
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+
+//What a single tag does to the text it covers
+enum t_style_effect_kind {
+    STYLE_EFFECT_FORMAT_BIT,
+    STYLE_EFFECT_HEADER,
+    STYLE_EFFECT_EXPONENT,
+    STYLE_EFFECT_QUOTE,
+    STYLE_EFFECT_LIST,
+    STYLE_EFFECT_LINK
+};
+
+struct t_style_effect {
+    unsigned char kind;
+    //The formatTag bit offset for STYLE_EFFECT_FORMAT_BIT, the level for STYLE_EFFECT_HEADER
+    unsigned char value;
+    //Set when linkURL was allocated for the effect rather than pointing into the tag's text
+    bool ownsLinkURL;
+    char *linkURL;
+    //The URL's t_format linkIndex, 0 until a run uses it
+    unsigned int linkIndex;
+};
+
+//Deduplicates a document's link URLs as runs start using them
+struct t_link_interner {
+    //Open addressing. Each slot holds a linkIndex, or 0 if it is empty
+    unsigned int *slots;
+    size_t slotMask;
+    //The distinct URLs in the order they were first used. They point at the effects' URLs
+    const char **urls;
+    size_t *urlLengths;
+    int numberOfURLs;
+    size_t totalURLSize;
+};
+
+//A position where an effect starts (delta = 1) or stops (delta = -1) applying
+struct t_style_boundary {
+    unsigned int position;
+    int effectIndex;
+    int delta;
+};
+
+//The styles active at the current sweep position
+struct t_style_state {
+    int formatBitCounts[8];
+    int headerLevelCounts[10];
+    int exponentLevel;
+    int quoteLevel;
+    int listNestLevel;
+    
+    //When links overlap the one which was closed last wins (matching the order tags are applied in), so we keep a max heap of active link effect indices. Links which have ended are lazily removed when they reach the top
+    int *linkHeap;
+    int linkHeapCount;
+    bool *isLinkActive;
+};
+
+static int t_style_boundary_cmp(const void *a, const void *b) {
+    unsigned int positionA = ((const struct t_style_boundary *)a)->position;
+    unsigned int positionB = ((const struct t_style_boundary *)b)->position;
+    return (positionA > positionB) - (positionA < positionB);
+}
+
+/**
+ Work out which style a tag applies
+ 
+ @param tag The tag
+ @param effect (return) The style the tag applies
+ @param arena The arena to allocate link URLs in
+ @return true if the tag changes the style of its text. A link effect without a linkURL means there was no memory for it
+ */
+static bool styleEffectForTag(const struct t_tag *tag, struct t_style_effect *effect, struct Arena *arena) {
+    effect->linkURL = NULL;
+    effect->ownsLinkURL = false;
+    effect->linkIndex = 0;
+    switch (tag->kind) {
+        case TAG_KIND_LINK: {
+            //The URL is used straight out of the tag text
+            const char *url = tagAttribute(tag, TAG_ATTRIBUTE_HREF, NULL);
+            if (!url) {
+                break;
+            }
+            effect->kind = STYLE_EFFECT_LINK;
+            effect->linkURL = (char *)url;
+            return true;
+        }
+        case TAG_KIND_BLOCKQUOTE:
+            //Increase quote level
+            effect->kind = STYLE_EFFECT_QUOTE;
+            return true;
+        case TAG_KIND_CODE:
+            //Apply CODE! to all
+            effect->kind = STYLE_EFFECT_FORMAT_BIT;
+            effect->value = FORMAT_TAG_IS_CODE_OFFSET;
+            return true;
+        case TAG_KIND_DEL:
+            //Apply strike to all
+            effect->kind = STYLE_EFFECT_FORMAT_BIT;
+            effect->value = FORMAT_TAG_IS_STRUCK_OFFSET;
+            return true;
+        case TAG_KIND_EM:
+            //Apply italics to all
+            effect->kind = STYLE_EFFECT_FORMAT_BIT;
+            effect->value = FORMAT_TAG_IS_ITALICS_OFFSET;
+            return true;
+        case TAG_KIND_H1:
+        case TAG_KIND_H2:
+        case TAG_KIND_H3:
+        case TAG_KIND_H4:
+        case TAG_KIND_H5:
+        case TAG_KIND_H6:
+            //Set our header level
+            effect->kind = STYLE_EFFECT_HEADER;
+            effect->value = tag->kind - TAG_KIND_H1 + 1;
+            return true;
+        case TAG_KIND_STRONG:
+            //Apply bold to all
+            effect->kind = STYLE_EFFECT_FORMAT_BIT;
+            effect->value = FORMAT_TAG_IS_BOLD_OFFSET;
+            return true;
+        case TAG_KIND_SUP:
+            //Increase superscript level
+            effect->kind = STYLE_EFFECT_EXPONENT;
+            return true;
+        case TAG_KIND_TABLE: {
+            if (!tag->tableData && tag->tableSourceLength > 0) {
+                //The table was captured lazily, so link to where it is in the input and leave the encoding until it's opened
+                size_t urlSize = sizeof(TABLE_SOURCE_URI_PREFIX) + 2 * 20 + 1;
+                char *url = arenaAlloc(arena, urlSize);
+                effect->kind = STYLE_EFFECT_LINK;
+                if (!url) {
+                    //Out of memory, which flattenTags notices by the missing URL
+                    return true;
+                }
+                tableSourceLinkURL(url, urlSize, tag->tableSourceStart, tag->tableSourceLength);
+                
+                effect->ownsLinkURL = true;
+                effect->linkURL = url;
+                return true;
+            }
+            
+            //Apply our encoded table link
+            if (!tag->tableData || tag->tableDataLength == 0) {
+                //invalid table data?
+                break;
+            }
+            
+            //Remove the null from DATA_URI_PREFIX and take the null from the table data length
+            size_t dataURIPrefixWithoutNull = sizeof(DATA_URI_PREFIX) - 1;
+            char *url = arenaAlloc(arena, dataURIPrefixWithoutNull + tag->tableDataLength);
+            effect->kind = STYLE_EFFECT_LINK;
+            if (!url) {
+                return true;
+            }
+            memcpy(url, DATA_URI_PREFIX, dataURIPrefixWithoutNull);
+            memcpy(url + dataURIPrefixWithoutNull, tag->tableData, tag->tableDataLength);
+            
+            effect->ownsLinkURL = true;
+            effect->linkURL = url;
+            return true;
+        }
+        case TAG_KIND_ORDERED_LIST:
+        case TAG_KIND_UNORDERED_LIST:
+            //Apply list indentation
+            effect->kind = STYLE_EFFECT_LIST;
+            return true;
+        default:
+            //nil tag
+            break;
+    }
+    return false;
+}
+
+/**
+ Start or stop applying an effect
+ 
+ @param state The sweep state
+ @param effects All effects, indexed by the boundary
+ @param boundary The boundary being crossed
+ */
+static void t_style_state_apply(struct t_style_state *state, struct t_style_effect *effects, struct t_style_boundary boundary) {
+    struct t_style_effect effect = effects[boundary.effectIndex];
+    switch (effect.kind) {
+        case STYLE_EFFECT_FORMAT_BIT:
+            state->formatBitCounts[effect.value] += boundary.delta;
+            break;
+        case STYLE_EFFECT_HEADER:
+            state->headerLevelCounts[effect.value] += boundary.delta;
+            break;
+        case STYLE_EFFECT_EXPONENT:
+            state->exponentLevel += boundary.delta;
+            break;
+        case STYLE_EFFECT_QUOTE:
+            state->quoteLevel += boundary.delta;
+            break;
+        case STYLE_EFFECT_LIST:
+            state->listNestLevel += boundary.delta;
+            break;
+        case STYLE_EFFECT_LINK:
+            if (boundary.delta > 0) {
+                //Sift the new link up the heap
+                int position = state->linkHeapCount++;
+                while (position > 0 && state->linkHeap[(position - 1) / 2] < boundary.effectIndex) {
+                    state->linkHeap[position] = state->linkHeap[(position - 1) / 2];
+                    position = (position - 1) / 2;
+                }
+                state->linkHeap[position] = boundary.effectIndex;
+                state->isLinkActive[boundary.effectIndex] = true;
+            } else {
+                state->isLinkActive[boundary.effectIndex] = false;
+            }
+            break;
+    }
+}
+
+/**
+ Get the link which is currently on top, discarding links which have already ended
+ 
+ @param state The sweep state
+ @return The index of the winning link effect or -1 if there is no link
+ */
+static int t_style_state_active_link(struct t_style_state *state) {
+    while (state->linkHeapCount > 0 && !state->isLinkActive[state->linkHeap[0]]) {
+        //Pop the top and sift the last element down
+        int last = state->linkHeap[--state->linkHeapCount];
+        int position = 0;
+        while (true) {
+            int child = position * 2 + 1;
+            if (child >= state->linkHeapCount) {
+                break;
+            }
+            if (child + 1 < state->linkHeapCount && state->linkHeap[child + 1] > state->linkHeap[child]) {
+                child++;
+            }
+            if (state->linkHeap[child] <= last) {
+                break;
+            }
+            state->linkHeap[position] = state->linkHeap[child];
+            position = child;
+        }
+        state->linkHeap[position] = last;
+    }
+    return state->linkHeapCount > 0 ? state->linkHeap[0] : -1;
+}
+
+//FNV-1a
+static size_t linkURLHash(const char *url, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)url[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ Get the linkIndex of an effect's URL, adding the URL to the table if no run has used it yet
+ 
+ @param interner The URLs so far
+ @param effect The link effect
+ @return The linkIndex
+ */
+static unsigned int internLinkURL(struct t_link_interner *interner, struct t_style_effect *effect) {
+    if (effect->linkIndex > 0) {
+        return effect->linkIndex;
+    }
+    
+    size_t length = strlen(effect->linkURL);
+    //Table data URIs are long and practically never repeat, so they aren't worth hashing
+    bool isDeduplicated = !effect->ownsLinkURL;
+    size_t slot = 0;
+    if (isDeduplicated) {
+        slot = linkURLHash(effect->linkURL, length) & interner->slotMask;
+        while (interner->slots[slot] > 0) {
+            unsigned int linkIndex = interner->slots[slot];
+            if (interner->urlLengths[linkIndex - 1] == length && memcmp(interner->urls[linkIndex - 1], effect->linkURL, length) == 0) {
+                effect->linkIndex = linkIndex;
+                return linkIndex;
+            }
+            slot = (slot + 1) & interner->slotMask;
+        }
+    }
+    
+    interner->urls[interner->numberOfURLs] = effect->linkURL;
+    interner->urlLengths[interner->numberOfURLs] = length;
+    interner->numberOfURLs++;
+    interner->totalURLSize += length + 1;
+    if (isDeduplicated) {
+        interner->slots[slot] = interner->numberOfURLs;
+    }
+    effect->linkIndex = interner->numberOfURLs;
+    return effect->linkIndex;
+}
+
+/**
+ Build the t_format for the current sweep position
+ 
+ @param state The sweep state
+ @param effects All effects
+ @param interner The link URLs so far
+ @return The format (without positions)
+ */
+static struct t_format t_style_state_format(struct t_style_state *state, struct t_style_effect *effects, struct t_link_interner *interner) {
+    struct t_format format;
+    memset(&format, 0, sizeof(format));
+    for (int bit = 0; bit < FORMAT_TAG_H_LEVEL_OFFSET; bit++) {
+        if (state->formatBitCounts[bit] > 0) {
+            format.formatTag |= 1 << bit;
+        }
+    }
+    //Nested headers combine their levels, just as they would if they were applied one after another
+    for (int level = 1; level < 10; level++) {
+        if (state->headerLevelCounts[level] > 0) {
+            format.formatTag |= level << FORMAT_TAG_H_LEVEL_OFFSET;
+        }
+    }
+    format.exponentLevel = (unsigned char)state->exponentLevel;
+    format.quoteLevel = (unsigned char)state->quoteLevel;
+    format.listNestLevel = (unsigned char)state->listNestLevel;
+    
+    int link = t_style_state_active_link(state);
+    format.linkIndex = link >= 0 ? internLinkURL(interner, &effects[link]) : 0;
+    return format;
+}
+
+/**
+ Where flattenTags puts the runs. Each output format has its own emit function
+ */
+struct t_run_sink {
+    void (*emit)(struct t_run_sink *sink, const struct t_format *format);
+    void *runs;
+    struct t_run_columns *columns;
+    int numberOfRuns;
+    //Set if a run needed something the output format can't represent
+    bool isTruncated;
+    
+    //For visitAttributesLinear, which hands each run to the caller along with its URL from the interner
+    void (*visitor)(void *context, const struct t_format *run, const char *linkURL, size_t linkURLLength);
+    void *context;
+    const struct t_link_interner *interner;
+};
+
+static void emitFormat(struct t_run_sink *sink, const struct t_format *format) {
+    ((struct t_format *)sink->runs)[sink->numberOfRuns++] = *format;
+}
+
+//Capping at the largest level a field can hold, rather than wrapping around, keeps the drawing closest to the real thing
+static inline unsigned short packLevel(unsigned char level, unsigned short max, int offset) {
+    return (level < max ? level : max) << offset;
+}
+
+static unsigned short packStyle(const struct t_format *format) {
+    return (format->formatTag & RUN_STYLE_FORMAT_TAG_MASK) |
+        packLevel(format->exponentLevel, RUN_STYLE_EXPONENT_LEVEL_MAX, RUN_STYLE_EXPONENT_LEVEL_OFFSET) |
+        packLevel(format->quoteLevel, RUN_STYLE_QUOTE_LEVEL_MAX, RUN_STYLE_QUOTE_LEVEL_OFFSET) |
+        packLevel(format->listNestLevel, RUN_STYLE_LIST_NEST_LEVEL_MAX, RUN_STYLE_LIST_NEST_LEVEL_OFFSET);
+}
+
+static unsigned short packLinkIndex(struct t_run_sink *sink, const struct t_format *format) {
+    if (format->linkIndex > RUN_LINK_INDEX_MAX) {
+        sink->isTruncated = true;
+        return 0;
+    }
+    return format->linkIndex;
+}
+
+static void emitRun(struct t_run_sink *sink, const struct t_format *format) {
+    struct t_run *run = &((struct t_run *)sink->runs)[sink->numberOfRuns++];
+    run->startPosition = format->startPosition;
+    run->style = packStyle(format);
+    run->linkIndex = packLinkIndex(sink, format);
+}
+
+static void emitRunColumns(struct t_run_sink *sink, const struct t_format *format) {
+    int index = sink->numberOfRuns++;
+    sink->columns->startPositions[index] = format->startPosition;
+    sink->columns->styles[index] = packStyle(format);
+    sink->columns->linkIndices[index] = packLinkIndex(sink, format);
+}
+
+static void emitVisit(struct t_run_sink *sink, const struct t_format *format) {
+    const char *linkURL = NULL;
+    size_t linkURLLength = 0;
+    if (format->linkIndex > 0) {
+        linkURL = sink->interner->urls[format->linkIndex - 1];
+        linkURLLength = sink->interner->urlLengths[format->linkIndex - 1];
+    }
+    sink->visitor(sink->context, format, linkURL, linkURLLength);
+    sink->numberOfRuns++;
+}
+
+/**
+ The flattening itself, shared by every output format. Destroys inputTags in the process!
+ 
+ @param inputTags Overlapping tags buffer
+ @param numberOfInputTags The number of inputTags
+ @param sink Where to put the runs
+ @param links (return) The URLs the runs link to. May be NULL if the sink doesn't need them after flattening
+ @param displayTextLength The size of the text that we will be applying these tags to
+ @param arena The arena which owns the link table and scratch space, or NULL
+ @return false if there was no memory, in which case there are no runs and no link table. The tags are destroyed either way
+ */
+static bool flattenTags(struct t_tag inputTags[], int numberOfInputTags, struct t_run_sink *sink, struct t_link_table *links, int displayTextLength, struct Arena *arena) {
+    if (links) {
+        links->urls = NULL;
+        links->numberOfURLs = 0;
+    }
+    bool isOutOfMemory = false;
+    int numberOfEffects = 0;
+    int numberOfBoundaries = 0;
+    int numberOfLinks = 0;
+    struct t_style_state state;
+    memset(&state, 0, sizeof(state));
+    struct t_link_interner interner;
+    memset(&interner, 0, sizeof(interner));
+    
+    //Work out what each tag does to the text. Tags which don't style anything are dropped here
+    struct t_style_effect *effects = arenaAlloc(arena, (numberOfInputTags + 1) * sizeof(struct t_style_effect));
+    struct t_style_boundary *boundaries = arenaAlloc(arena, (2 * numberOfInputTags + 1) * sizeof(struct t_style_boundary));
+    if (!effects || !boundaries) {
+        goto OUT_OF_MEMORY;
+    }
+    
     for (int i = 0; i < numberOfInputTags; i++) {
         struct t_tag tag = inputTags[i];
-        char* tagText = tag.tag;
-        if (tagText) {
-            //switch on the first character to minimize string comparisons
-            switch (tagText[0]) {
-                case 'a':
-                    if (strncmp(tagText, "a href=", 7) == 0) {
-                        //We first need to extract the link
-                        long tagTextLength = strlen(tagText);
-                        char *url = malloc(tagTextLength-7);
-                        //Extract the URL
-                        int z = 8;
-                        for (; z < tagTextLength; z++) {
-                            if (tagText[z] == '"') {
-                                break;
-                            }else {
-                                url[z-8] = tagText[z];
-                            }
-                        }
-                        url[z-8] = 0x00;
-                        
-                        //Set our link
-                        for (int j = tag.startPosition; j < tag.endPosition; j++) {
-                            displayTextFormat[j].linkURL = url;
-                        }
-                        
-                        //If we never got into the loop above (and so url is never stored else where), free it now.
-                        if (tag.endPosition - tag.startPosition <= 0) {
-                            free(url);
-                        }
-                        
-                    }
-                    break;
-                case 'b':
-                    if (strncmp(tagText, "blockquote", 10) == 0) {
-                        //Increase quote level
-                        for (int j = tag.startPosition; j < tag.endPosition; j++) {
-                            displayTextFormat[j].quoteLevel++;
-                        }
-                    }
-                    break;
-                case 'c':
-                    if (strncmp(tagText, "code", 4) == 0) {
-                        //Apply CODE! to all
-                        for (int j = tag.startPosition; j < tag.endPosition; j++) {
-                            //Since we only ever set these bit fields to true, we can skip erasing
-                            displayTextFormat[j].formatTag |= 1 << FORMAT_TAG_IS_CODE_OFFSET;
-                        }
-                    }
-                    break;
-                case 'd':
-                    if (strncmp(tagText, "del", 3) == 0) {
-                        //Apply strike to all
-                        for (int j = tag.startPosition; j < tag.endPosition; j++) {
-                            displayTextFormat[j].formatTag |= 1 << FORMAT_TAG_IS_STRUCK_OFFSET;
-                        }
-                    }
-                    break;
-                case 'e':
-                    if (strncmp(tagText, "em", 2) == 0) {
-                        //Apply italics to all
-                        for (int j = tag.startPosition; j < tag.endPosition; j++) {
-                            displayTextFormat[j].formatTag |= 1 << FORMAT_TAG_IS_ITALICS_OFFSET;
-                        }
-                    }
-                    break;
-                case 'h':
-                    if (tagText[0] == 'h' && tagText[1] >= '1' && tagText[1] <= '6') {
-                        //Set our header level
-                        unsigned char headerLevel = tagText[1] - '0';
-                        //since we're stuffing this into a 4 bit field and the above only really expects up to 9 we cap this value
-                        if (headerLevel >= 10) {
-                            headerLevel = 9;
-                        }
-                        for (int j = tag.startPosition; j < tag.endPosition; j++) {
-                            displayTextFormat[j].formatTag |= headerLevel << FORMAT_TAG_H_LEVEL_OFFSET;
-                        }
-                    }
-                    break;
-                case 's':
-                    if (strncmp(tagText, "strong", 6) == 0) {
-                        //Apply bold to all
-                        for (int j = tag.startPosition; j < tag.endPosition; j++) {
-                            displayTextFormat[j].formatTag |= 1 << FORMAT_TAG_IS_BOLD_OFFSET;
-                        }
-                    } else if (strncmp(tagText, "sup", 3) == 0) {
-                        //Increase superscript level
-                        for (int j = tag.startPosition; j < tag.endPosition; j++) {
-                            displayTextFormat[j].exponentLevel++;
-                        }
-                    }
-                    break;
-                case 't':
-                    if (strncmp(tagText, "table", 5) == 0) {
-                        //Apply our encoded table link
-                        if (!tag.tableData || tag.tableDataLength == 0) {
-                            //invalid table data?
-                            break;
-                        }
-                                                
-                        //Remove the null from DATA_URI_PREFIX and take the null from the table data length
-                        size_t dataURIPrefixWithoutNull = sizeof(DATA_URI_PREFIX) - 1;
-                        char *url = malloc(dataURIPrefixWithoutNull + tag.tableDataLength);
-                        memcpy(url, DATA_URI_PREFIX, dataURIPrefixWithoutNull);
-                        memcpy(url + dataURIPrefixWithoutNull, tag.tableData, tag.tableDataLength);
-                        
-                        //Set our link
-                        for (int j = tag.startPosition; j < tag.endPosition; j++) {
-                            displayTextFormat[j].linkURL = url;
-                        }
-                        
-                        //If we never got into the loop above (and so url is never stored else where), free it now.
-                        if (tag.endPosition - tag.startPosition <= 0) {
-                            free(url);
-                        }
-                    }
-                    
-                    break;
-                case 'o':
-                case 'u':
-                    if (strncmp(tagText, "ol", 2) == 0 || (strncmp(tagText, "ul", 2) == 0)) {
-                        //Apply list indentation
-                        for (int j = tag.startPosition; j < tag.endPosition; j++) {
-                            displayTextFormat[j].listNestLevel++;
-                        }
-                    }
-                    
-                    break;
-                default:
-                    //nil tag
-                    break;
+        struct t_style_effect *effect = &effects[numberOfEffects];
+        //Empty tags can't change the style of anything
+        if (tag.startPosition < tag.endPosition && styleEffectForTag(&tag, effect, arena)) {
+            if (effect->kind == STYLE_EFFECT_LINK && !effect->linkURL) {
+                goto OUT_OF_MEMORY;
             }
-        } else {
-            printf("NULL TAG TEXT?? SKIPPING!");
+            boundaries[numberOfBoundaries++] = (struct t_style_boundary){tag.startPosition, numberOfEffects, 1};
+            boundaries[numberOfBoundaries++] = (struct t_style_boundary){tag.endPosition, numberOfEffects, -1};
+            if (effect->kind == STYLE_EFFECT_LINK) {
+                numberOfLinks++;
+            }
+            numberOfEffects++;
         }
-
-        //Destroy inputTags data as warned
-        free(tag.tag);
-        free(tag.tableData);
-        tag.tag = NULL;
+        
+        //Destroy inputTags data as warned. The tag text is kept until we're done since link URLs point into it
+        arenaFree(arena, tag.tableData);
+        inputTags[i].tableData = NULL;
     }
     
-    for (int i = 0; i < displayTextLength; i++) {
-        //print_t_format(displayTextFormat[i]);
+    //Sweep over the boundaries in order. Between two boundaries the style is constant so each gap is (at most) one run
+    qsort(boundaries, numberOfBoundaries, sizeof(struct t_style_boundary), t_style_boundary_cmp);
+    
+    state.linkHeap = arenaAlloc(arena, (numberOfLinks + 1) * sizeof(int));
+    state.isLinkActive = arenaAlloc(arena, (numberOfEffects + 1) * sizeof(bool));
+    if (!state.linkHeap || !state.isLinkActive) {
+        goto OUT_OF_MEMORY;
     }
-    printf("--------\n");
+    memset(state.isLinkActive, 0, (numberOfEffects + 1) * sizeof(bool));
     
-    //Now that each character has it's style, let's simplify to a 1D
-    *numberOfSimplifiedTags = 0;
-    unsigned int activeStyleStart = 0;
-    for (int i = 1; i < displayTextLength; i++) {
-        if (t_format_cmp(displayTextFormat[activeStyleStart], displayTextFormat[i]) != 0) {
-            //We're different, so commit our previous style (with start and ends) and adopt the current one
-            displayTextFormat[i-1].startPosition = activeStyleStart;
-            displayTextFormat[i-1].endPosition = i;
-            simplifiedTags[*numberOfSimplifiedTags] = displayTextFormat[i-1];
+    //There can't be more distinct URLs than links, and keeping the table at most half full keeps probing short
+    size_t numberOfSlots = 1;
+    while (numberOfSlots < 2 * (size_t)numberOfLinks) {
+        numberOfSlots *= 2;
+    }
+    interner.slotMask = numberOfSlots - 1;
+    if (numberOfLinks > 0) {
+        //One allocation for all three arrays, the pointer sized ones first so everything stays aligned
+        char *internerBuffer = arenaAlloc(arena, numberOfLinks * (sizeof(const char *) + sizeof(size_t)) + numberOfSlots * sizeof(unsigned int));
+        if (!internerBuffer) {
+            goto OUT_OF_MEMORY;
+        }
+        interner.urls = (const char **)internerBuffer;
+        interner.urlLengths = (size_t *)(internerBuffer + numberOfLinks * sizeof(const char *));
+        interner.slots = (unsigned int *)(internerBuffer + numberOfLinks * (sizeof(const char *) + sizeof(size_t)));
+        memset(interner.slots, 0, numberOfSlots * sizeof(unsigned int));
+    }
+    sink->interner = &interner;
+    
+    //The run being built. It's only handed to the sink once the style changes, so that it is complete
+    struct t_format pendingFormat;
+    bool hasPendingFormat = false;
+    //Positions are unsigned, so compare against the length as one too
+    unsigned int textLength = displayTextLength > 0 ? (unsigned int)displayTextLength : 0;
+    unsigned int runStart = 0;
+    int boundaryIndex = 0;
+    while (runStart < textLength) {
+        //Everything up to the next boundary shares the current style
+        unsigned int runEnd = textLength;
+        if (boundaryIndex < numberOfBoundaries && boundaries[boundaryIndex].position < runEnd) {
+            runEnd = boundaries[boundaryIndex].position;
+        }
+        
+        if (runStart < runEnd) {
+            struct t_format format = t_style_state_format(&state, effects, &interner);
+            format.startPosition = runStart;
+            format.endPosition = runEnd;
             
-            if (displayTextFormat[i-1].linkURL) {
-                simplifiedTags[*numberOfSimplifiedTags].linkURL = malloc(strlen(displayTextFormat[i-1].linkURL) + 1);
-                memcpy(simplifiedTags[*numberOfSimplifiedTags].linkURL, displayTextFormat[i-1].linkURL, strlen(displayTextFormat[i-1].linkURL) + 1);
+            if (hasPendingFormat && t_format_cmp(pendingFormat, format) == 0) {
+                //Same style as the run before us (i.e. a tag ended and an identical one started), so extend it
+                pendingFormat.endPosition = runEnd;
+            } else {
+                if (hasPendingFormat) {
+                    print_t_format(pendingFormat);
+                    sink->emit(sink, &pendingFormat);
+                }
+                pendingFormat = format;
+                hasPendingFormat = true;
             }
-            
-            print_t_format(displayTextFormat[i-1]);
-            *numberOfSimplifiedTags+=1;
-            activeStyleStart = i;
         }
+        
+        //Apply every boundary which sits at the end of this run
+        while (boundaryIndex < numberOfBoundaries && boundaries[boundaryIndex].position <= runEnd) {
+            t_style_state_apply(&state, effects, boundaries[boundaryIndex]);
+            boundaryIndex++;
+        }
+        runStart = runEnd;
     }
+    if (hasPendingFormat) {
+        print_t_format(pendingFormat);
+        sink->emit(sink, &pendingFormat);
+    }
+    printf("--------\n");
     
-    //and commit the final style
-    //We need to make sure we have displayed text otherwise we over/underflow here
-    if (displayTextLength > 0) {
-        displayTextFormat[displayTextLength-1].startPosition = activeStyleStart;
-        displayTextFormat[displayTextLength-1].endPosition = displayTextLength;
-        simplifiedTags[*numberOfSimplifiedTags] = displayTextFormat[displayTextLength-1];
-        if (displayTextFormat[displayTextLength-1].linkURL) {
-            simplifiedTags[*numberOfSimplifiedTags].linkURL = malloc(strlen(displayTextFormat[displayTextLength-1].linkURL) + 1);
-            memcpy(simplifiedTags[*numberOfSimplifiedTags].linkURL, displayTextFormat[displayTextLength-1].linkURL, strlen(displayTextFormat[displayTextLength-1].linkURL) + 1);
+    //Copy the URLs which ended up being used into one block, right behind the array which points at them
+    if (links && interner.numberOfURLs > 0) {
+        size_t urlArraySize = interner.numberOfURLs * sizeof(char *);
+        char **urls = arenaAlloc(arena, urlArraySize + interner.totalURLSize);
+        if (!urls) {
+            goto OUT_OF_MEMORY;
+        }
+        char *urlText = (char *)urls + urlArraySize;
+        for (int i = 0; i < interner.numberOfURLs; i++) {
+            urls[i] = urlText;
+            memcpy(urlText, interner.urls[i], interner.urlLengths[i] + 1);
+            urlText += interner.urlLengths[i] + 1;
         }
-        print_t_format(displayTextFormat[displayTextLength-1]);
-        *numberOfSimplifiedTags+=1;
+        links->urls = urls;
+        links->numberOfURLs = interner.numberOfURLs;
     }
+    goto FREE;
     
+OUT_OF_MEMORY:
+    isOutOfMemory = true;
+    //Runs may already have gone to the sink, but without the link table they can't be used
+    sink->numberOfRuns = 0;
+    
+FREE:
     //now free
-    for (int i = 0; i < displayTextLength; i++) {
-        //do we have a linkURL and is it either different from the next one or are we the last one
-        //this is necessary so we don't double free the URL
-        if (displayTextFormat[i].linkURL && ((i + 1 < displayTextLength && displayTextFormat[i+1].linkURL != displayTextFormat[i].linkURL) || (i+1 >= displayTextLength))) {
-            free(displayTextFormat[i].linkURL);
-            displayTextFormat[i].linkURL = NULL;
+    for (int i = 0; i < numberOfEffects; i++) {
+        if (effects[i].ownsLinkURL) {
+            arenaFree(arena, effects[i].linkURL);
         }
     }
-    
-    free(displayTextFormat);
+    for (int i = 0; i < numberOfInputTags; i++) {
+        arenaFree(arena, inputTags[i].tableData);
+        arenaFree(arena, inputTags[i].tag);
+    }
+    arenaFree(arena, interner.urls);
+    arenaFree(arena, state.linkHeap);
+    arenaFree(arena, state.isLinkActive);
+    arenaFree(arena, boundaries);
+    arenaFree(arena, effects);
+    return !isOutOfMemory;
+}
+
+/**
+ Takes in overlapping t_format tags and simplifies them into 1D range suitable for use in NSAttributedString. Destroys inputTags in the process!
+ 
+ Rather than styling every character we sort the points where tags start and end and sweep over them, so the cost is O(tags log tags + runs) regardless of how long the text is.
+ 
+ @param inputTags Overlapping tags buffer (given by tokenizeHTML)
+ @param numberOfInputTags The number of inputTags
+ @param simplifiedTags (return) Simplified tags buffer (return value). Must have room for maximumNumberOfSimplifiedTags(numberOfInputTags, displayTextLength) tags
+ @param numberOfSimplifiedTags (return) the number of found simplified tags
+ @param links (return) The URLs the simplified tags link to. Release them with freeLinkTable
+ @param displayTextLength The size of the text that we will be applying these tags to
+ @return false if there was no memory, in which case there are no simplified tags and nothing to release
+ */
+bool makeAttributesLinear(struct t_tag inputTags[], int numberOfInputTags, struct t_format simplifiedTags[], int* numberOfSimplifiedTags, struct t_link_table *links, int displayTextLength) {
+    return makeAttributesLinearWithArena(inputTags, numberOfInputTags, simplifiedTags, numberOfSimplifiedTags, links, displayTextLength, NULL);
+}
+
+/**
+ Release the link table from makeAttributesLinear
+ 
+ @param links The link table
+ */
+void freeLinkTable(struct t_link_table *links) {
+    free(links->urls);
+    links->urls = NULL;
+    links->numberOfURLs = 0;
+}
+
+/**
+ Takes in overlapping t_format tags and simplifies them into 1D range, placing the link table and all scratch space in an arena. Destroys inputTags in the process!
+ 
+ @param inputTags Overlapping tags buffer (given by tokenizeHTMLWithArena using the same arena)
+ @param numberOfInputTags The number of inputTags
+ @param simplifiedTags (return) Simplified tags buffer (return value)
+ @param numberOfSimplifiedTags (return) the number of found simplified tags
+ @param links (return) The URLs the simplified tags link to, owned by the arena
+ @param displayTextLength The size of the text that we will be applying these tags to
+ @param arena The arena which owns the results. Pass NULL to use malloc, in which case the caller frees the link table as with makeAttributesLinear
+ @return false if there was no memory, in which case there are no simplified tags
+ */
+bool makeAttributesLinearWithArena(struct t_tag inputTags[], int numberOfInputTags, struct t_format simplifiedTags[], int* numberOfSimplifiedTags, struct t_link_table *links, int displayTextLength, struct Arena *arena) {
+    struct t_run_sink sink = {.emit = emitFormat, .runs = simplifiedTags};
+    bool success = flattenTags(inputTags, numberOfInputTags, &sink, links, displayTextLength, arena);
+    *numberOfSimplifiedTags = sink.numberOfRuns;
+    return success;
+}
+
+/**
+ makeAttributesLinear, producing packed t_runs (half the size of a t_format) instead. Destroys inputTags in the process!
+ 
+ @param inputTags Overlapping tags buffer (given by tokenizeHTMLWithArena using the same arena)
+ @param numberOfInputTags The number of inputTags
+ @param runs (return) The runs. Must have room for maximumNumberOfSimplifiedTags(numberOfInputTags, displayTextLength) runs
+ @param numberOfRuns (return) The number of runs
+ @param links (return) The URLs the runs link to
+ @param displayTextLength The size of the text that we will be applying these tags to
+ @param arena The arena which owns the link table. Pass NULL to use malloc, in which case the caller frees it with freeLinkTable
+ @return false if there was no memory, in which case there are no runs, or if the document has more distinct links than a run can index, in which case the runs are all there but those links are dropped
+ */
+bool makeRunsLinearWithArena(struct t_tag inputTags[], int numberOfInputTags, struct t_run runs[], int *numberOfRuns, struct t_link_table *links, int displayTextLength, struct Arena *arena) {
+    struct t_run_sink sink = {.emit = emitRun, .runs = runs};
+    bool success = flattenTags(inputTags, numberOfInputTags, &sink, links, displayTextLength, arena);
+    *numberOfRuns = sink.numberOfRuns;
+    return success && !sink.isTruncated;
+}
+
+/**
+ makeRunsLinearWithArena, producing a struct of arrays instead. Destroys inputTags in the process!
+ 
+ @param inputTags Overlapping tags buffer (given by tokenizeHTMLWithArena using the same arena)
+ @param numberOfInputTags The number of inputTags
+ @param columns (return) The runs. The caller provides the arrays, each with room for maximumNumberOfSimplifiedTags(numberOfInputTags, displayTextLength) runs
+ @param links (return) The URLs the runs link to
+ @param displayTextLength The size of the text that we will be applying these tags to
+ @param arena The arena which owns the link table. Pass NULL to use malloc, in which case the caller frees it with freeLinkTable
+ @return false as makeRunsLinearWithArena does
+ */
+bool makeRunColumnsLinearWithArena(struct t_tag inputTags[], int numberOfInputTags, struct t_run_columns *columns, struct t_link_table *links, int displayTextLength, struct Arena *arena) {
+    struct t_run_sink sink = {.emit = emitRunColumns, .columns = columns};
+    bool success = flattenTags(inputTags, numberOfInputTags, &sink, links, displayTextLength, arena);
+    columns->numberOfRuns = sink.numberOfRuns;
+    return success && !sink.isTruncated;
+}
+
+/**
+ Flatten the tags into runs as makeAttributesLinear does, but hand each run to a callback as soon as it is complete instead of writing them to an array. The runs come in order and cover the whole text. Nothing is copied for the caller, so there is no run buffer to size and no link table to free. Destroys inputTags in the process!
+ 
+ @param inputTags Overlapping tags buffer (given by tokenizeHTMLWithArena using the same arena)
+ @param numberOfInputTags The number of inputTags
+ @param displayTextLength The size of the text that we will be applying these tags to
+ @param visitor Called with each run. run->linkIndex is still set, so runs with the same URL can be told apart cheaply. linkURL is the run's null terminated URL (linkURLLength bytes, excluding the null byte) or NULL if it isn't a link. Both point into the parser's memory and are only valid until the visitor returns
+ @param context Passed to visitor as is
+ @param arena The arena for scratch space, or NULL
+ @return The number of runs visited, or -1 if there was no memory. Nothing is visited then
+ */
+int visitAttributesLinear(struct t_tag inputTags[], int numberOfInputTags, int displayTextLength, void (*visitor)(void *context, const struct t_format *run, const char *linkURL, size_t linkURLLength), void *context, struct Arena *arena) {
+    struct t_run_sink sink = {.emit = emitVisit, .visitor = visitor, .context = context};
+    if (!flattenTags(inputTags, numberOfInputTags, &sink, NULL, displayTextLength, arena)) {
+        return -1;
+    }
+    return sink.numberOfRuns;
 }
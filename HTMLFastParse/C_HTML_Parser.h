@@ -10,10 +10,61 @@
 #define C_HTML_Parser_h
 
 #include <stdio.h>
+#include <stdbool.h>
 #include "t_tag.h"
 #include "t_format.h"
+#include "t_run.h"
+#include "t_parse_result.h"
+#include "Arena.h"
+
+/**
+ Options for tokenizeHTMLWithOptions and createTokenizerWithOptions
+ */
+enum t_tokenizer_options {
+    TOKENIZER_OPTION_NONE = 0,
+    //Record where each table is in the input (tableSourceStart and tableSourceLength) instead of base64 encoding it up front. The table's link becomes a short reference which tableSourceForLinkURL reads back
+    TOKENIZER_OPTION_LAZY_TABLES = 1 << 0
+};
+
+int getVisibleByteEffectForCharacter(unsigned char character);
+int maximumNumberOfTags(const char *input, size_t inputLength);
+int maximumNumberOfSimplifiedTags(int numberOfTags, int displayTextLength);
+
+int t_format_cmp(struct t_format format1, struct t_format format2);
 
 char * tokenizeHTML(char *input, size_t inputLength, struct t_tag *completedTags, int *numberOfTags, int *numberOfHumanVisibleCharacters);
-void makeAttributesLinear(struct t_tag inputTags[], int numberOfInputTags, struct t_format simplifiedTags[], int* numberOfSimplifiedTags, int displayTextLength);
+bool makeAttributesLinear(struct t_tag inputTags[], int numberOfInputTags, struct t_format simplifiedTags[], int* numberOfSimplifiedTags, struct t_link_table *links, int displayTextLength);
+void freeLinkTable(struct t_link_table *links);
+
+const char * tagAttribute(const struct t_tag *tag, enum t_tag_attribute attribute, size_t *length);
+
+char * tokenizeHTMLWithArena(char *input, size_t inputLength, struct t_tag *completedTags, int *numberOfTags, int *numberOfHumanVisibleCharacters, struct Arena *arena);
+char * tokenizeHTMLWithOptions(char *input, size_t inputLength, struct t_tag *completedTags, int *numberOfTags, int *numberOfHumanVisibleCharacters, unsigned int options, struct Arena *arena);
+char * tokenizeHTMLPreview(char *input, size_t inputLength, struct t_tag *completedTags, int *numberOfTags, int *numberOfHumanVisibleCharacters, int maximumVisibleCharacters, bool *isTruncated, unsigned int options, struct Arena *arena);
+bool parsePlainText(const char *input, size_t inputLength, struct t_format *run, struct t_parse_result *result);
+bool makeAttributesLinearWithArena(struct t_tag inputTags[], int numberOfInputTags, struct t_format simplifiedTags[], int* numberOfSimplifiedTags, struct t_link_table *links, int displayTextLength, struct Arena *arena);
+bool makeRunsLinearWithArena(struct t_tag inputTags[], int numberOfInputTags, struct t_run runs[], int *numberOfRuns, struct t_link_table *links, int displayTextLength, struct Arena *arena);
+bool makeRunColumnsLinearWithArena(struct t_tag inputTags[], int numberOfInputTags, struct t_run_columns *columns, struct t_link_table *links, int displayTextLength, struct Arena *arena);
+int visitAttributesLinear(struct t_tag inputTags[], int numberOfInputTags, int displayTextLength, void (*visitor)(void *context, const struct t_format *run, const char *linkURL, size_t linkURLLength), void *context, struct Arena *arena);
+
+bool tableSourceForLinkURL(const char *linkURL, size_t *start, size_t *length);
+size_t tableSourceLinkURL(char *url, size_t urlSize, size_t start, size_t length);
+char * tableHTMLForSource(const char *input, size_t inputLength, size_t start, size_t length);
+char * tableDataURIForSource(const char *input, size_t inputLength, size_t start, size_t length);
+
+/**
+ Resumable tokenizer state for input which arrives in chunks. See createTokenizer
+ */
+struct Tokenizer;
+
+struct Tokenizer* createTokenizer(struct Arena *arena);
+struct Tokenizer* createTokenizerWithOptions(unsigned int options, struct Arena *arena);
+struct Tokenizer* createPreviewTokenizer(int maximumVisibleCharacters, unsigned int options, struct Arena *arena);
+bool feedTokenizer(struct Tokenizer *tokenizer, const char *chunk, size_t chunkLength);
+const char * tokenizerDisplayText(struct Tokenizer *tokenizer, int *numberOfHumanVisibleCharacters);
+const struct t_tag * tokenizerCompletedTags(struct Tokenizer *tokenizer, int *numberOfTags);
+bool tokenizerIsTruncated(struct Tokenizer *tokenizer);
+char * finishTokenizer(struct Tokenizer *tokenizer, struct t_tag **completedTags, int *numberOfTags, int *numberOfHumanVisibleCharacters);
+void destroyTokenizer(struct Tokenizer *tokenizer);
 
 #endif /* C_HTML_Parser_h */
@@ -10,6 +10,9 @@
 #import <UIKit/UIKit.h>
 
 @interface HFPFormatToAttributedString : NSObject
++(NSDictionary<NSString *, NSNumber *> *)parseCacheStatistics;
 -(NSAttributedString *)attributedStringForHTML:(NSString *)htmlInput;
+-(NSAttributedString *)attributedStringForHTML:(NSString *)htmlInput maximumLength:(int)maximumLength truncated:(BOOL *)truncated;
+-(NSArray<NSAttributedString *> *)attributedStringsForHTML:(NSArray<NSString *> *)htmlInputs;
 -(void)setDefaultFontColor:(UIColor *)defaultColor;
 @end
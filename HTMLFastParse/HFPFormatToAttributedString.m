@@ -8,6 +8,9 @@
 
 #import "HFPFormatToAttributedString.h"
 #import "C_HTML_Parser.h"
+#import "Batch.h"
+#import "UTF16.h"
+#import "ParseCache.h"
 #import <UIKit/UIKit.h>
 
 @implementation HFPFormatToAttributedString
@@ -42,6 +45,10 @@ CGFloat baseFontSize;
 
 float quotePadding = 20.0;
 
+//Parse results are shared by every formatter since they don't depend on the fonts or colors
+#define PARSE_CACHE_SIZE (4 * 1024 * 1024)
+struct ParseCache *parseCache;
+
 
 /**
  Create a new Formatter
@@ -60,9 +67,33 @@ float quotePadding = 20.0;
     //Prepare our common fonts once
     codeFontName = @"CourierNewPSMT";
     [self prepareFonts];
+    
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        parseCache = createParseCache(PARSE_CACHE_SIZE);
+    });
     return self;
 }
 
+/**
+ Get the hit, miss and eviction counts of the parse cache every formatter shares
+ 
+ @return The counts under the keys "hits", "misses", "evictions", "numberOfEntries" and "size" (the bytes in use). All zero if there is no cache
+ */
++(NSDictionary<NSString *, NSNumber *> *)parseCacheStatistics {
+    struct t_parse_cache_statistics statistics = {0};
+    if (parseCache) {
+        getParseCacheStatistics(parseCache, &statistics);
+    }
+    return @{
+        @"hits" : @(statistics.hits),
+        @"misses" : @(statistics.misses),
+        @"evictions" : @(statistics.evictions),
+        @"numberOfEntries" : @(statistics.numberOfEntries),
+        @"size" : @(statistics.size)
+    };
+}
+
 
 /**
  Initialize and cache high frequency fonts, colors, and other styles
@@ -140,6 +171,21 @@ float quotePadding = 20.0;
  @return The attributed string
  */
 -(NSAttributedString *)attributedStringForHTML:(NSString *)htmlInput {
+    return [self attributedStringForHTML:htmlInput maximumLength:INT_MAX truncated:NULL];
+}
+
+/**
+ Attribute the start of a string of HTML, for previews. Only as much of the HTML as the preview needs is parsed, so a preview of a long post costs about the same as a short one
+ 
+ @param htmlInput The HTML to attribute
+ @param maximumLength The most characters to show. Styles which are still open where the text is cut off are kept
+ @param truncated (returned) Whether any of the text was left out. May be NULL
+ @return The attributed string
+ */
+-(NSAttributedString *)attributedStringForHTML:(NSString *)htmlInput maximumLength:(int)maximumLength truncated:(BOOL *)truncated {
+    if (truncated) {
+        *truncated = NO;
+    }
     char* input = (char*)[htmlInput UTF8String];
     if (input == nil) {
         //Input can be null if htmlInput is also null or if it is not representable in UTF8. We are not going to bother parsing data which requires > 8bits per field because it can't fit in a char
@@ -147,18 +193,123 @@ float quotePadding = 20.0;
     }
     unsigned long inputLength = strlen(input);
     
-    struct t_tag* tokens = malloc(inputLength * sizeof(struct t_tag));
+    //Plain text (lots of comments are) needs no parsing, the input already is the display text. Checking it reads the whole input though, which a preview of long text shouldn't
+    struct t_format plainTextRun;
+    struct t_parse_result plainText;
+    if (inputLength <= (unsigned long)MAX(maximumLength, 0) && parsePlainText(input, inputLength, &plainTextRun, &plainText)) {
+        return [self attributedStringForDisplayText:plainText.displayText numberOfHumanVisibleCharacters:plainText.numberOfHumanVisibleCharacters formats:plainText.formats numberOfFormats:plainText.numberOfFormats links:&plainText.links];
+    }
+    
+    //The same HTML ([deleted], bot replies, comments scrolled back into view) comes up again and again, so whole documents are only parsed once
+    if (maximumLength == INT_MAX && parseCache) {
+        const struct t_parse_result *result = parseHTMLCached(parseCache, input, inputLength);
+        if (result) {
+            NSAttributedString *answer = [self attributedStringForDisplayText:result->displayText numberOfHumanVisibleCharacters:result->numberOfHumanVisibleCharacters formats:result->formats numberOfFormats:result->numberOfFormats links:&result->links];
+            releaseCachedParseResult(parseCache, result);
+            return answer;
+        }
+    }
+    
+    //Size our buffers by the number of tags rather than by the number of bytes
+    struct t_tag* tokens = malloc((maximumNumberOfTags(input, inputLength) + 1) * sizeof(struct t_tag));
     
     int numberOfTags = -1;
     int numberOfHumanVisibleCharacters = -1;
-    char* displayText = tokenizeHTML(input, inputLength, tokens, &numberOfTags, &numberOfHumanVisibleCharacters);
+    bool isTruncated = false;
+    char* displayText = tokens ? tokenizeHTMLPreview(input, inputLength, tokens, &numberOfTags, &numberOfHumanVisibleCharacters, maximumLength, &isTruncated, TOKENIZER_OPTION_NONE, NULL) : NULL;
+    if (truncated) {
+        *truncated = isTruncated;
+    }
     
-    struct t_format* finalTokens =  malloc(inputLength * sizeof(struct t_format));//&finalTokenBuffer[0];
+    struct t_format* finalTokens = displayText ? malloc((maximumNumberOfSimplifiedTags(numberOfTags, numberOfHumanVisibleCharacters) + 1) * sizeof(struct t_format)) : NULL;
+    if (!finalTokens) {
+        for (int i = 0; i < numberOfTags; i++) {
+            free(tokens[i].tag);
+            free(tokens[i].tableData);
+        }
+        free(displayText);
+        free(tokens);
+        return [[NSAttributedString alloc]initWithString:@"[HTMLFastParse Internal Error]: There was not enough memory to parse this text."];
+    }
     int numberOfSimplifiedTags = -1;
-    makeAttributesLinear(tokens, (int)numberOfTags, finalTokens,&numberOfSimplifiedTags, numberOfHumanVisibleCharacters);
+    struct t_link_table links;
+    //Without the memory to flatten them there are no formats, and the text is shown unstyled
+    makeAttributesLinear(tokens, (int)numberOfTags, finalTokens,&numberOfSimplifiedTags, &links, numberOfHumanVisibleCharacters);
+    
+    NSAttributedString *answer = [self attributedStringForDisplayText:displayText numberOfHumanVisibleCharacters:numberOfHumanVisibleCharacters formats:finalTokens numberOfFormats:numberOfSimplifiedTags links:&links];
+    
+    //Free and get ready to return
+    freeLinkTable(&links);
+    free(displayText);
+    free(tokens);
+    free(finalTokens);
+    return answer;
+}
+
+/**
+ Attribute many strings of HTML at once. This is faster than calling attributedStringForHTML: for each one when there are lots of short strings (comments, for example) since the parser's working memory is shared between all of them and large batches are parsed on every core
+
+ @param htmlInputs The HTML to attribute
+ @return The attributed strings, in the same order as htmlInputs
+ */
+-(NSArray<NSAttributedString *> *)attributedStringsForHTML:(NSArray<NSString *> *)htmlInputs {
+    int numberOfInputs = (int)[htmlInputs count];
+    if (numberOfInputs == 0) {
+        return @[];
+    }
     
+    struct t_html_input *inputs = malloc(numberOfInputs * sizeof(struct t_html_input));
+    for (int i = 0; i < numberOfInputs; i++) {
+        //The UTF8 buffers live as long as the autorelease pool so they are still around once the batch is parsed
+        const char *input = [htmlInputs[i] UTF8String];
+        inputs[i].input = input ? input : "";
+        inputs[i].inputLength = input ? strlen(input) : 0;
+    }
+    
+    //Parsing is spread across all cores, building the attributed strings has to stay on this thread
+    struct t_parse_result *results = parseHTMLBatchInParallel(inputs, numberOfInputs, 0);
+    NSMutableArray<NSAttributedString *> *answers = [[NSMutableArray alloc]initWithCapacity:numberOfInputs];
+    for (int i = 0; i < numberOfInputs; i++) {
+        //Keep the exact behavior of attributedStringForHTML: for anything the batch can't help with
+        if (!results || ![htmlInputs[i] UTF8String]) {
+            [answers addObject:[self attributedStringForHTML:htmlInputs[i]]];
+        } else {
+            struct t_parse_result result = results[i];
+            [answers addObject:[self attributedStringForDisplayText:result.displayText numberOfHumanVisibleCharacters:result.numberOfHumanVisibleCharacters formats:result.formats numberOfFormats:result.numberOfFormats links:&result.links]];
+        }
+    }
+    
+    free(results);
+    free(inputs);
+    return answers;
+}
+
+/**
+ Build the attributed string for parsed HTML
+ 
+ @param displayText The display text from tokenizeHTML
+ @param numberOfHumanVisibleCharacters The number of visible characters from tokenizeHTML
+ @param formats The flattened styles from makeAttributesLinear
+ @param numberOfFormats The number of styles
+ @param links The URLs the styles link to
+ @return The attributed string
+ */
+-(NSAttributedString *)attributedStringForDisplayText:(const char *)displayText numberOfHumanVisibleCharacters:(int)numberOfHumanVisibleCharacters formats:(struct t_format *)formats numberOfFormats:(int)numberOfFormats links:(const struct t_link_table *)links {
     //Now apply our linear attributes to our attributed string
-    NSString *stringBuffer = [NSString stringWithUTF8String: displayText];
+    //Transcode straight to UTF-16 rather than have NSString decode the UTF-8 again. The number of code units is always the visible count, so that is all the room it needs
+    NSString *stringBuffer = nil;
+    size_t charactersCapacity = MAX(numberOfHumanVisibleCharacters, 1);
+    unichar *characters = malloc(charactersCapacity * sizeof(unichar));
+    if (characters) {
+        bool isValid;
+        size_t numberOfCharacters = transcodeToUTF16(displayText, strlen(displayText), characters, charactersCapacity, NULL, &isValid);
+        if (isValid) {
+            stringBuffer = [[NSString alloc] initWithCharactersNoCopy:characters length:numberOfCharacters freeWhenDone:YES];
+        } else {
+            //NSString's UTF8String and repairUTF8 never give text which isn't valid, but keep the old behaviour in case it is
+            free(characters);
+        }
+    }
     NSMutableAttributedString *answer;
     if (stringBuffer) {
         answer = [[NSMutableAttributedString alloc] initWithString:stringBuffer];
@@ -170,8 +321,18 @@ float quotePadding = 20.0;
         } range:NSMakeRange(0, answer.length)];
         //Only format the string if we are sure that everything will line up (if our calculated visible is not the same as attributed sees, everything will be broken and likely will cause a crash
         if ([answer length] == numberOfHumanVisibleCharacters) {
-            for (int i = 0; i < numberOfSimplifiedTags; i++) {
-                [self addAttributeToString:answer forFormat:finalTokens[i]];
+            //Each URL is only converted and checked once, however many runs link to it. Ones NSURL can't handle are left as NSNull
+            NSMutableArray *linkURLs = [[NSMutableArray alloc]initWithCapacity:links->numberOfURLs];
+            for (int i = 0; i < links->numberOfURLs; i++) {
+                NSString *linkURL = [NSString stringWithUTF8String:links->urls[i]];
+                [linkURLs addObject:(linkURL && [NSURL URLWithString:linkURL] != nil) ? linkURL : [NSNull null]];
+            }
+            for (int i = 0; i < numberOfFormats; i++) {
+                NSString *linkURL = nil;
+                if (formats[i].linkIndex > 0 && linkURLs[formats[i].linkIndex - 1] != [NSNull null]) {
+                    linkURL = linkURLs[formats[i].linkIndex - 1];
+                }
+                [self addAttributeToString:answer forFormat:formats[i] linkURL:linkURL];
             }
         }else {
             NSAttributedString *failureText = [[NSAttributedString alloc]initWithString:@"\n\n\n[HTMLFastParse Internal Error]: HFP detected an issue where NSAttributedString length and the calculated visible length are not equal. Please report this at https://github.com/shusain93/HTMLFastParse/issues"];
@@ -181,13 +342,6 @@ float quotePadding = 20.0;
         answer = [[NSMutableAttributedString alloc] initWithString:@"[HTMLFastParse Internal Error]: Unable to create backing buffer because the data could not be represented in UTF-8. Please verify the API is being used correctly or report this at https://github.com/shusain93/HTMLFastParse/issues"];
     }
     
-    //Free and get ready to return
-    for (int i = 0; i < numberOfSimplifiedTags; i++) {
-        free(finalTokens[i].linkURL);
-    }
-    free(displayText);
-    free(tokens);
-    free(finalTokens);
     return answer;
 }
 
@@ -196,8 +350,9 @@ float quotePadding = 20.0;
  
  @param string The mutable attributed string to work on
  @param format The styles to apply (with range data stuffed!)
+ @param linkURL The URL the format links to, or nil if it isn't a (valid) link
  */
--(void)addAttributeToString:(NSMutableAttributedString *)string forFormat:(struct t_format)format {
+-(void)addAttributeToString:(NSMutableAttributedString *)string forFormat:(struct t_format)format linkURL:(NSString *)linkURL {
     //This is the range of the style
     NSRange currentRange = NSMakeRange(format.startPosition, format.endPosition-format.startPosition);
     //unpack commonly used format values
@@ -238,16 +393,9 @@ float quotePadding = 20.0;
         [string addAttribute:NSForegroundColorAttributeName value:quoteFontColor range:currentRange];
     }
     
-    if (format.linkURL) {
-        NSString *nsLinkURL = [NSString stringWithUTF8String:format.linkURL];
-        if ([NSURL URLWithString:nsLinkURL] != nil) {
-            [string addAttribute:NSLinkAttributeName value: nsLinkURL range:currentRange];
-            [string addAttribute:NSForegroundColorAttributeName value:linkColor range:currentRange];
-        }else {
-            //We were not able to set the URL, so feed forward that we don't actually have a URL
-            //this shouldn't have any consequences w.r.t. memory freeing since **all** URLs in a t_format are attempted to free, regardless if they are nil (i.e. .linkURL isn't checked since free(0x0) is documented to have no effect).
-            format.linkURL = 0x00;
-        }
+    if (linkURL) {
+        [string addAttribute:NSLinkAttributeName value: linkURL range:currentRange];
+        [string addAttribute:NSForegroundColorAttributeName value:linkColor range:currentRange];
     }
     
     
@@ -341,7 +489,7 @@ float quotePadding = 20.0;
         [string addAttribute:NSFontAttributeName value:customFont range:currentRange];
     }
     
-    if (FORMAT_TAG_GET_BIT_FIELD(format.formatTag, FORMAT_TAG_IS_CODE_OFFSET) == 0 && format.quoteLevel == 0 && format.linkURL == nil) {
+    if (FORMAT_TAG_GET_BIT_FIELD(format.formatTag, FORMAT_TAG_IS_CODE_OFFSET) == 0 && format.quoteLevel == 0 && linkURL == nil) {
         [string addAttribute:NSForegroundColorAttributeName value:defaultFontColor range:currentRange];
     }
 }
@@ -0,0 +1,403 @@
+//
+//  Pack.c
+//  HTMLFastParse
+//
+//  Copyright © 2026 CarbonDev. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Pack.h"
+#include "C_HTML_Parser.h"
+#include "UTF8.h"
+#include "Arena.h"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "Pack files are little endian"
+#endif
+
+//Readers use the runs in place, so t_run must have the same layout everywhere
+_Static_assert(sizeof(struct t_run) == 8 && offsetof(struct t_run, style) == 4 && offsetof(struct t_run, linkIndex) == 6, "t_run is stored as is in pack files");
+
+#define ALIGN(size, alignment) (((size) + ((alignment) - 1)) & ~(size_t)((alignment) - 1))
+
+struct PackWriter {
+    FILE *file;
+    //Where the next document goes, which is also where the index will go
+    uint64_t endOffset;
+    uint64_t *documentOffsets;
+    uint64_t numberOfDocuments;
+    uint64_t documentOffsetsCapacity;
+    struct Arena *scratchArena;
+    //Set once anything fails to write, so that closing doesn't write an index to a broken file
+    bool failed;
+};
+
+struct PackReader {
+    const char *base;
+    size_t size;
+    const uint64_t *documentOffsets;
+    uint64_t numberOfDocuments;
+};
+
+/**
+ A table in the document being written
+ */
+struct t_pack_table_source {
+    struct t_pack_table table;
+    //Where its HTML is in the input
+    size_t sourceStart;
+    size_t sourceLength;
+};
+
+/**
+ Open a pack file to append documents to, creating it if it doesn't exist. An existing pack is only added to, so it reads as it was until the writer is closed and stays that way if the writer fails. A new pack can't be read until the writer is closed
+
+ @param path The pack file
+ @return The writer, or NULL if the file can't be opened or isn't a pack file
+ */
+struct PackWriter* openPackWriter(const char *path) {
+    struct PackWriter *writer = calloc(1, sizeof(struct PackWriter));
+    if (!writer) {
+        return NULL;
+    }
+    writer->scratchArena = createArena(0);
+    writer->file = fopen(path, "r+b");
+    if (writer->file) {
+        //Carry on from an existing pack, keeping its index in memory. New documents and the new index go after the old index, which is left alone until the header is switched over
+        struct t_pack_header header;
+        struct stat status;
+        uint64_t numberOfDocuments;
+        bool isValid = fstat(fileno(writer->file), &status) == 0 && status.st_size >= (off_t)sizeof(struct t_pack_header);
+        uint64_t size = isValid ? (uint64_t)status.st_size : 0;
+        isValid = isValid && fread(&header, sizeof(header), 1, writer->file) == 1 && header.magic == PACK_MAGIC && header.version == PACK_VERSION;
+        //The same checks as openPackReader, so a damaged index can't make us allocate too little
+        isValid = isValid && header.indexOffset != 0 && header.indexOffset % 8 == 0 && header.indexOffset <= size - sizeof(uint64_t);
+        isValid = isValid && fseeko(writer->file, header.indexOffset, SEEK_SET) == 0 && fread(&numberOfDocuments, sizeof(numberOfDocuments), 1, writer->file) == 1;
+        isValid = isValid && numberOfDocuments <= (size - header.indexOffset - sizeof(uint64_t)) / sizeof(uint64_t);
+        if (isValid) {
+            writer->documentOffsetsCapacity = numberOfDocuments + 64;
+            writer->documentOffsets = malloc(writer->documentOffsetsCapacity * sizeof(uint64_t));
+            isValid = writer->documentOffsets && fread(writer->documentOffsets, sizeof(uint64_t), numberOfDocuments, writer->file) == numberOfDocuments;
+            writer->numberOfDocuments = numberOfDocuments;
+            writer->endOffset = header.indexOffset + (numberOfDocuments + 1) * sizeof(uint64_t);
+        }
+        if (!isValid) {
+            writer->failed = true;
+            closePackWriter(writer);
+            return NULL;
+        }
+    } else {
+        //A new pack is marked as being written until the writer is closed
+        struct t_pack_header header = {PACK_MAGIC, PACK_VERSION, 0};
+        writer->file = fopen(path, "w+b");
+        writer->endOffset = sizeof(struct t_pack_header);
+        if (writer->file && fwrite(&header, sizeof(header), 1, writer->file) != 1) {
+            writer->failed = true;
+        }
+    }
+
+    if (!writer->file || !writer->scratchArena || writer->failed || fseeko(writer->file, writer->endOffset, SEEK_SET) != 0) {
+        writer->failed = true;
+        closePackWriter(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+/**
+ Parse a document and append it to the pack. Tables are captured lazily and their HTML stored in the document, so opening one doesn't need the input
+
+ @param writer The writer
+ @param input Input text as a char array
+ @param inputLength The number of characters (as bytes) to read, excluding the null byte!
+ @return false if the document couldn't be written. The pack is still usable, without it
+ */
+bool appendPackDocument(struct PackWriter *writer, const char *input, size_t inputLength) {
+    if (writer->failed) {
+        return false;
+    }
+    struct Arena *arena = writer->scratchArena;
+    resetArena(arena);
+
+    size_t repairedLength;
+    char *repaired = repairUTF8(input, inputLength, &repairedLength, arena);
+    if (repaired) {
+        input = repaired;
+        inputLength = repairedLength;
+    }
+
+    struct t_tag *tags = arenaAlloc(arena, (maximumNumberOfTags(input, inputLength) + 1) * sizeof(struct t_tag));
+    if (!tags) {
+        return false;
+    }
+    int numberOfTags = 0;
+    int numberOfHumanVisibleCharacters = 0;
+    const char *displayText = tokenizeHTMLWithOptions((char *)input, inputLength, tags, &numberOfTags, &numberOfHumanVisibleCharacters, TOKENIZER_OPTION_LAZY_TABLES, arena);
+    if (!displayText) {
+        return false;
+    }
+    size_t displayTextLength = strlen(displayText);
+
+    //Flattening destroys the tags, so note the tables first
+    struct t_pack_table_source *tables = arenaAlloc(arena, (numberOfTags + 1) * sizeof(struct t_pack_table_source));
+    int numberOfTables = 0;
+    for (int i = 0; tables && i < numberOfTags; i++) {
+        if (tags[i].kind == TAG_KIND_TABLE && tags[i].tableSourceLength > 0) {
+            tables[numberOfTables].table.startPosition = tags[i].startPosition;
+            tables[numberOfTables].table.endPosition = tags[i].endPosition;
+            tables[numberOfTables].sourceStart = tags[i].tableSourceStart;
+            tables[numberOfTables].sourceLength = tags[i].tableSourceLength;
+            numberOfTables++;
+        }
+    }
+
+    struct t_run *runs = arenaAlloc(arena, (maximumNumberOfSimplifiedTags(numberOfTags, numberOfHumanVisibleCharacters) + 1) * sizeof(struct t_run));
+    int numberOfRuns = 0;
+    struct t_link_table links;
+    if (!tables || !runs) {
+        return false;
+    }
+    //A run can only link to one of the first 65535 URLs, so a document with more than that can't be stored
+    if (!makeRunsLinearWithArena(tags, numberOfTags, runs, &numberOfRuns, &links, numberOfHumanVisibleCharacters, arena)) {
+        return false;
+    }
+
+    //Lay the document out
+    struct t_pack_document document;
+    size_t size = sizeof(struct t_pack_document);
+    document.displayTextOffset = (uint32_t)size;
+    document.displayTextLength = (uint32_t)displayTextLength;
+    size = ALIGN(size + displayTextLength + 1, 4);
+    document.runsOffset = (uint32_t)size;
+    document.numberOfRuns = numberOfRuns;
+    size += numberOfRuns * sizeof(struct t_run);
+    document.tablesOffset = (uint32_t)size;
+    document.numberOfTables = numberOfTables;
+    size += numberOfTables * sizeof(struct t_pack_table);
+    for (int i = 0; i < numberOfTables; i++) {
+        tables[i].table.htmlOffset = (uint32_t)size;
+        tables[i].table.htmlLength = (uint32_t)tables[i].sourceLength;
+        size += tables[i].sourceLength;
+    }
+    size = ALIGN(size, 4);
+    document.urlOffsetsOffset = (uint32_t)size;
+    document.numberOfURLs = links.numberOfURLs;
+    size += links.numberOfURLs * sizeof(uint32_t);
+
+    //Table links point into the input, they're rewritten to point at the table's HTML in the document instead
+    uint32_t *urlOffsets = arenaAlloc(arena, (links.numberOfURLs + 1) * sizeof(uint32_t));
+    const struct t_pack_table **urlTables = arenaAlloc(arena, (links.numberOfURLs + 1) * sizeof(struct t_pack_table *));
+    if (!urlOffsets || !urlTables) {
+        return false;
+    }
+    for (int i = 0; i < links.numberOfURLs; i++) {
+        urlOffsets[i] = (uint32_t)size;
+        urlTables[i] = NULL;
+        size_t start;
+        size_t length;
+        if (tableSourceForLinkURL(links.urls[i], &start, &length)) {
+            for (int j = 0; j < numberOfTables && !urlTables[i]; j++) {
+                if (tables[j].sourceStart == start && tables[j].sourceLength == length) {
+                    urlTables[i] = &tables[j].table;
+                }
+            }
+        }
+        if (urlTables[i]) {
+            size += tableSourceLinkURL(NULL, 0, urlTables[i]->htmlOffset, urlTables[i]->htmlLength) + 1;
+        } else {
+            size += strlen(links.urls[i]) + 1;
+        }
+    }
+    size = ALIGN(size, 8);
+    if (size > UINT32_MAX) {
+        return false;
+    }
+    document.size = (uint32_t)size;
+    document.numberOfHumanVisibleCharacters = numberOfHumanVisibleCharacters;
+
+    //Then fill it in
+    char *block = arenaAlloc(arena, size);
+    if (!block) {
+        return false;
+    }
+    memset(block, 0, size);
+    memcpy(block, &document, sizeof(document));
+    memcpy(block + document.displayTextOffset, displayText, displayTextLength);
+    memcpy(block + document.runsOffset, runs, numberOfRuns * sizeof(struct t_run));
+    for (int i = 0; i < numberOfTables; i++) {
+        memcpy(block + document.tablesOffset + i * sizeof(struct t_pack_table), &tables[i].table, sizeof(struct t_pack_table));
+        memcpy(block + tables[i].table.htmlOffset, input + tables[i].sourceStart, tables[i].sourceLength);
+    }
+    memcpy(block + document.urlOffsetsOffset, urlOffsets, links.numberOfURLs * sizeof(uint32_t));
+    for (int i = 0; i < links.numberOfURLs; i++) {
+        if (urlTables[i]) {
+            tableSourceLinkURL(block + urlOffsets[i], size - urlOffsets[i], urlTables[i]->htmlOffset, urlTables[i]->htmlLength);
+        } else {
+            strcpy(block + urlOffsets[i], links.urls[i]);
+        }
+    }
+
+    if (writer->numberOfDocuments == writer->documentOffsetsCapacity) {
+        uint64_t capacity = writer->documentOffsetsCapacity * 2 + 64;
+        uint64_t *documentOffsets = realloc(writer->documentOffsets, capacity * sizeof(uint64_t));
+        if (!documentOffsets) {
+            return false;
+        }
+        writer->documentOffsets = documentOffsets;
+        writer->documentOffsetsCapacity = capacity;
+    }
+    if (fwrite(block, size, 1, writer->file) != 1) {
+        writer->failed = true;
+        return false;
+    }
+    writer->documentOffsets[writer->numberOfDocuments++] = writer->endOffset;
+    writer->endOffset += size;
+    return true;
+}
+
+/**
+ Write the index and close the pack file
+
+ @param writer The writer. May be NULL
+ @return false if anything failed to write, in which case readers won't open the file
+ */
+bool closePackWriter(struct PackWriter *writer) {
+    if (!writer) {
+        return false;
+    }
+    bool success = !writer->failed;
+    if (success) {
+        struct t_pack_header header = {PACK_MAGIC, PACK_VERSION, writer->endOffset};
+        success = fseeko(writer->file, writer->endOffset, SEEK_SET) == 0;
+        success = success && fwrite(&writer->numberOfDocuments, sizeof(uint64_t), 1, writer->file) == 1;
+        success = success && fwrite(writer->documentOffsets, sizeof(uint64_t), writer->numberOfDocuments, writer->file) == writer->numberOfDocuments;
+        //The header goes last, once everything it points at is on disk, so that readers only ever see the old index or the complete new one
+        success = success && fflush(writer->file) == 0 && fsync(fileno(writer->file)) == 0;
+        success = success && fseeko(writer->file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, writer->file) == 1;
+        success = success && fflush(writer->file) == 0;
+    }
+    if (writer->file && fclose(writer->file) != 0) {
+        success = false;
+    }
+    free(writer->documentOffsets);
+    destroyArena(writer->scratchArena);
+    free(writer);
+    return success;
+}
+
+/**
+ Map a pack file into memory. Nothing is read until a document is asked for
+
+ @param path The pack file
+ @return The reader, or NULL if the file can't be opened, isn't a pack file or is still being written
+ */
+struct PackReader* openPackReader(const char *path) {
+    int file = open(path, O_RDONLY);
+    if (file < 0) {
+        return NULL;
+    }
+    struct stat status;
+    if (fstat(file, &status) != 0 || status.st_size < (off_t)sizeof(struct t_pack_header)) {
+        close(file);
+        return NULL;
+    }
+    size_t size = (size_t)status.st_size;
+    const char *base = mmap(NULL, size, PROT_READ, MAP_SHARED, file, 0);
+    close(file);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+    const struct t_pack_header *header = (const struct t_pack_header *)base;
+    uint64_t indexOffset = header->indexOffset;
+    bool isValid = header->magic == PACK_MAGIC && header->version == PACK_VERSION;
+    isValid = isValid && indexOffset != 0 && indexOffset % 8 == 0 && indexOffset <= size - sizeof(uint64_t);
+    uint64_t numberOfDocuments = isValid ? *(const uint64_t *)(base + indexOffset) : 0;
+    isValid = isValid && numberOfDocuments <= (size - indexOffset - sizeof(uint64_t)) / sizeof(uint64_t);
+    struct PackReader *reader = isValid ? malloc(sizeof(struct PackReader)) : NULL;
+    if (!reader) {
+        munmap((void *)base, size);
+        return NULL;
+    }
+    reader->base = base;
+    reader->size = size;
+    reader->documentOffsets = (const uint64_t *)(base + indexOffset + sizeof(uint64_t));
+    reader->numberOfDocuments = numberOfDocuments;
+    return reader;
+}
+
+/**
+ Unmap a pack file. Documents from it can't be used after this
+
+ @param reader The reader. May be NULL
+ */
+void closePackReader(struct PackReader *reader) {
+    if (!reader) {
+        return;
+    }
+    munmap((void *)reader->base, reader->size);
+    free(reader);
+}
+
+uint64_t numberOfPackDocuments(const struct PackReader *reader) {
+    return reader->numberOfDocuments;
+}
+
+static inline bool isRegionInside(uint64_t offset, uint64_t length, uint64_t size) {
+    return offset <= size && length <= size - offset;
+}
+
+/**
+ Get a document in place. Its header, URLs and tables are checked to lie within the document (so a damaged file can't send you outside of it) but nothing is copied
+
+ @param reader The reader
+ @param index The document's position in the pack, in the order they were appended
+ @return The document, valid until the reader is closed. NULL if index is out of range or the document is damaged
+ */
+const struct t_pack_document * packDocument(const struct PackReader *reader, uint64_t index) {
+    if (index >= reader->numberOfDocuments) {
+        return NULL;
+    }
+    uint64_t offset = reader->documentOffsets[index];
+    if (offset % 8 != 0 || !isRegionInside(offset, sizeof(struct t_pack_document), reader->size)) {
+        return NULL;
+    }
+    const struct t_pack_document *document = (const struct t_pack_document *)(reader->base + offset);
+    uint64_t size = document->size;
+    const char *bytes = (const char *)document;
+    if (!isRegionInside(offset, size, reader->size) || size < sizeof(struct t_pack_document)) {
+        return NULL;
+    }
+
+    if (!isRegionInside(document->displayTextOffset, (uint64_t)document->displayTextLength + 1, size) || bytes[document->displayTextOffset + document->displayTextLength] != 0x00) {
+        return NULL;
+    }
+    if (document->runsOffset % 4 != 0 || !isRegionInside(document->runsOffset, (uint64_t)document->numberOfRuns * sizeof(struct t_run), size)) {
+        return NULL;
+    }
+    if (document->tablesOffset % 4 != 0 || !isRegionInside(document->tablesOffset, (uint64_t)document->numberOfTables * sizeof(struct t_pack_table), size)) {
+        return NULL;
+    }
+    for (uint32_t i = 0; i < document->numberOfTables; i++) {
+        const struct t_pack_table *table = &packTables(document)[i];
+        if (!isRegionInside(table->htmlOffset, table->htmlLength, size)) {
+            return NULL;
+        }
+    }
+    if (document->urlOffsetsOffset % 4 != 0 || !isRegionInside(document->urlOffsetsOffset, (uint64_t)document->numberOfURLs * sizeof(uint32_t), size)) {
+        return NULL;
+    }
+    const uint32_t *urlOffsets = (const uint32_t *)(bytes + document->urlOffsetsOffset);
+    for (uint32_t i = 0; i < document->numberOfURLs; i++) {
+        if (urlOffsets[i] >= size || !memchr(bytes + urlOffsets[i], 0x00, size - urlOffsets[i])) {
+            return NULL;
+        }
+    }
+    return document;
+}
@@ -0,0 +1,108 @@
+//
+//  Pack.h
+//  HTMLFastParse
+//
+//  Copyright © 2026 CarbonDev. All rights reserved.
+//
+
+#ifndef Pack_h
+#define Pack_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "t_run.h"
+
+/*
+ A pack file holds parsed documents so they can be served without parsing them again. Everything is little endian and every offset in a document is from the start of that document, so a document can be used straight out of an mmapped file.
+
+ FILE LAYOUT:
+ t_pack_header
+ t_pack_document, t_pack_document, ... (each starting on an 8 byte boundary)
+ The index: a uint64_t count followed by the uint64_t file offset of every document
+ Appending adds more documents and a new index after the old one, and the header is then pointed at the new index
+
+ DOCUMENT LAYOUT (each region aligned to 4 bytes):
+ t_pack_document
+ The display text, null terminated
+ The runs, as t_run
+ The tables, as t_pack_table, then the HTML of every table
+ The offset of every URL, as uint32_t, then the null terminated URLs
+ */
+#define PACK_MAGIC 0x4B504648u /* "HFPK" */
+#define PACK_VERSION 1
+
+struct t_pack_header {
+    uint32_t magic;
+    uint32_t version;
+    //The file offset of the current index. 0 until the writer which created the file is closed
+    uint64_t indexOffset;
+};
+
+struct t_pack_document {
+    //The size of the whole document, including this header
+    uint32_t size;
+    int32_t numberOfHumanVisibleCharacters;
+    uint32_t displayTextOffset;
+    //In bytes, excluding the null byte
+    uint32_t displayTextLength;
+    uint32_t runsOffset;
+    uint32_t numberOfRuns;
+    uint32_t urlOffsetsOffset;
+    uint32_t numberOfURLs;
+    uint32_t tablesOffset;
+    uint32_t numberOfTables;
+};
+
+/**
+ Where a table is in the display text and its HTML (from "<table" through the closing '>'), which parseTableHTML turns into a grid. A table's link is a tableSourceForLinkURL reference to the same HTML, relative to the start of the document
+ */
+struct t_pack_table {
+    uint32_t startPosition;
+    uint32_t endPosition;
+    uint32_t htmlOffset;
+    uint32_t htmlLength;
+};
+
+//Appending documents to a pack file
+struct PackWriter;
+
+struct PackWriter* openPackWriter(const char *path);
+bool appendPackDocument(struct PackWriter *writer, const char *input, size_t inputLength);
+bool closePackWriter(struct PackWriter *writer);
+
+//Reading documents from a pack file
+struct PackReader;
+
+struct PackReader* openPackReader(const char *path);
+void closePackReader(struct PackReader *reader);
+uint64_t numberOfPackDocuments(const struct PackReader *reader);
+const struct t_pack_document * packDocument(const struct PackReader *reader, uint64_t index);
+
+static inline const char * packDisplayText(const struct t_pack_document *document) {
+    return (const char *)document + document->displayTextOffset;
+}
+
+//Use formatForRun to unpack them, with numberOfHumanVisibleCharacters as the display text length
+static inline const struct t_run * packRuns(const struct t_pack_document *document) {
+    return (const struct t_run *)((const char *)document + document->runsOffset);
+}
+
+//The URL of a run's linkIndex, NULL if it doesn't link anywhere
+static inline const char * packLinkURL(const struct t_pack_document *document, unsigned int linkIndex) {
+    if (linkIndex == 0 || linkIndex > document->numberOfURLs) {
+        return NULL;
+    }
+    const uint32_t *urlOffsets = (const uint32_t *)((const char *)document + document->urlOffsetsOffset);
+    return (const char *)document + urlOffsets[linkIndex - 1];
+}
+
+static inline const struct t_pack_table * packTables(const struct t_pack_document *document) {
+    return (const struct t_pack_table *)((const char *)document + document->tablesOffset);
+}
+
+static inline const char * packTableHTML(const struct t_pack_document *document, const struct t_pack_table *table) {
+    return (const char *)document + table->htmlOffset;
+}
+
+#endif /* Pack_h */
@@ -0,0 +1,338 @@
+//
+//  ParseCache.c
+//  HTMLFastParse
+//
+//  Copyright © 2026 CarbonDev. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "ParseCache.h"
+#include "Batch.h"
+
+#define INITIAL_NUMBER_OF_BUCKETS 64
+
+/**
+ One cached result. It is freed once it has left the cache and no caller is still using it
+ */
+struct t_cache_entry {
+    //Callers are handed a pointer to this, so it must come first
+    struct t_parse_result result;
+    //The block from parseHTMLBatch which result points into
+    struct t_parse_result *block;
+    //The memory used by the entry and its block
+    size_t size;
+
+    uint64_t hash;
+    size_t inputLength;
+    //One for the cache while the entry is in it and one for each caller which hasn't released it yet
+    int references;
+
+    struct t_cache_entry *nextInBucket;
+    //The least recently used list
+    struct t_cache_entry *newer;
+    struct t_cache_entry *older;
+
+    //A copy of the input, since two inputs can share a hash
+    char input[];
+};
+
+struct ParseCache {
+    //Held for every lookup and change. Parsing happens outside of it
+    pthread_mutex_t lock;
+    size_t maximumSize;
+
+    //A power of two number of buckets
+    struct t_cache_entry **buckets;
+    size_t numberOfBuckets;
+
+    struct t_cache_entry *newest;
+    struct t_cache_entry *oldest;
+
+    struct t_parse_cache_statistics statistics;
+};
+
+static inline uint64_t multiplyAndFold(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t product = (__uint128_t)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+#else
+    //The same 128 bit product from 32 bit halves
+    uint64_t aHigh = a >> 32, aLow = (uint32_t)a, bHigh = b >> 32, bLow = (uint32_t)b;
+    uint64_t lowLow = aLow * bLow, lowHigh = aLow * bHigh, highLow = aHigh * bLow, highHigh = aHigh * bHigh;
+    uint64_t middle = (lowLow >> 32) + (uint32_t)lowHigh + (uint32_t)highLow;
+    uint64_t low = (middle << 32) | (uint32_t)lowLow;
+    uint64_t high = highHigh + (lowHigh >> 32) + (highLow >> 32) + (middle >> 32);
+    return low ^ high;
+#endif
+}
+
+static inline uint64_t read64(const unsigned char *bytes) {
+    uint64_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+/**
+ Hash the input 16 bytes at a time with a multiply and fold, in the style of wyhash
+ */
+static uint64_t hashInput(const char *input, size_t inputLength) {
+    static const uint64_t PRIMES[3] = {0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull};
+    const unsigned char *bytes = (const unsigned char *)input;
+    uint64_t seed = PRIMES[0] ^ inputLength;
+    size_t i = 0;
+    for (; i + 16 <= inputLength; i += 16) {
+        seed = multiplyAndFold(read64(&bytes[i]) ^ PRIMES[1], read64(&bytes[i + 8]) ^ seed);
+    }
+    unsigned char tail[16] = {0};
+    memcpy(tail, &bytes[i], inputLength - i);
+    seed = multiplyAndFold(read64(tail) ^ PRIMES[1], read64(&tail[8]) ^ seed);
+    return multiplyAndFold(seed ^ PRIMES[2], inputLength ^ PRIMES[1]);
+}
+
+/**
+ The memory used by a result from parseHTMLBatch, which puts the display text, formats and link table straight after the result in one block
+ */
+static size_t sizeOfParseResultBlock(const struct t_parse_result *block) {
+    const char *end = block->displayText + strlen(block->displayText) + 1;
+    if (block->numberOfFormats > 0 && (const char *)&block->formats[block->numberOfFormats] > end) {
+        end = (const char *)&block->formats[block->numberOfFormats];
+    }
+    if (block->links.numberOfURLs > 0) {
+        const char *lastURL = block->links.urls[block->links.numberOfURLs - 1];
+        if (lastURL + strlen(lastURL) + 1 > end) {
+            end = lastURL + strlen(lastURL) + 1;
+        }
+    }
+    return end - (const char *)block;
+}
+
+/**
+ Create a cache
+
+ @param maximumSize The most memory (in bytes) the cached results may use. Results bigger than this are never cached
+ @return The cache, or NULL if there is no memory for it. Destroy it with destroyParseCache
+ */
+struct ParseCache* createParseCache(size_t maximumSize) {
+    struct ParseCache *cache = calloc(1, sizeof(struct ParseCache));
+    if (!cache) {
+        return NULL;
+    }
+    cache->buckets = calloc(INITIAL_NUMBER_OF_BUCKETS, sizeof(struct t_cache_entry *));
+    if (!cache->buckets || pthread_mutex_init(&cache->lock, NULL) != 0) {
+        free(cache->buckets);
+        free(cache);
+        return NULL;
+    }
+    cache->numberOfBuckets = INITIAL_NUMBER_OF_BUCKETS;
+    cache->maximumSize = maximumSize;
+    return cache;
+}
+
+/**
+ Free a cache and everything in it. Every result from it must have been released first
+
+ @param cache The cache. May be NULL
+ */
+void destroyParseCache(struct ParseCache *cache) {
+    if (!cache) {
+        return;
+    }
+    struct t_cache_entry *entry = cache->newest;
+    while (entry) {
+        struct t_cache_entry *older = entry->older;
+        free(entry->block);
+        free(entry);
+        entry = older;
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->buckets);
+    free(cache);
+}
+
+static struct t_cache_entry * findEntry(struct ParseCache *cache, uint64_t hash, const char *input, size_t inputLength) {
+    struct t_cache_entry *entry = cache->buckets[hash & (cache->numberOfBuckets - 1)];
+    while (entry && (entry->hash != hash || entry->inputLength != inputLength || memcmp(entry->input, input, inputLength) != 0)) {
+        entry = entry->nextInBucket;
+    }
+    return entry;
+}
+
+static void unlinkFromList(struct ParseCache *cache, struct t_cache_entry *entry) {
+    if (entry->newer) {
+        entry->newer->older = entry->older;
+    } else {
+        cache->newest = entry->older;
+    }
+    if (entry->older) {
+        entry->older->newer = entry->newer;
+    } else {
+        cache->oldest = entry->newer;
+    }
+}
+
+static void pushToList(struct ParseCache *cache, struct t_cache_entry *entry) {
+    entry->newer = NULL;
+    entry->older = cache->newest;
+    if (cache->newest) {
+        cache->newest->newer = entry;
+    } else {
+        cache->oldest = entry;
+    }
+    cache->newest = entry;
+}
+
+/**
+ Double the number of buckets once there are more entries than buckets. If there is no memory for that the chains just get longer
+ */
+static void growBuckets(struct ParseCache *cache) {
+    size_t numberOfBuckets = cache->numberOfBuckets * 2;
+    struct t_cache_entry **buckets = calloc(numberOfBuckets, sizeof(struct t_cache_entry *));
+    if (!buckets) {
+        return;
+    }
+    for (size_t i = 0; i < cache->numberOfBuckets; i++) {
+        struct t_cache_entry *entry = cache->buckets[i];
+        while (entry) {
+            struct t_cache_entry *next = entry->nextInBucket;
+            size_t bucket = entry->hash & (numberOfBuckets - 1);
+            entry->nextInBucket = buckets[bucket];
+            buckets[bucket] = entry;
+            entry = next;
+        }
+    }
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->numberOfBuckets = numberOfBuckets;
+}
+
+static void releaseEntry(struct t_cache_entry *entry) {
+    entry->references--;
+    if (entry->references == 0) {
+        free(entry->block);
+        free(entry);
+    }
+}
+
+/**
+ Take the least recently used entry out of the cache. It lives on until its last caller releases it
+ */
+static void evictOldestEntry(struct ParseCache *cache) {
+    struct t_cache_entry *entry = cache->oldest;
+    struct t_cache_entry **link = &cache->buckets[entry->hash & (cache->numberOfBuckets - 1)];
+    while (*link != entry) {
+        link = &(*link)->nextInBucket;
+    }
+    *link = entry->nextInBucket;
+    unlinkFromList(cache, entry);
+
+    cache->statistics.numberOfEntries--;
+    cache->statistics.size -= entry->size;
+    cache->statistics.evictions++;
+    releaseEntry(entry);
+}
+
+/**
+ Parse HTML, or get the result of parsing the same HTML before. The result is the same as parseHTMLBatch gives for the input on its own
+
+ @param cache The cache
+ @param input Input text as a char array
+ @param inputLength The number of characters (as bytes) to read, excluding the null byte!
+ @return The result, which can't be changed. It stays valid (even if it is evicted) until it is given to releaseCachedParseResult. NULL if there is no memory to parse the input
+ */
+const struct t_parse_result * parseHTMLCached(struct ParseCache *cache, const char *input, size_t inputLength) {
+    uint64_t hash = hashInput(input, inputLength);
+
+    pthread_mutex_lock(&cache->lock);
+    struct t_cache_entry *entry = findEntry(cache, hash, input, inputLength);
+    if (entry) {
+        cache->statistics.hits++;
+        unlinkFromList(cache, entry);
+        pushToList(cache, entry);
+        entry->references++;
+        pthread_mutex_unlock(&cache->lock);
+        return &entry->result;
+    }
+    cache->statistics.misses++;
+    pthread_mutex_unlock(&cache->lock);
+
+    //Parse without holding the lock so that other threads can keep using the cache meanwhile
+    struct t_html_input document = {input, inputLength};
+    struct t_parse_result *block = parseHTMLBatch(&document, 1, NULL);
+    if (!block) {
+        return NULL;
+    }
+    struct t_cache_entry *newEntry = malloc(sizeof(struct t_cache_entry) + inputLength);
+    if (!newEntry) {
+        free(block);
+        return NULL;
+    }
+    newEntry->result = *block;
+    newEntry->block = block;
+    newEntry->size = sizeOfParseResultBlock(block) + sizeof(struct t_cache_entry) + inputLength;
+    newEntry->hash = hash;
+    newEntry->inputLength = inputLength;
+    memcpy(newEntry->input, input, inputLength);
+    newEntry->references = 1;
+
+    pthread_mutex_lock(&cache->lock);
+    //Another thread may have parsed the same input while the lock was let go
+    entry = findEntry(cache, hash, input, inputLength);
+    if (entry) {
+        unlinkFromList(cache, entry);
+        pushToList(cache, entry);
+        entry->references++;
+        pthread_mutex_unlock(&cache->lock);
+        free(block);
+        free(newEntry);
+        return &entry->result;
+    }
+    if (newEntry->size <= cache->maximumSize) {
+        if ((size_t)cache->statistics.numberOfEntries >= cache->numberOfBuckets) {
+            growBuckets(cache);
+        }
+        size_t bucket = hash & (cache->numberOfBuckets - 1);
+        newEntry->nextInBucket = cache->buckets[bucket];
+        cache->buckets[bucket] = newEntry;
+        pushToList(cache, newEntry);
+        newEntry->references++;
+        cache->statistics.numberOfEntries++;
+        cache->statistics.size += newEntry->size;
+        //The new entry is the newest and fits on its own, so it is never the one evicted
+        while (cache->statistics.size > cache->maximumSize) {
+            evictOldestEntry(cache);
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return &newEntry->result;
+}
+
+/**
+ Let the cache know a result from parseHTMLCached is no longer being used
+
+ @param cache The cache the result came from
+ @param result The result. May be NULL
+ */
+void releaseCachedParseResult(struct ParseCache *cache, const struct t_parse_result *result) {
+    if (!result) {
+        return;
+    }
+    pthread_mutex_lock(&cache->lock);
+    releaseEntry((struct t_cache_entry *)result);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ Get the hit, miss and eviction counts and how full the cache is
+
+ @param cache The cache
+ @param statistics (returned) The statistics
+ */
+void getParseCacheStatistics(struct ParseCache *cache, struct t_parse_cache_statistics *statistics) {
+    pthread_mutex_lock(&cache->lock);
+    *statistics = cache->statistics;
+    pthread_mutex_unlock(&cache->lock);
+}
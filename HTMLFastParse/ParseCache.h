@@ -0,0 +1,39 @@
+//
+//  ParseCache.h
+//  HTMLFastParse
+//
+//  Copyright © 2026 CarbonDev. All rights reserved.
+//
+
+#ifndef ParseCache_h
+#define ParseCache_h
+
+#include <stdio.h>
+#include "t_parse_result.h"
+
+/**
+ A cache of parse results keyed on the input, so the same HTML ("[deleted]", bot boilerplate, comments scrolled back into view) is only parsed once. The least recently used results are dropped once the cache is over its size. It may be shared between threads
+ */
+struct ParseCache;
+
+/**
+ How well the cache is doing
+ */
+struct t_parse_cache_statistics {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    //The number of results in the cache and the memory they use
+    int numberOfEntries;
+    size_t size;
+};
+
+struct ParseCache* createParseCache(size_t maximumSize);
+void destroyParseCache(struct ParseCache *cache);
+
+const struct t_parse_result * parseHTMLCached(struct ParseCache *cache, const char *input, size_t inputLength);
+void releaseCachedParseResult(struct ParseCache *cache, const struct t_parse_result *result);
+
+void getParseCacheStatistics(struct ParseCache *cache, struct t_parse_cache_statistics *statistics);
+
+#endif /* ParseCache_h */
@@ -5,26 +5,48 @@
 // C program for array implementation of stack
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include <limits.h>
 #include "t_tag.h"
 #include "Stack.h"
+#include "Arena.h"
+
+// Real documents rarely nest more than this deep, so this many entries are
+// kept inside the stack itself and the array is only allocated past that
+#define STACK_INLINE_CAPACITY 16
 
 // A structure to represent a stack
 struct Stack
 {
 	int top;
 	unsigned capacity;
+	// Either inlineArray or, once the stack has outgrown it, an allocation
 	struct t_tag* array;
+	struct Arena* arena;
+	struct t_tag inlineArray[STACK_INLINE_CAPACITY];
 };
 
-// function to create a stack of given capacity. It initializes size of
-// stack as 0
-struct Stack* createStack(unsigned capacity)
+// function to create a stack of given initial capacity. It initializes size of
+// stack as 0. Pass a NULL arena to use malloc
+struct Stack* createStack(unsigned capacity, struct Arena* arena)
 {
-	struct Stack* stack = (struct Stack*) malloc(sizeof(struct Stack));
-	stack->capacity = capacity;
+	struct Stack* stack = (struct Stack*) arenaAlloc(arena, sizeof(struct Stack));
+	if (!stack)
+		return NULL;
 	stack->top = -1;
-	stack->array = malloc(stack->capacity * sizeof(struct t_tag));
+	stack->arena = arena;
+	if (capacity <= STACK_INLINE_CAPACITY) {
+		stack->capacity = STACK_INLINE_CAPACITY;
+		stack->array = stack->inlineArray;
+	} else {
+		stack->capacity = capacity;
+		stack->array = arenaAlloc(arena, stack->capacity * sizeof(struct t_tag));
+		if (!stack->array) {
+			stack->capacity = STACK_INLINE_CAPACITY;
+			stack->array = stack->inlineArray;
+		}
+	}
 	return stack;
 }
 
@@ -37,11 +59,30 @@ int isEmpty(struct Stack* stack)
 {   return stack->top == -1;  }
 
 // Function to add an item to stack.  It increases top by 1
-void push(struct Stack* stack, struct t_tag item)
+// The stack doubles in size when it is full so that its capacity tracks the
+// real nesting depth rather than having to be sized for the worst case up front.
+// Returns false, leaving the stack as it was, if it could not grow
+bool push(struct Stack* stack, struct t_tag item)
 {
-	if (isFull(stack))
-		return;
+	if (isFull(stack)) {
+		if (stack->capacity > INT_MAX / 2 || (size_t)stack->capacity * 2 > SIZE_MAX / sizeof(struct t_tag))
+			return false;
+		unsigned newCapacity = stack->capacity * 2;
+		struct t_tag* newArray;
+		if (stack->array == stack->inlineArray) {
+			newArray = arenaAlloc(stack->arena, newCapacity * sizeof(struct t_tag));
+			if (newArray)
+				memcpy(newArray, stack->inlineArray, stack->capacity * sizeof(struct t_tag));
+		} else {
+			newArray = arenaRealloc(stack->arena, stack->array, stack->capacity * sizeof(struct t_tag), newCapacity * sizeof(struct t_tag));
+		}
+		if (!newArray)
+			return false;
+		stack->array = newArray;
+		stack->capacity = newCapacity;
+	}
 	stack->array[++stack->top] = item;
+	return true;
 }
 
 // Function to remove an item from stack.  It decreases top by 1
@@ -53,5 +94,9 @@ struct t_tag* pop(struct Stack* stack)
 }
 
 void prepareForFree(struct Stack* stack) {
-	free(stack->array);
+	if (stack->array != stack->inlineArray)
+		arenaFree(stack->arena, stack->array);
+	stack->array = stack->inlineArray;
+	stack->capacity = STACK_INLINE_CAPACITY;
+	stack->top = -1;
 }
@@ -1,16 +1,18 @@
 //
 // Created by Allison Husain on 4/27/18.
 //
+#include <stdbool.h>
 #include "t_tag.h"
+#include "Arena.h"
 #ifndef HTMLTOATTR_STACK_H
 #define HTMLTOATTR_STACK_H
 
 
 struct Stack;
-struct Stack* createStack(unsigned capacity);
+struct Stack* createStack(unsigned capacity, struct Arena* arena);
 int isFull(struct Stack* stack);
 int isEmpty(struct Stack* stack);
-void push(struct Stack* stack, struct t_tag);
+bool push(struct Stack* stack, struct t_tag);
 struct t_tag* pop(struct Stack* stack);
 void prepareForFree(struct Stack* stack);
 #endif //HTMLTOATTR_STACK_H
@@ -0,0 +1,378 @@
+//
+//  Table.c
+//  HTMLFastParse
+//
+//  Copyright © 2026 CarbonDev. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "Table.h"
+#include "C_HTML_Parser.h"
+
+//A cell found while walking the table's tags, before its text and runs are copied out
+struct t_table_cell_range {
+    unsigned int startPosition;
+    unsigned int endPosition;
+    unsigned char align;
+    bool isHeader;
+};
+
+static size_t alignOffset(size_t offset, size_t alignment) {
+    return (offset + (alignment - 1)) & ~(alignment - 1);
+}
+
+static unsigned char alignForTag(const struct t_tag *tag) {
+    size_t length;
+    const char *align = tagAttribute(tag, TAG_ATTRIBUTE_ALIGN, &length);
+    if (!align) {
+        return TABLE_ALIGN_NONE;
+    } else if (length == 4 && memcmp(align, "left", 4) == 0) {
+        return TABLE_ALIGN_LEFT;
+    } else if (length == 6 && memcmp(align, "center", 6) == 0) {
+        return TABLE_ALIGN_CENTER;
+    } else if (length == 5 && memcmp(align, "right", 5) == 0) {
+        return TABLE_ALIGN_RIGHT;
+    }
+    return TABLE_ALIGN_NONE;
+}
+
+/**
+ Find the first run which covers part of a range. Runs are sorted and never overlap, so their end positions are too
+
+ @param formats The runs
+ @param numberOfFormats The number of runs
+ @param startPosition The start of the range
+ @param endPosition The end of the range
+ @return The index of the run, or numberOfFormats if the range is empty or every run ends before it
+ */
+static int firstFormatInRange(const struct t_format formats[], int numberOfFormats, unsigned int startPosition, unsigned int endPosition) {
+    if (startPosition >= endPosition) {
+        return numberOfFormats;
+    }
+    int low = 0;
+    int high = numberOfFormats;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (formats[middle].endPosition <= startPosition) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/**
+ Parse a table into a grid of cells. The table's HTML goes through the same tokenizer and flattening as a document, so each cell's text and runs are exactly what that HTML would give on its own. Nested tables become "[View table]" links inside their cell.
+
+ Only cells which are closed are kept and a row is every cell since the previous </tr>, so cells outside of a row still end up in one.
+
+ @param html The table's raw HTML, from "<table" through "</table>" (see tableSourceStart and tableSourceLength in t_tag)
+ @param htmlLength The number of bytes of HTML
+ @param scratchArena The arena to use for working memory, which is reset first. Pass NULL to have one created for just this table
+ @return The table. Everything (the cells, their text and runs and the link table) lives in this one block, so free() it once you are done. NULL on failure
+ */
+struct t_table * parseTableHTML(const char *html, size_t htmlLength, struct Arena *scratchArena) {
+    struct Arena *ownedArena = NULL;
+    if (!scratchArena) {
+        ownedArena = scratchArena = createArena(0);
+        if (!scratchArena) {
+            return NULL;
+        }
+    }
+    resetArena(scratchArena);
+
+    //The tokenizer skips tables whole, so only give it what's between <table ...> and the last </table>
+    const char *inner = html;
+    size_t innerLength = htmlLength;
+    if (htmlLength >= 6 && memcmp(html, "<table", 6) == 0) {
+        const char *tableTagEnd = memchr(html, '>', htmlLength);
+        inner = tableTagEnd ? tableTagEnd + 1 : html + htmlLength;
+        innerLength = htmlLength - (inner - html);
+        for (size_t i = innerLength; i-- > 0;) {
+            if (inner[i] == '<' && innerLength - i >= 7 && memcmp(inner + i, "</table", 7) == 0) {
+                innerLength = i;
+                break;
+            }
+        }
+    }
+
+    int numberOfTags = 0;
+    int numberOfHumanVisibleCharacters = 0;
+    struct t_tag *tags = arenaAlloc(scratchArena, (maximumNumberOfTags(inner, innerLength) + 1) * sizeof(struct t_tag));
+    if (!tags) {
+        destroyArena(ownedArena);
+        return NULL;
+    }
+    char *displayText = tokenizeHTMLWithArena((char *)inner, innerLength, tags, &numberOfTags, &numberOfHumanVisibleCharacters, scratchArena);
+    if (!displayText) {
+        destroyArena(ownedArena);
+        return NULL;
+    }
+
+    //Tags are completed in the order they close, so a row's cells always come just before it
+    struct t_table_cell_range *cellRanges = arenaAlloc(scratchArena, (numberOfTags + 1) * sizeof(struct t_table_cell_range));
+    int *rowStarts = arenaAlloc(scratchArena, (numberOfTags + 2) * sizeof(int));
+    if (!cellRanges || !rowStarts) {
+        destroyArena(ownedArena);
+        return NULL;
+    }
+    int numberOfCells = 0;
+    int numberOfRows = 0;
+    rowStarts[0] = 0;
+    for (int i = 0; i <= numberOfTags; i++) {
+        bool isEnd = i == numberOfTags;
+        if (!isEnd && (tags[i].kind == TAG_KIND_TABLE_HEADER_CELL || tags[i].kind == TAG_KIND_TABLE_DATA_CELL)) {
+            struct t_table_cell_range *cell = &cellRanges[numberOfCells++];
+            cell->startPosition = tags[i].startPosition;
+            cell->endPosition = tags[i].endPosition;
+            cell->align = alignForTag(&tags[i]);
+            cell->isHeader = tags[i].kind == TAG_KIND_TABLE_HEADER_CELL;
+        } else if (!isEnd && tags[i].kind == TAG_KIND_TABLE) {
+            //A nested table is skipped whole and becomes a link, but the cells and rows inside it are still completed (after its "[View table]" text) just before it is
+            while (numberOfCells > 0 && cellRanges[numberOfCells - 1].startPosition > tags[i].startPosition) {
+                numberOfCells--;
+            }
+            while (numberOfRows > 0 && rowStarts[numberOfRows] > numberOfCells) {
+                numberOfRows--;
+            }
+        } else if ((isEnd || tags[i].kind == TAG_KIND_TABLE_ROW) && numberOfCells > rowStarts[numberOfRows]) {
+            rowStarts[++numberOfRows] = numberOfCells;
+        }
+    }
+    int numberOfColumns = 0;
+    for (int i = 0; i < numberOfRows; i++) {
+        if (rowStarts[i + 1] - rowStarts[i] > numberOfColumns) {
+            numberOfColumns = rowStarts[i + 1] - rowStarts[i];
+        }
+    }
+
+    int numberOfFormats = 0;
+    struct t_format *formats = arenaAlloc(scratchArena, (maximumNumberOfSimplifiedTags(numberOfTags, numberOfHumanVisibleCharacters) + 1) * sizeof(struct t_format));
+    if (!formats) {
+        destroyArena(ownedArena);
+        return NULL;
+    }
+    struct t_link_table links;
+    if (!makeAttributesLinearWithArena(tags, numberOfTags, formats, &numberOfFormats, &links, numberOfHumanVisibleCharacters, scratchArena)) {
+        destroyArena(ownedArena);
+        return NULL;
+    }
+
+    //Cells are found by visible position, but their text is copied by byte. Positions in the middle of a four byte character (which counts twice) point at its start
+    size_t displayTextSize = strlen(displayText);
+    size_t *byteOffsets = arenaAlloc(scratchArena, (numberOfHumanVisibleCharacters + 1) * sizeof(size_t));
+    if (!byteOffsets) {
+        destroyArena(ownedArena);
+        return NULL;
+    }
+    int visible = 0;
+    for (size_t i = 0; i < displayTextSize && visible < numberOfHumanVisibleCharacters; i++) {
+        int effect = getVisibleByteEffectForCharacter(displayText[i]);
+        for (int k = 0; k < effect && visible < numberOfHumanVisibleCharacters; k++) {
+            byteOffsets[visible++] = i;
+        }
+    }
+    while (visible <= numberOfHumanVisibleCharacters) {
+        byteOffsets[visible++] = displayTextSize;
+    }
+
+    //Size everything up so the result can be a single block
+    size_t textSize = 0;
+    size_t numberOfCellFormats = 0;
+    for (int i = 0; i < numberOfCells; i++) {
+        struct t_table_cell_range *cell = &cellRanges[i];
+        if (cell->endPosition > (unsigned int)numberOfHumanVisibleCharacters) {
+            cell->endPosition = numberOfHumanVisibleCharacters;
+        }
+        if (cell->startPosition > cell->endPosition) {
+            cell->startPosition = cell->endPosition;
+        }
+        textSize += byteOffsets[cell->endPosition] - byteOffsets[cell->startPosition] + 1;
+        for (int j = firstFormatInRange(formats, numberOfFormats, cell->startPosition, cell->endPosition); j < numberOfFormats && formats[j].startPosition < cell->endPosition; j++) {
+            numberOfCellFormats++;
+        }
+    }
+    size_t linksSize = 0;
+    if (links.numberOfURLs > 0) {
+        const char *lastURL = links.urls[links.numberOfURLs - 1];
+        linksSize = (lastURL + strlen(lastURL) + 1) - (const char *)links.urls;
+    }
+
+    size_t cellsOffset = alignOffset(sizeof(struct t_table), _Alignof(struct t_table_cell));
+    size_t rowStartsOffset = alignOffset(cellsOffset + numberOfCells * sizeof(struct t_table_cell), _Alignof(int));
+    size_t formatsOffset = alignOffset(rowStartsOffset + (numberOfRows + 1) * sizeof(int), _Alignof(struct t_format));
+    size_t linksOffset = alignOffset(formatsOffset + numberOfCellFormats * sizeof(struct t_format), _Alignof(char *));
+    size_t textOffset = linksOffset + linksSize;
+    char *block = malloc(textOffset + textSize);
+    if (!block) {
+        destroyArena(ownedArena);
+        return NULL;
+    }
+
+    struct t_table *table = (struct t_table *)block;
+    table->cells = (struct t_table_cell *)(block + cellsOffset);
+    table->numberOfCells = numberOfCells;
+    table->rowStarts = (int *)(block + rowStartsOffset);
+    table->numberOfRows = numberOfRows;
+    table->numberOfColumns = numberOfColumns;
+    memcpy(table->rowStarts, rowStarts, (numberOfRows + 1) * sizeof(int));
+
+    //The link table is already a single allocation, so it's copied as is and its pointers moved over
+    struct t_link_table tableLinks = {NULL, links.numberOfURLs};
+    if (links.numberOfURLs > 0) {
+        tableLinks.urls = (char **)(block + linksOffset);
+        memcpy(tableLinks.urls, links.urls, linksSize);
+        for (int i = 0; i < links.numberOfURLs; i++) {
+            tableLinks.urls[i] = (char *)tableLinks.urls + (links.urls[i] - (char *)links.urls);
+        }
+    }
+
+    struct t_format *cellFormats = (struct t_format *)(block + formatsOffset);
+    char *text = block + textOffset;
+    for (int i = 0; i < numberOfCells; i++) {
+        const struct t_table_cell_range *range = &cellRanges[i];
+        struct t_table_cell *cell = &table->cells[i];
+        cell->align = range->align;
+        cell->isHeader = range->isHeader;
+
+        size_t cellTextSize = byteOffsets[range->endPosition] - byteOffsets[range->startPosition];
+        memcpy(text, displayText + byteOffsets[range->startPosition], cellTextSize);
+        text[cellTextSize] = 0x00;
+        cell->content.displayText = text;
+        cell->content.numberOfHumanVisibleCharacters = range->endPosition - range->startPosition;
+        text += cellTextSize + 1;
+
+        //Clip the runs to the cell and move them to its start
+        cell->content.formats = cellFormats;
+        cell->content.numberOfFormats = 0;
+        for (int j = firstFormatInRange(formats, numberOfFormats, range->startPosition, range->endPosition); j < numberOfFormats && formats[j].startPosition < range->endPosition; j++) {
+            struct t_format format = formats[j];
+            format.startPosition = (format.startPosition > range->startPosition ? format.startPosition : range->startPosition) - range->startPosition;
+            format.endPosition = (format.endPosition < range->endPosition ? format.endPosition : range->endPosition) - range->startPosition;
+            cellFormats[cell->content.numberOfFormats++] = format;
+        }
+        if (cell->content.numberOfFormats == 0) {
+            cell->content.formats = NULL;
+        }
+        cellFormats += cell->content.numberOfFormats;
+        cell->content.links = tableLinks;
+    }
+
+    destroyArena(ownedArena);
+    return table;
+}
+
+struct t_table_cache_entry {
+    size_t start;
+    size_t length;
+    struct t_table *table;
+};
+
+struct t_table_cache {
+    const char *input;
+    size_t inputLength;
+    //Shared by every table the cache parses
+    struct Arena *scratchArena;
+
+    //Most documents have a handful of tables at most, so these are searched in order
+    struct t_table_cache_entry *entries;
+    int numberOfEntries;
+    int entriesCapacity;
+};
+
+/**
+ Create a cache of the tables in one document. Nothing is parsed until a table is asked for, and then only that table, once. Use it with TOKENIZER_OPTION_LAZY_TABLES, whose table links point back into the input.
+
+ @param input The document's input, which the cache reads tables from. It must outlive the cache
+ @param inputLength The number of bytes in the input
+ @return The cache, or NULL on failure
+ */
+struct t_table_cache * createTableCache(const char *input, size_t inputLength) {
+    struct t_table_cache *cache = calloc(1, sizeof(struct t_table_cache));
+    if (!cache) {
+        return NULL;
+    }
+    cache->input = input;
+    cache->inputLength = inputLength;
+    return cache;
+}
+
+/**
+ Get the table at a range of the input, parsing it if this is the first time it's been asked for
+
+ @param cache The cache
+ @param start The table's tableSourceStart
+ @param length The table's tableSourceLength
+ @return The table, owned by the cache. NULL if the range isn't inside the input or the table couldn't be parsed
+ */
+const struct t_table * tableForSource(struct t_table_cache *cache, size_t start, size_t length) {
+    if (start > cache->inputLength || length > cache->inputLength - start) {
+        return NULL;
+    }
+    for (int i = 0; i < cache->numberOfEntries; i++) {
+        if (cache->entries[i].start == start && cache->entries[i].length == length) {
+            return cache->entries[i].table;
+        }
+    }
+
+    if (cache->numberOfEntries == cache->entriesCapacity) {
+        int newCapacity = cache->entriesCapacity > 0 ? cache->entriesCapacity * 2 : 4;
+        struct t_table_cache_entry *newEntries = realloc(cache->entries, newCapacity * sizeof(struct t_table_cache_entry));
+        if (!newEntries) {
+            return NULL;
+        }
+        cache->entries = newEntries;
+        cache->entriesCapacity = newCapacity;
+    }
+    if (!cache->scratchArena) {
+        cache->scratchArena = createArena(0);
+        if (!cache->scratchArena) {
+            return NULL;
+        }
+    }
+
+    struct t_table *table = parseTableHTML(cache->input + start, length, cache->scratchArena);
+    if (!table) {
+        return NULL;
+    }
+    struct t_table_cache_entry entry = {start, length, table};
+    cache->entries[cache->numberOfEntries++] = entry;
+    return table;
+}
+
+/**
+ Get the table a link from a lazily captured table points to
+
+ @param cache The cache of the document the link came from
+ @param linkURL The link's URL
+ @return The table, owned by the cache. NULL if the link isn't a lazily captured table
+ */
+const struct t_table * tableForLinkURL(struct t_table_cache *cache, const char *linkURL) {
+    size_t start;
+    size_t length;
+    if (!tableSourceForLinkURL(linkURL, &start, &length)) {
+        return NULL;
+    }
+    return tableForSource(cache, start, length);
+}
+
+/**
+ Destroy a table cache along with every table it parsed
+
+ @param cache The cache
+ */
+void destroyTableCache(struct t_table_cache *cache) {
+    if (!cache) {
+        return;
+    }
+    for (int i = 0; i < cache->numberOfEntries; i++) {
+        free(cache->entries[i].table);
+    }
+    free(cache->entries);
+    destroyArena(cache->scratchArena);
+    free(cache);
+}
@@ -0,0 +1,27 @@
+//
+//  Table.h
+//  HTMLFastParse
+//
+//  Copyright © 2026 CarbonDev. All rights reserved.
+//
+
+#ifndef Table_h
+#define Table_h
+
+#include <stdio.h>
+#include "t_table.h"
+#include "Arena.h"
+
+struct t_table * parseTableHTML(const char *html, size_t htmlLength, struct Arena *scratchArena);
+
+/**
+ The tables of one document, parsed the first time each one is asked for. See createTableCache
+ */
+struct t_table_cache;
+
+struct t_table_cache * createTableCache(const char *input, size_t inputLength);
+const struct t_table * tableForSource(struct t_table_cache *cache, size_t start, size_t length);
+const struct t_table * tableForLinkURL(struct t_table_cache *cache, const char *linkURL);
+void destroyTableCache(struct t_table_cache *cache);
+
+#endif /* Table_h */
@@ -0,0 +1,243 @@
+//
+//  TextScan.c
+//  HTMLFastParse
+//
+//  Copyright © 2026 CarbonDev. All rights reserved.
+//
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "TextScan.h"
+#include "CPUFeatures.h"
+
+/*
+ A visible character (as NSString counts them) starts at every byte which is not a UTF-8 continuation byte (10xxxxxx).
+ Four byte characters are counted twice since they are a surrogate pair in UTF-16. This must agree with getVisibleByteEffectForCharacter.
+ */
+#define IS_NOT_CONTINUATION_BYTE(c) (((c) & 0xC0) != 0x80)
+#define IS_FOUR_BYTE_LEAD(c) ((c) >= 0xF0)
+
+static inline bool isTextRunTerminator(unsigned char c) {
+    return c == '<' || c == '>' || c == '&' || c == '\n';
+}
+
+static inline bool isTagDelimiter(unsigned char c) {
+    return c == '<' || c == '>';
+}
+
+/**
+ Count the visible characters in a buffer one byte at a time
+ */
+static inline int countVisibleCharactersScalar(const unsigned char *text, size_t length) {
+    int count = 0;
+    for (size_t i = 0; i < length; i++) {
+        count += IS_NOT_CONTINUATION_BYTE(text[i]) + IS_FOUR_BYTE_LEAD(text[i]);
+    }
+    return count;
+}
+
+static size_t scanTextRunScalar(const char *text, size_t length, int *visibleCharacters) {
+    const unsigned char *bytes = (const unsigned char *)text;
+    size_t i = 0;
+    while (i < length && !isTextRunTerminator(bytes[i])) {
+        i++;
+    }
+    *visibleCharacters += countVisibleCharactersScalar(bytes, i);
+    return i;
+}
+
+static size_t scanToTagDelimiterScalar(const char *text, size_t length) {
+    const unsigned char *bytes = (const unsigned char *)text;
+    size_t i = 0;
+    while (i < length && !isTagDelimiter(bytes[i])) {
+        i++;
+    }
+    return i;
+}
+
+#if CPU_X86
+
+static size_t scanTextRunSSE2(const char *text, size_t length, int *visibleCharacters) {
+    const __m128i lessThan = _mm_set1_epi8('<');
+    const __m128i greaterThan = _mm_set1_epi8('>');
+    const __m128i ampersand = _mm_set1_epi8('&');
+    const __m128i newLine = _mm_set1_epi8('\n');
+    //Continuation bytes are 0x80-0xBF, which are the only bytes <= 0xBF when compared as signed
+    const __m128i lastContinuationByte = _mm_set1_epi8((char)0xBF);
+    const __m128i firstFourByteLead = _mm_set1_epi8((char)0xF0);
+
+    int count = 0;
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(text + i));
+        __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, lessThan), _mm_cmpeq_epi8(block, greaterThan)),
+                                       _mm_or_si128(_mm_cmpeq_epi8(block, ampersand), _mm_cmpeq_epi8(block, newLine)));
+        unsigned int specialMask = _mm_movemask_epi8(special);
+        unsigned int visibleMask = _mm_movemask_epi8(_mm_cmpgt_epi8(block, lastContinuationByte));
+        unsigned int fourByteMask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(block, firstFourByteLead), block));
+        if (specialMask) {
+            unsigned int runLength = __builtin_ctz(specialMask);
+            unsigned int prefix = (1u << runLength) - 1;
+            *visibleCharacters += count + __builtin_popcount(visibleMask & prefix) + __builtin_popcount(fourByteMask & prefix);
+            return i + runLength;
+        }
+        count += __builtin_popcount(visibleMask) + __builtin_popcount(fourByteMask);
+    }
+
+    *visibleCharacters += count;
+    return i + scanTextRunScalar(text + i, length - i, visibleCharacters);
+}
+
+__attribute__((target("avx2")))
+static size_t scanTextRunAVX2(const char *text, size_t length, int *visibleCharacters) {
+    const __m256i lessThan = _mm256_set1_epi8('<');
+    const __m256i greaterThan = _mm256_set1_epi8('>');
+    const __m256i ampersand = _mm256_set1_epi8('&');
+    const __m256i newLine = _mm256_set1_epi8('\n');
+    const __m256i lastContinuationByte = _mm256_set1_epi8((char)0xBF);
+    const __m256i firstFourByteLead = _mm256_set1_epi8((char)0xF0);
+
+    int count = 0;
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(text + i));
+        __m256i special = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(block, lessThan), _mm256_cmpeq_epi8(block, greaterThan)),
+                                          _mm256_or_si256(_mm256_cmpeq_epi8(block, ampersand), _mm256_cmpeq_epi8(block, newLine)));
+        uint32_t specialMask = (uint32_t)_mm256_movemask_epi8(special);
+        uint32_t visibleMask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(block, lastContinuationByte));
+        uint32_t fourByteMask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(block, firstFourByteLead), block));
+        if (specialMask) {
+            unsigned int runLength = __builtin_ctz(specialMask);
+            uint32_t prefix = runLength == 0 ? 0 : (0xFFFFFFFFu >> (32 - runLength));
+            *visibleCharacters += count + __builtin_popcount(visibleMask & prefix) + __builtin_popcount(fourByteMask & prefix);
+            return i + runLength;
+        }
+        count += __builtin_popcount(visibleMask) + __builtin_popcount(fourByteMask);
+    }
+
+    *visibleCharacters += count;
+    //Finish off with the 16 byte version which will in turn finish with the scalar version
+    return i + scanTextRunSSE2(text + i, length - i, visibleCharacters);
+}
+
+static size_t scanToTagDelimiterSSE2(const char *text, size_t length) {
+    const __m128i lessThan = _mm_set1_epi8('<');
+    const __m128i greaterThan = _mm_set1_epi8('>');
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(text + i));
+        unsigned int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, lessThan), _mm_cmpeq_epi8(block, greaterThan)));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + scanToTagDelimiterScalar(text + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static size_t scanToTagDelimiterAVX2(const char *text, size_t length) {
+    const __m256i lessThan = _mm256_set1_epi8('<');
+    const __m256i greaterThan = _mm256_set1_epi8('>');
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(text + i));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(block, lessThan), _mm256_cmpeq_epi8(block, greaterThan)));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + scanToTagDelimiterSSE2(text + i, length - i);
+}
+
+#elif CPU_NEON
+
+//Narrow a 0x00/0xFF comparison result to a 64 bit mask with four bits per byte
+static inline uint64_t neonMovemask(uint8x16_t comparison) {
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(comparison), 4)), 0);
+}
+
+static size_t scanTextRunNEON(const char *text, size_t length, int *visibleCharacters) {
+    const uint8x16_t lessThan = vdupq_n_u8('<');
+    const uint8x16_t greaterThan = vdupq_n_u8('>');
+    const uint8x16_t ampersand = vdupq_n_u8('&');
+    const uint8x16_t newLine = vdupq_n_u8('\n');
+    const int8x16_t lastContinuationByte = vdupq_n_s8((int8_t)0xBF);
+    const uint8x16_t firstFourByteLead = vdupq_n_u8(0xF0);
+    const uint8x16_t one = vdupq_n_u8(1);
+
+    int count = 0;
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t block = vld1q_u8((const uint8_t *)(text + i));
+        uint8x16_t special = vorrq_u8(vorrq_u8(vceqq_u8(block, lessThan), vceqq_u8(block, greaterThan)),
+                                      vorrq_u8(vceqq_u8(block, ampersand), vceqq_u8(block, newLine)));
+        uint64_t specialMask = neonMovemask(special);
+        if (specialMask) {
+            size_t runLength = __builtin_ctzll(specialMask) >> 2;
+            *visibleCharacters += count + countVisibleCharactersScalar((const unsigned char *)(text + i), runLength);
+            return i + runLength;
+        }
+        uint8x16_t visible = vandq_u8(vcgtq_s8(vreinterpretq_s8_u8(block), lastContinuationByte), one);
+        uint8x16_t fourByte = vandq_u8(vcgeq_u8(block, firstFourByteLead), one);
+        count += vaddvq_u8(vaddq_u8(visible, fourByte));
+    }
+
+    *visibleCharacters += count;
+    return i + scanTextRunScalar(text + i, length - i, visibleCharacters);
+}
+
+static size_t scanToTagDelimiterNEON(const char *text, size_t length) {
+    const uint8x16_t lessThan = vdupq_n_u8('<');
+    const uint8x16_t greaterThan = vdupq_n_u8('>');
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t block = vld1q_u8((const uint8_t *)(text + i));
+        uint64_t mask = neonMovemask(vorrq_u8(vceqq_u8(block, lessThan), vceqq_u8(block, greaterThan)));
+        if (mask) {
+            return i + (__builtin_ctzll(mask) >> 2);
+        }
+    }
+    return i + scanToTagDelimiterScalar(text + i, length - i);
+}
+
+#endif
+
+/*
+ Runtime dispatch (see CPUFeatures.h). Each scanner picks the widest vectors the CPU has on first use
+ */
+#if CPU_X86
+#define SCAN_TEXT_RUN_BEST (cpuSupportsAVX2() ? scanTextRunAVX2 : scanTextRunSSE2)
+#define SCAN_TO_TAG_DELIMITER_BEST (cpuSupportsAVX2() ? scanToTagDelimiterAVX2 : scanToTagDelimiterSSE2)
+#elif CPU_NEON
+#define SCAN_TEXT_RUN_BEST scanTextRunNEON
+#define SCAN_TO_TAG_DELIMITER_BEST scanToTagDelimiterNEON
+#else
+#define SCAN_TEXT_RUN_BEST scanTextRunScalar
+#define SCAN_TO_TAG_DELIMITER_BEST scanToTagDelimiterScalar
+#endif
+
+RUNTIME_DISPATCH(scanTextRun, size_t, (const char *text, size_t length, int *visibleCharacters), (text, length, visibleCharacters), SCAN_TEXT_RUN_BEST)
+RUNTIME_DISPATCH(scanToTagDelimiter, size_t, (const char *text, size_t length), (text, length), SCAN_TO_TAG_DELIMITER_BEST)
+
+/**
+ Find the end of a run of plain text, i.e. the next byte which the tokenizer needs to look at individually ('<', '>', '&' or a new line)
+
+ @param text The text to scan
+ @param length The number of bytes available
+ @param visibleCharacters (in/out) Incremented by the number of visible characters in the run
+ @return The length of the run in bytes. Equal to length if no special byte was found
+ */
+size_t scanTextRun(const char *text, size_t length, int *visibleCharacters) {
+    return CALL_DISPATCHED(scanTextRun, (text, length, visibleCharacters));
+}
+
+/**
+ Find the next '<' or '>'. Used to skip over content which is swallowed by the tokenizer (i.e. tables)
+
+ @param text The text to scan
+ @param length The number of bytes available
+ @return The offset of the delimiter, or length if there isn't one
+ */
+size_t scanToTagDelimiter(const char *text, size_t length) {
+    return CALL_DISPATCHED(scanToTagDelimiter, (text, length));
+}
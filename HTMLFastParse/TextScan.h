@@ -0,0 +1,20 @@
+//
+//  TextScan.h
+//  HTMLFastParse
+//
+//  Copyright © 2026 CarbonDev. All rights reserved.
+//
+
+#ifndef TextScan_h
+#define TextScan_h
+
+#include <stdio.h>
+
+/**
+ Vectorized scanners for the tokenizer's hot loops. The best implementation for the CPU (AVX2, SSE2, NEON or plain C) is picked the first time each scanner is used.
+ */
+
+size_t scanTextRun(const char *text, size_t length, int *visibleCharacters);
+size_t scanToTagDelimiter(const char *text, size_t length);
+
+#endif /* TextScan_h */
@@ -0,0 +1,310 @@
+//
+//  UTF16.c
+//  HTMLFastParse
+//
+//  Copyright © 2026 CarbonDev. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "UTF16.h"
+#include "UTF8.h"
+#include "CPUFeatures.h"
+
+/*
+ The tokenizer counts positions in UTF-16 code units: one for every byte which is not a UTF-8 continuation byte (10xxxxxx), two for four byte leads since they become a surrogate pair.
+ The transcoder writes exactly that many code units for every byte, even for invalid UTF-8, so that the tags line up with the output. This must agree with getVisibleByteEffectForCharacter.
+ */
+#define IS_NOT_CONTINUATION_BYTE(c) (((c) & 0xC0) != 0x80)
+#define IS_FOUR_BYTE_LEAD(c) ((c) >= 0xF0)
+#define UTF16_LENGTH_OF_BYTE(c) (IS_NOT_CONTINUATION_BYTE(c) + IS_FOUR_BYTE_LEAD(c))
+
+#define REPLACEMENT_CHARACTER 0xFFFD
+
+/**
+ Widen ASCII bytes to code units one at a time
+
+ @return The number of bytes widened, which stops short of length at the first byte which isn't ASCII
+ */
+static size_t widenASCIIScalar(const unsigned char *text, size_t length, uint16_t *output) {
+    size_t i = 0;
+    while (i < length && text[i] < 0x80) {
+        output[i] = text[i];
+        i++;
+    }
+    return i;
+}
+
+#if CPU_X86
+
+static size_t widenASCIISSE2(const unsigned char *text, size_t length, uint16_t *output) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(text + i));
+        //Only bytes which aren't ASCII have their high bit set
+        unsigned int nonASCIIMask = _mm_movemask_epi8(block);
+        if (nonASCIIMask) {
+            return i + widenASCIIScalar(text + i, __builtin_ctz(nonASCIIMask), output + i);
+        }
+        _mm_storeu_si128((__m128i *)(output + i), _mm_unpacklo_epi8(block, zero));
+        _mm_storeu_si128((__m128i *)(output + i + 8), _mm_unpackhi_epi8(block, zero));
+    }
+    return i + widenASCIIScalar(text + i, length - i, output + i);
+}
+
+__attribute__((target("avx2")))
+static size_t widenASCIIAVX2(const unsigned char *text, size_t length, uint16_t *output) {
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(text + i));
+        uint32_t nonASCIIMask = (uint32_t)_mm256_movemask_epi8(block);
+        if (nonASCIIMask) {
+            return i + widenASCIIScalar(text + i, __builtin_ctz(nonASCIIMask), output + i);
+        }
+        _mm256_storeu_si256((__m256i *)(output + i), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(block)));
+        _mm256_storeu_si256((__m256i *)(output + i + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(block, 1)));
+    }
+    //Finish off with the 16 byte version which will in turn finish with the scalar version
+    return i + widenASCIISSE2(text + i, length - i, output + i);
+}
+
+#elif CPU_NEON
+
+static size_t widenASCIINEON(const unsigned char *text, size_t length, uint16_t *output) {
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t block = vld1q_u8(text + i);
+        if (vmaxvq_u8(block) >= 0x80) {
+            return i + widenASCIIScalar(text + i, 16, output + i);
+        }
+        vst1q_u16(output + i, vmovl_u8(vget_low_u8(block)));
+        vst1q_u16(output + i + 8, vmovl_high_u8(block));
+    }
+    return i + widenASCIIScalar(text + i, length - i, output + i);
+}
+
+#endif
+
+//Widen with AVX2 where the CPU has it (see CPUFeatures.h)
+#if CPU_X86
+#define WIDEN_ASCII_BEST (cpuSupportsAVX2() ? widenASCIIAVX2 : widenASCIISSE2)
+#elif CPU_NEON
+#define WIDEN_ASCII_BEST widenASCIINEON
+#else
+#define WIDEN_ASCII_BEST widenASCIIScalar
+#endif
+
+RUNTIME_DISPATCH(widenASCII, size_t, (const unsigned char *text, size_t length, uint16_t *output), (text, length, output), WIDEN_ASCII_BEST)
+
+/**
+ Decode the character which starts at a byte which isn't ASCII
+
+ @param text The character
+ @param length The number of bytes available
+ @param output Where to write the code units
+ @param outputLength (in/out) The number of code units written so far
+ @param isValid (returned) Set to false if the bytes aren't valid UTF-8
+ @return The number of bytes used
+ */
+static size_t decodeCharacter(const unsigned char *text, size_t length, uint16_t *output, size_t *outputLength, bool *isValid) {
+    unsigned char lead = text[0];
+    size_t sequenceLength;
+    uint32_t codePoint;
+    uint32_t minimumCodePoint;
+    if (lead < 0xC0) {
+        //A continuation byte without a lead. It has no code units of its own
+        *isValid = false;
+        return 1;
+    } else if (lead < 0xE0) {
+        sequenceLength = 2;
+        codePoint = lead & 0x1F;
+        minimumCodePoint = 0x80;
+    } else if (lead < 0xF0) {
+        sequenceLength = 3;
+        codePoint = lead & 0x0F;
+        minimumCodePoint = 0x800;
+    } else {
+        sequenceLength = lead <= 0xF4 ? 4 : 0;
+        codePoint = lead & 0x07;
+        minimumCodePoint = 0x10000;
+    }
+
+    bool isCharacterValid = sequenceLength > 0 && sequenceLength <= length;
+    for (size_t i = 1; isCharacterValid && i < sequenceLength; i++) {
+        isCharacterValid = (text[i] & 0xC0) == 0x80;
+        codePoint = (codePoint << 6) | (text[i] & 0x3F);
+    }
+    //Overlong encodings, surrogates and anything past the last code point aren't allowed either
+    isCharacterValid = isCharacterValid && codePoint >= minimumCodePoint && codePoint <= 0x10FFFF && (codePoint < 0xD800 || codePoint > 0xDFFF);
+
+    if (!isCharacterValid) {
+        //Only the lead is used up, whatever follows is decoded (or skipped) on its own
+        *isValid = false;
+        output[(*outputLength)++] = REPLACEMENT_CHARACTER;
+        if (IS_FOUR_BYTE_LEAD(lead)) {
+            output[(*outputLength)++] = REPLACEMENT_CHARACTER;
+        }
+        return 1;
+    }
+
+    if (codePoint >= 0x10000) {
+        codePoint -= 0x10000;
+        output[(*outputLength)++] = 0xD800 | (codePoint >> 10);
+        output[(*outputLength)++] = 0xDC00 | (codePoint & 0x3FF);
+    } else {
+        output[(*outputLength)++] = codePoint;
+    }
+    return sequenceLength;
+}
+
+/**
+ Convert display text to UTF-16 (what NSString, Java and ICU use) without going through another decoder. Runs of ASCII, which is most of the text, are widened with vector instructions.
+
+ The output always has exactly as many code units as the tokenizer counted visible characters, so the positions of the tags can be used on it as they are. Invalid UTF-8 is replaced with U+FFFD to keep that true.
+
+ @param text The display text
+ @param length The number of bytes of text
+ @param output Where to write the code units. numberOfHumanVisibleCharacters units are enough for all of the text. That is at most length for valid UTF-8, but a stray four byte lead counts twice so allow 2 * length when the text may not be valid
+ @param outputCapacity The number of code units output has room for. Writing stops once it is full, without splitting a character
+ @param index (returned) A map between byte and UTF-16 offsets in the text. Release it with freeUTF16Index. Pass NULL if you don't need it
+ @param isValid (returned) Whether the whole text was valid UTF-8, including any which didn't fit in the output. May be NULL
+ @return The number of code units written
+ */
+size_t transcodeToUTF16(const char *text, size_t length, uint16_t *output, size_t outputCapacity, struct t_utf16_index *index, bool *isValid) {
+    const unsigned char *bytes = (const unsigned char *)text;
+    bool isTextValid = true;
+    size_t outputLength = 0;
+
+    //Without an index the next checkpoint is never reached
+    size_t nextCheckpoint = SIZE_MAX;
+    if (index) {
+        index->numberOfCheckpoints = 0;
+        index->checkpoints = malloc((length / UTF16_INDEX_INTERVAL + 1) * sizeof(struct t_utf16_checkpoint));
+        if (index->checkpoints) {
+            nextCheckpoint = 0;
+        }
+    }
+
+    widenASCIIFunction widenASCII = atomic_load_explicit(&widenASCIIImplementation, memory_order_relaxed);
+    size_t i = 0;
+    while (i < length && outputLength < outputCapacity) {
+        if (i >= nextCheckpoint) {
+            index->checkpoints[index->numberOfCheckpoints++] = (struct t_utf16_checkpoint){(uint32_t)i, (uint32_t)outputLength};
+            nextCheckpoint = (i / UTF16_INDEX_INTERVAL + 1) * UTF16_INDEX_INTERVAL;
+        }
+
+        //Widening stops at the next checkpoint so that it lands on the first character after it, and where the output is full
+        size_t widenLength = (nextCheckpoint < length ? nextCheckpoint : length) - i;
+        if (widenLength > outputCapacity - outputLength) {
+            widenLength = outputCapacity - outputLength;
+        }
+        size_t asciiLength = widenASCII(bytes + i, widenLength, output + outputLength);
+        i += asciiLength;
+        outputLength += asciiLength;
+        if (i < length && bytes[i] >= 0x80) {
+            if (outputCapacity - outputLength >= 2) {
+                i += decodeCharacter(bytes + i, length - i, output, &outputLength, &isTextValid);
+            } else {
+                //There may not be room for a surrogate pair, so only copy the character over if it fits
+                uint16_t units[2];
+                size_t numberOfUnits = 0;
+                size_t characterLength = decodeCharacter(bytes + i, length - i, units, &numberOfUnits, &isTextValid);
+                if (numberOfUnits > outputCapacity - outputLength) {
+                    break;
+                }
+                memcpy(output + outputLength, units, numberOfUnits * sizeof(uint16_t));
+                outputLength += numberOfUnits;
+                i += characterLength;
+            }
+        }
+    }
+
+    if (isValid) {
+        //The output filled up before the end of the text, so check what wasn't decoded too. Writing always stops between two characters
+        if (isTextValid && i < length) {
+            isTextValid = validateUTF8(text + i, length - i) == length - i;
+        }
+        *isValid = isTextValid;
+    }
+    return outputLength;
+}
+
+/**
+ Release the index from transcodeToUTF16
+
+ @param index The index
+ */
+void freeUTF16Index(struct t_utf16_index *index) {
+    free(index->checkpoints);
+    index->checkpoints = NULL;
+    index->numberOfCheckpoints = 0;
+}
+
+/**
+ Convert a byte offset in the display text to a UTF-16 offset
+
+ @param index The index from transcodeToUTF16
+ @param text The display text
+ @param byteOffset The offset of the first byte of a character (or the end of the text)
+ @return The UTF-16 offset of the character
+ */
+size_t utf16OffsetForByteOffset(const struct t_utf16_index *index, const char *text, size_t byteOffset) {
+    //Binary search for the last checkpoint at or before the offset. Offset 0 is always a checkpoint, even when there are none
+    struct t_utf16_checkpoint checkpoint = {0, 0};
+    int low = 0;
+    int high = index->numberOfCheckpoints;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (index->checkpoints[middle].byteOffset <= byteOffset) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low > 0) {
+        checkpoint = index->checkpoints[low - 1];
+    }
+
+    size_t utf16Offset = checkpoint.utf16Offset;
+    for (size_t i = checkpoint.byteOffset; i < byteOffset; i++) {
+        utf16Offset += UTF16_LENGTH_OF_BYTE((unsigned char)text[i]);
+    }
+    return utf16Offset;
+}
+
+/**
+ Convert a UTF-16 offset (an NSRange location, for example) to a byte offset in the display text
+
+ @param index The index from transcodeToUTF16
+ @param text The display text
+ @param length The number of bytes of text
+ @param utf16Offset The UTF-16 offset
+ @return The offset of the first byte of the character at utf16Offset. If that is the second half of a surrogate pair, the start of the pair. length if utf16Offset is past the end
+ */
+size_t byteOffsetForUTF16Offset(const struct t_utf16_index *index, const char *text, size_t length, size_t utf16Offset) {
+    struct t_utf16_checkpoint checkpoint = {0, 0};
+    int low = 0;
+    int high = index->numberOfCheckpoints;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (index->checkpoints[middle].utf16Offset <= utf16Offset) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low > 0) {
+        checkpoint = index->checkpoints[low - 1];
+    }
+
+    size_t currentUTF16Offset = checkpoint.utf16Offset;
+    for (size_t i = checkpoint.byteOffset; i < length; i++) {
+        size_t characterLength = UTF16_LENGTH_OF_BYTE((unsigned char)text[i]);
+        if (characterLength > 0 && currentUTF16Offset + characterLength > utf16Offset) {
+            return i;
+        }
+        currentUTF16Offset += characterLength;
+    }
+    return length;
+}
@@ -0,0 +1,40 @@
+//
+//  UTF16.h
+//  HTMLFastParse
+//
+//  Copyright © 2026 CarbonDev. All rights reserved.
+//
+
+#ifndef UTF16_h
+#define UTF16_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+//How far apart (in bytes of display text) the checkpoints of a t_utf16_index are
+#define UTF16_INDEX_INTERVAL 256
+
+/**
+ A byte offset in the display text and the UTF-16 offset of the same character
+ */
+struct t_utf16_checkpoint {
+    uint32_t byteOffset;
+    uint32_t utf16Offset;
+};
+
+/**
+ A sparse map between byte offsets in the display text and UTF-16 offsets. There is a checkpoint at the first character at or after every UTF16_INDEX_INTERVAL bytes, lookups walk the rest of the way from the nearest one
+ */
+struct t_utf16_index {
+    struct t_utf16_checkpoint *checkpoints;
+    int numberOfCheckpoints;
+};
+
+size_t transcodeToUTF16(const char *text, size_t length, uint16_t *output, size_t outputCapacity, struct t_utf16_index *index, bool *isValid);
+void freeUTF16Index(struct t_utf16_index *index);
+
+size_t utf16OffsetForByteOffset(const struct t_utf16_index *index, const char *text, size_t byteOffset);
+size_t byteOffsetForUTF16Offset(const struct t_utf16_index *index, const char *text, size_t length, size_t utf16Offset);
+
+#endif /* UTF16_h */
@@ -0,0 +1,339 @@
+//
+//  UTF8.c
+//  HTMLFastParse
+//
+//  Copyright © 2026 CarbonDev. All rights reserved.
+//
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "UTF8.h"
+#include "CPUFeatures.h"
+
+#define IS_NOT_CONTINUATION_BYTE(c) (((c) & 0xC0) != 0x80)
+
+//U+FFFD, which replaces every bad sequence
+static const char REPLACEMENT_CHARACTER[] = "\xEF\xBF\xBD";
+#define REPLACEMENT_CHARACTER_LENGTH 3
+
+/**
+ Check the character which starts at a byte which isn't ASCII. The ranges are those of the well formed byte sequences table in the Unicode standard, which rules out overlong encodings, surrogates and anything past U+10FFFF without decoding the code point
+
+ @param text The character
+ @param length The number of bytes available
+ @param isValid (returned) Whether the character is valid
+ @return The length of the character if it is valid. Otherwise the length of the bad sequence (its lead and as many of the bytes after it as could still have been part of a valid character) which should become a single U+FFFD
+ */
+static size_t checkCharacter(const unsigned char *text, size_t length, bool *isValid) {
+    unsigned char lead = text[0];
+    size_t sequenceLength;
+    //The second byte has a narrower range for some leads, every byte after it is any continuation byte
+    unsigned char secondMinimum = 0x80;
+    unsigned char secondMaximum = 0xBF;
+    if (lead >= 0xC2 && lead <= 0xDF) {
+        sequenceLength = 2;
+    } else if (lead >= 0xE0 && lead <= 0xEF) {
+        sequenceLength = 3;
+        if (lead == 0xE0) {
+            secondMinimum = 0xA0;
+        } else if (lead == 0xED) {
+            secondMaximum = 0x9F;
+        }
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+        sequenceLength = 4;
+        if (lead == 0xF0) {
+            secondMinimum = 0x90;
+        } else if (lead == 0xF4) {
+            secondMaximum = 0x8F;
+        }
+    } else {
+        //A continuation byte without a lead, an overlong two byte lead (C0, C1) or a lead past F4
+        *isValid = false;
+        return 1;
+    }
+
+    size_t i = 1;
+    while (i < sequenceLength && i < length) {
+        unsigned char minimum = i == 1 ? secondMinimum : 0x80;
+        unsigned char maximum = i == 1 ? secondMaximum : 0xBF;
+        if (text[i] < minimum || text[i] > maximum) {
+            break;
+        }
+        i++;
+    }
+    *isValid = i == sequenceLength;
+    return i;
+}
+
+#if CPU_X86 || CPU_NEON
+
+/*
+ The vector validators check every byte against the one or two before it with three table lookups (the approach from "Validating UTF-8 In Less Than One Instruction Per Byte", Keiser and Lemire). Each bit is one kind of error, a byte is bad if any bit survives in all three lookups
+ */
+#define TOO_SHORT (1 << 0)
+#define TOO_LONG (1 << 1)
+#define OVERLONG_3 (1 << 2)
+#define TOO_LARGE (1 << 3)
+#define SURROGATE (1 << 4)
+#define OVERLONG_2 (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4 (1 << 6)
+#define TWO_CONTINUATIONS (1 << 7)
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTINUATIONS)
+
+//Looked up by the high nibble of the previous byte
+static const uint8_t BYTE_1_HIGH[16] = {
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+    TWO_CONTINUATIONS, TWO_CONTINUATIONS, TWO_CONTINUATIONS, TWO_CONTINUATIONS,
+    TOO_SHORT | OVERLONG_2,
+    TOO_SHORT,
+    TOO_SHORT | OVERLONG_3 | SURROGATE,
+    TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+};
+
+//Looked up by the low nibble of the previous byte
+static const uint8_t BYTE_1_LOW[16] = {
+    CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+    CARRY | OVERLONG_2,
+    CARRY,
+    CARRY,
+    CARRY | TOO_LARGE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000
+};
+
+//Looked up by the high nibble of the byte itself
+static const uint8_t BYTE_2_HIGH[16] = {
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    TOO_LONG | OVERLONG_2 | TWO_CONTINUATIONS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+    TOO_LONG | OVERLONG_2 | TWO_CONTINUATIONS | OVERLONG_3 | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTINUATIONS | SURROGATE | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTINUATIONS | SURROGATE | TOO_LARGE,
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+};
+
+//A block whose last bytes are above these ends part way through a character
+static const uint8_t INCOMPLETE_LIMITS[32] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1
+};
+
+/**
+ Where to carry on one character at a time after the vector loop stopped at offset. Everything before it is valid except perhaps the character which runs across it, so back up to that character's lead
+ */
+static size_t resumeOffset(const unsigned char *text, size_t offset) {
+    for (size_t back = 1; back <= 3 && back <= offset; back++) {
+        if (IS_NOT_CONTINUATION_BYTE(text[offset - back])) {
+            return text[offset - back] >= 0xC0 ? offset - back : offset;
+        }
+    }
+    return offset;
+}
+
+#endif
+
+/**
+ Find the first bad character one character at a time
+ */
+static size_t validateUTF8Scalar(const unsigned char *text, size_t length) {
+    size_t i = 0;
+    while (i < length) {
+        if (text[i] < 0x80) {
+            i++;
+            continue;
+        }
+        bool isValid;
+        size_t characterLength = checkCharacter(&text[i], length - i, &isValid);
+        if (!isValid) {
+            return i;
+        }
+        i += characterLength;
+    }
+    return length;
+}
+
+#if CPU_X86
+
+/**
+ SSE2 has no byte shuffle for the table lookups, so this only skips ASCII 16 bytes at a time and checks everything else one character at a time
+ */
+static size_t validateUTF8SSE2(const unsigned char *text, size_t length) {
+    size_t i = 0;
+    while (i + 16 <= length) {
+        //Only bytes which aren't ASCII have their high bit set
+        unsigned int nonASCIIMask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(text + i)));
+        if (!nonASCIIMask) {
+            i += 16;
+            continue;
+        }
+        i += __builtin_ctz(nonASCIIMask);
+        bool isValid;
+        size_t characterLength = checkCharacter(&text[i], length - i, &isValid);
+        if (!isValid) {
+            return i;
+        }
+        i += characterLength;
+    }
+    return i + validateUTF8Scalar(text + i, length - i);
+}
+
+//The block shifted along by n bytes, with the end of the previous block shifted in
+#define PREVIOUS_BYTES_AVX2(input, previous, n) _mm256_alignr_epi8(input, _mm256_permute2x128_si256(previous, input, 0x21), 16 - (n))
+
+__attribute__((target("avx2")))
+static size_t validateUTF8AVX2(const unsigned char *text, size_t length) {
+    const __m256i byte1HighTable = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)BYTE_1_HIGH));
+    const __m256i byte1LowTable = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)BYTE_1_LOW));
+    const __m256i byte2HighTable = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)BYTE_2_HIGH));
+    const __m256i incompleteLimits = _mm256_loadu_si256((const __m256i *)INCOMPLETE_LIMITS);
+    const __m256i lowNibble = _mm256_set1_epi8(0x0F);
+    const __m256i zero = _mm256_setzero_si256();
+
+    __m256i previous = zero;
+    __m256i previousIncomplete = zero;
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i input = _mm256_loadu_si256((const __m256i *)(text + i));
+        __m256i error;
+        if (!_mm256_movemask_epi8(input)) {
+            //All ASCII, which is only wrong if the last block left a character unfinished
+            error = previousIncomplete;
+            previousIncomplete = zero;
+        } else {
+            __m256i previous1 = PREVIOUS_BYTES_AVX2(input, previous, 1);
+            __m256i byte1High = _mm256_shuffle_epi8(byte1HighTable, _mm256_and_si256(_mm256_srli_epi16(previous1, 4), lowNibble));
+            __m256i byte1Low = _mm256_shuffle_epi8(byte1LowTable, _mm256_and_si256(previous1, lowNibble));
+            __m256i byte2High = _mm256_shuffle_epi8(byte2HighTable, _mm256_and_si256(_mm256_srli_epi16(input, 4), lowNibble));
+            __m256i specialCases = _mm256_and_si256(_mm256_and_si256(byte1High, byte1Low), byte2High);
+            //The third and fourth bytes of long characters must be continuation bytes, and nothing else may be
+            __m256i isThirdByte = _mm256_subs_epu8(PREVIOUS_BYTES_AVX2(input, previous, 2), _mm256_set1_epi8(0xE0 - 0x80));
+            __m256i isFourthByte = _mm256_subs_epu8(PREVIOUS_BYTES_AVX2(input, previous, 3), _mm256_set1_epi8(0xF0 - 0x80));
+            __m256i mustBeContinuation = _mm256_and_si256(_mm256_or_si256(isThirdByte, isFourthByte), _mm256_set1_epi8((char)0x80));
+            error = _mm256_xor_si256(mustBeContinuation, specialCases);
+            previousIncomplete = _mm256_subs_epu8(input, incompleteLimits);
+        }
+        if (!_mm256_testz_si256(error, error)) {
+            break;
+        }
+        previous = input;
+    }
+    //Finish off, or find exactly where the error is, with the SSE2 version
+    size_t resume = resumeOffset(text, i);
+    return resume + validateUTF8SSE2(text + resume, length - resume);
+}
+
+#elif CPU_NEON
+
+static size_t validateUTF8NEON(const unsigned char *text, size_t length) {
+    const uint8x16_t byte1HighTable = vld1q_u8(BYTE_1_HIGH);
+    const uint8x16_t byte1LowTable = vld1q_u8(BYTE_1_LOW);
+    const uint8x16_t byte2HighTable = vld1q_u8(BYTE_2_HIGH);
+    const uint8x16_t incompleteLimits = vld1q_u8(INCOMPLETE_LIMITS + 16);
+    const uint8x16_t lowNibble = vdupq_n_u8(0x0F);
+    const uint8x16_t zero = vdupq_n_u8(0);
+
+    uint8x16_t previous = zero;
+    uint8x16_t previousIncomplete = zero;
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t input = vld1q_u8(text + i);
+        uint8x16_t error;
+        if (vmaxvq_u8(input) < 0x80) {
+            error = previousIncomplete;
+            previousIncomplete = zero;
+        } else {
+            uint8x16_t previous1 = vextq_u8(previous, input, 15);
+            uint8x16_t byte1High = vqtbl1q_u8(byte1HighTable, vshrq_n_u8(previous1, 4));
+            uint8x16_t byte1Low = vqtbl1q_u8(byte1LowTable, vandq_u8(previous1, lowNibble));
+            uint8x16_t byte2High = vqtbl1q_u8(byte2HighTable, vshrq_n_u8(input, 4));
+            uint8x16_t specialCases = vandq_u8(vandq_u8(byte1High, byte1Low), byte2High);
+            uint8x16_t isThirdByte = vqsubq_u8(vextq_u8(previous, input, 14), vdupq_n_u8(0xE0 - 0x80));
+            uint8x16_t isFourthByte = vqsubq_u8(vextq_u8(previous, input, 13), vdupq_n_u8(0xF0 - 0x80));
+            uint8x16_t mustBeContinuation = vandq_u8(vorrq_u8(isThirdByte, isFourthByte), vdupq_n_u8(0x80));
+            error = veorq_u8(mustBeContinuation, specialCases);
+            previousIncomplete = vqsubq_u8(input, incompleteLimits);
+        }
+        if (vmaxvq_u8(error)) {
+            break;
+        }
+        previous = input;
+    }
+    size_t resume = resumeOffset(text, i);
+    return resume + validateUTF8Scalar(text + resume, length - resume);
+}
+
+#endif
+
+//Validate with AVX2 where the CPU has it (see CPUFeatures.h)
+#if CPU_X86
+#define VALIDATE_UTF8_BEST (cpuSupportsAVX2() ? validateUTF8AVX2 : validateUTF8SSE2)
+#elif CPU_NEON
+#define VALIDATE_UTF8_BEST validateUTF8NEON
+#else
+#define VALIDATE_UTF8_BEST validateUTF8Scalar
+#endif
+
+RUNTIME_DISPATCH(validateUTF8, size_t, (const unsigned char *text, size_t length), (text, length), VALIDATE_UTF8_BEST)
+
+/**
+ Find the first byte of input which isn't valid UTF-8. Every byte is checked with vector instructions where the CPU has a byte shuffle (AVX2 and NEON), otherwise ASCII is skipped 16 bytes at a time and only the other characters are checked one at a time
+
+ @param text The input
+ @param length The number of bytes of input
+ @return The number of bytes at the start of text which are valid UTF-8. This is length if all of it is
+ */
+size_t validateUTF8(const char *text, size_t length) {
+    return CALL_DISPATCHED(validateUTF8, ((const unsigned char *)text, length));
+}
+
+/**
+ Replace bad UTF-8 with U+FFFD, one for each bad sequence in the same way as NSString's lossy decoding and browsers. Run this on input which may not be valid before tokenizeHTML so that the display text is valid and its visible length is what NSString will count
+
+ @param text The input
+ @param length The number of bytes of input
+ @param repairedLength (returned) The number of bytes of the repaired copy, excluding the null byte. length if text is already valid
+ @param arena The arena which owns the repaired copy. Pass NULL to use malloc, in which case free it when done
+ @return A null terminated repaired copy of text, or NULL if text is already valid (or there is no memory for the copy) and can be used as it is
+ */
+char * repairUTF8(const char *text, size_t length, size_t *repairedLength, struct Arena *arena) {
+    *repairedLength = length;
+    size_t validLength = validateUTF8(text, length);
+    if (validLength == length) {
+        return NULL;
+    }
+
+    //Each bad byte can grow to a three byte replacement
+    char *repaired = arenaAlloc(arena, validLength + (length - validLength) * REPLACEMENT_CHARACTER_LENGTH + 1);
+    if (!repaired) {
+        return NULL;
+    }
+    memcpy(repaired, text, validLength);
+
+    //Copy everything up to the next bad sequence in one go, then replace it
+    size_t i = validLength;
+    size_t repairedPosition = validLength;
+    while (i < length) {
+        bool isValid;
+        i += checkCharacter((const unsigned char *)&text[i], length - i, &isValid);
+        memcpy(&repaired[repairedPosition], REPLACEMENT_CHARACTER, REPLACEMENT_CHARACTER_LENGTH);
+        repairedPosition += REPLACEMENT_CHARACTER_LENGTH;
+
+        validLength = validateUTF8(&text[i], length - i);
+        memcpy(&repaired[repairedPosition], &text[i], validLength);
+        i += validLength;
+        repairedPosition += validLength;
+    }
+    repaired[repairedPosition] = 0;
+    *repairedLength = repairedPosition;
+    return repaired;
+}
@@ -0,0 +1,21 @@
+//
+//  UTF8.h
+//  HTMLFastParse
+//
+//  Copyright © 2026 CarbonDev. All rights reserved.
+//
+
+#ifndef UTF8_h
+#define UTF8_h
+
+#include <stdio.h>
+#include "Arena.h"
+
+/**
+ Checking and fixing UTF-8 before it is tokenized. The tokenizer counts visible characters byte by byte and trusts that the input is valid, so bad input gives display text which NSString won't accept (or counts differently). Repairing it first means the counts are right by construction.
+ */
+
+size_t validateUTF8(const char *text, size_t length);
+char * repairUTF8(const char *text, size_t length, size_t *repairedLength, struct Arena *arena);
+
+#endif /* UTF8_h */
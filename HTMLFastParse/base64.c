@@ -83,8 +83,11 @@
  */
 
 #include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
 
 #include "base64.h"
+#include "CPUFeatures.h"
 
 static const char basis_64[] =
     "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
@@ -94,13 +97,13 @@ size_t Base64encode_len(size_t len)
     return ((len + 2) / 3 * 4) + 1;
 }
 
-size_t Base64encode(char *encoded, const char *string, size_t len)
+static size_t Base64encodeScalar(char *encoded, const char *string, size_t len)
 {
     size_t i;
     char *p;
 
     p = encoded;
-    for (i = 0; i < len - 2; i += 3) {
+    for (i = 0; i + 2 < len; i += 3) {
     *p++ = basis_64[(string[i] >> 2) & 0x3F];
     *p++ = basis_64[((string[i] & 0x3) << 4) |
                     ((int) (string[i + 1] & 0xF0) >> 4)];
@@ -125,3 +128,202 @@ size_t Base64encode(char *encoded, const char *string, size_t len)
     *p++ = '\0';
     return p - encoded;
 }
+
+/*
+ Vectorized encoders. Each one encodes as many whole blocks as it can without reading past the input and hands the rest (and the padding) to the scalar encoder, so the output is identical.
+ */
+#if CPU_X86
+
+/**
+ Turn sixteen 6 bit values into their base64 characters without a 64 entry lookup. Every value in a range shares an offset from its character ('A'-'Z', 'a'-'z', '0'-'9', '+' and '/') so the values are reduced to a range number which picks the offset out of a 16 byte table
+ */
+__attribute__((target("ssse3")))
+static inline __m128i base64CharactersSSSE3(__m128i indices) {
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    //0-51 become 0, 52-61 become 1-10, 62 becomes 11 and 63 becomes 12
+    __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    //Then 0-25 become 13 so they can be told apart from 26-51
+    __m128i isUpperCase = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    range = _mm_or_si128(range, _mm_and_si128(isUpperCase, _mm_set1_epi8(13)));
+    return _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, range));
+}
+
+/**
+ Split the 12 bytes at the start of each 16 byte lane into sixteen 6 bit values, one per byte
+ */
+__attribute__((target("ssse3")))
+static inline __m128i base64IndicesSSSE3(__m128i input) {
+    //Put each group of three bytes into its own 32 bit word, in the order the shifts below expect
+    input = _mm_shuffle_epi8(input, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    //Move the first and third 6 bit values into place with a high multiply and the second and fourth with a low one
+    __m128i firstAndThird = _mm_mulhi_epu16(_mm_and_si128(input, _mm_set1_epi32(0x0FC0FC00)), _mm_set1_epi32(0x04000040));
+    __m128i secondAndFourth = _mm_mullo_epi16(_mm_and_si128(input, _mm_set1_epi32(0x003F03F0)), _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(firstAndThird, secondAndFourth);
+}
+
+__attribute__((target("ssse3")))
+static size_t Base64encodeSSSE3(char *encoded, const char *string, size_t len)
+{
+    size_t i = 0;
+    char *p = encoded;
+    //Each block reads 16 bytes but only encodes the first 12
+    for (; i + 16 <= len; i += 12, p += 16) {
+        __m128i input = _mm_loadu_si128((const __m128i *)(string + i));
+        _mm_storeu_si128((__m128i *)p, base64CharactersSSSE3(base64IndicesSSSE3(input)));
+    }
+    return (p - encoded) + Base64encodeScalar(p, string + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t Base64encodeAVX2(char *encoded, const char *string, size_t len)
+{
+    const __m256i shuffle = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                            10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m256i offsets = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+                                             'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    size_t i = 0;
+    char *p = encoded;
+    //Shuffles can't cross the two 16 byte lanes, so each lane gets its own 12 bytes (and reads 16)
+    for (; i + 28 <= len; i += 24, p += 32) {
+        __m256i input = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(string + i))),
+                                                _mm_loadu_si128((const __m128i *)(string + i + 12)), 1);
+        input = _mm256_shuffle_epi8(input, shuffle);
+        __m256i firstAndThird = _mm256_mulhi_epu16(_mm256_and_si256(input, _mm256_set1_epi32(0x0FC0FC00)), _mm256_set1_epi32(0x04000040));
+        __m256i secondAndFourth = _mm256_mullo_epi16(_mm256_and_si256(input, _mm256_set1_epi32(0x003F03F0)), _mm256_set1_epi32(0x01000010));
+        __m256i indices = _mm256_or_si256(firstAndThird, secondAndFourth);
+        
+        __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        __m256i isUpperCase = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+        range = _mm256_or_si256(range, _mm256_and_si256(isUpperCase, _mm256_set1_epi8(13)));
+        _mm256_storeu_si256((__m256i *)p, _mm256_add_epi8(indices, _mm256_shuffle_epi8(offsets, range)));
+    }
+    //Finish off with the 16 byte version which will in turn finish with the scalar version
+    return (p - encoded) + Base64encodeSSSE3(p, string + i, len - i);
+}
+
+#elif CPU_NEON
+
+static size_t Base64encodeNEON(char *encoded, const char *string, size_t len)
+{
+    //The whole alphabet fits in a four register table lookup
+    uint8x16x4_t alphabet;
+    alphabet.val[0] = vld1q_u8((const uint8_t *)basis_64);
+    alphabet.val[1] = vld1q_u8((const uint8_t *)basis_64 + 16);
+    alphabet.val[2] = vld1q_u8((const uint8_t *)basis_64 + 32);
+    alphabet.val[3] = vld1q_u8((const uint8_t *)basis_64 + 48);
+    const uint8x16_t lowSixBits = vdupq_n_u8(0x3F);
+    
+    size_t i = 0;
+    char *p = encoded;
+    for (; i + 48 <= len; i += 48, p += 64) {
+        //De-interleaving load, so val[n] holds byte n of each of the 16 groups
+        uint8x16x3_t input = vld3q_u8((const uint8_t *)(string + i));
+        uint8x16x4_t output;
+        output.val[0] = vshrq_n_u8(input.val[0], 2);
+        output.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(input.val[0], 4), vshrq_n_u8(input.val[1], 4)), lowSixBits);
+        output.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(input.val[1], 2), vshrq_n_u8(input.val[2], 6)), lowSixBits);
+        output.val[3] = vandq_u8(input.val[2], lowSixBits);
+        for (int k = 0; k < 4; k++) {
+            output.val[k] = vqtbl4q_u8(alphabet, output.val[k]);
+        }
+        //And an interleaving store puts the four characters of each group back together
+        vst4q_u8((uint8_t *)p, output);
+    }
+    return (p - encoded) + Base64encodeScalar(p, string + i, len - i);
+}
+
+#endif
+
+//The SSSE3 encoder needs a byte shuffle, which not every x86 CPU has (see CPUFeatures.h)
+#if CPU_X86
+#define BASE64_ENCODE_BEST (cpuSupportsAVX2() ? Base64encodeAVX2 : cpuSupportsSSSE3() ? Base64encodeSSSE3 : Base64encodeScalar)
+#elif CPU_NEON
+#define BASE64_ENCODE_BEST Base64encodeNEON
+#else
+#define BASE64_ENCODE_BEST Base64encodeScalar
+#endif
+
+RUNTIME_DISPATCH(Base64encode, size_t, (char *encoded, const char *string, size_t len), (encoded, string, len), BASE64_ENCODE_BEST)
+
+/**
+ Base64 encode a buffer, using the fastest encoder the CPU supports
+
+ @param encoded The output. Must have room for Base64encode_len(len) bytes
+ @param string The bytes to encode
+ @param len The number of bytes to encode
+ @return The number of bytes written, including the null byte
+ */
+size_t Base64encode(char *encoded, const char *string, size_t len)
+{
+    return CALL_DISPATCHED(Base64encode, (encoded, string, len));
+}
+
+/* aaaack but it's fast and const should make it shared text page. */
+static const unsigned char pr2six[256] =
+{
+    /* ASCII table */
+    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 62, 64, 64, 64, 63,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 64, 64, 64, 64, 64, 64,
+    64,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 64, 64, 64, 64, 64,
+    64, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 64, 64, 64, 64, 64,
+    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64
+};
+
+/**
+ The size of the buffer Base64decode needs
+
+ @param len The number of base64 characters
+ @return The buffer size, including room for a null byte
+ */
+size_t Base64decode_len(size_t len)
+{
+    return ((len + 3) / 4) * 3 + 1;
+}
+
+/**
+ Decode base64. Decoding stops at the first byte which isn't part of the alphabet, which is normally the '=' padding
+
+ @param decoded The output. Must have room for Base64decode_len(len) bytes and is null terminated
+ @param encoded The base64 characters
+ @param len The number of characters
+ @return The number of bytes decoded, not including the null byte
+ */
+size_t Base64decode(char *decoded, const char *encoded, size_t len)
+{
+    const unsigned char *bufin = (const unsigned char *)encoded;
+    size_t nprbytes = 0;
+    while (nprbytes < len && pr2six[bufin[nprbytes]] <= 63) {
+        nprbytes++;
+    }
+
+    unsigned char *bufout = (unsigned char *)decoded;
+    size_t i = 0;
+    for (; i + 4 <= nprbytes; i += 4) {
+        *bufout++ = (unsigned char) (pr2six[bufin[i]] << 2 | pr2six[bufin[i + 1]] >> 4);
+        *bufout++ = (unsigned char) (pr2six[bufin[i + 1]] << 4 | pr2six[bufin[i + 2]] >> 2);
+        *bufout++ = (unsigned char) (pr2six[bufin[i + 2]] << 6 | pr2six[bufin[i + 3]]);
+    }
+    //A trailing group of two or three characters holds one or two bytes
+    if (nprbytes - i > 1) {
+        *bufout++ = (unsigned char) (pr2six[bufin[i]] << 2 | pr2six[bufin[i + 1]] >> 4);
+    }
+    if (nprbytes - i > 2) {
+        *bufout++ = (unsigned char) (pr2six[bufin[i + 1]] << 4 | pr2six[bufin[i + 2]] >> 2);
+    }
+    *bufout = '\0';
+    return bufout - (unsigned char *)decoded;
+}
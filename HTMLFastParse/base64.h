@@ -12,4 +12,6 @@
 #include <stdio.h>
 size_t Base64encode_len(size_t len);
 size_t Base64encode(char *encoded, const char *string, size_t len);
+size_t Base64decode_len(size_t len);
+size_t Base64decode(char *decoded, const char *encoded, size_t len);
 #endif /* base64_h */
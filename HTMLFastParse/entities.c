@@ -5,283 +5,332 @@
 */
 
 #include "entities.h"
+#include "entities_hash.h"
 
-#include <errno.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 #define UNICODE_MAX 0x10FFFFul
 
-static const char *const NAMED_ENTITIES[][2] = {
-	{ "AElig;", "Æ" },
-	{ "Aacute;", "Á" },
-	{ "Acirc;", "Â" },
-	{ "Agrave;", "À" },
-	{ "Alpha;", "Α" },
-	{ "Aring;", "Å" },
-	{ "Atilde;", "Ã" },
-	{ "Auml;", "Ä" },
-	{ "Beta;", "Β" },
-	{ "Ccedil;", "Ç" },
-	{ "Chi;", "Χ" },
-	{ "Dagger;", "‡" },
-	{ "Delta;", "Δ" },
-	{ "ETH;", "Ð" },
-	{ "Eacute;", "É" },
-	{ "Ecirc;", "Ê" },
-	{ "Egrave;", "È" },
-	{ "Epsilon;", "Ε" },
-	{ "Eta;", "Η" },
-	{ "Euml;", "Ë" },
-	{ "Gamma;", "Γ" },
-	{ "Iacute;", "Í" },
-	{ "Icirc;", "Î" },
-	{ "Igrave;", "Ì" },
-	{ "Iota;", "Ι" },
-	{ "Iuml;", "Ï" },
-	{ "Kappa;", "Κ" },
-	{ "Lambda;", "Λ" },
-	{ "Mu;", "Μ" },
-	{ "Ntilde;", "Ñ" },
-	{ "Nu;", "Ν" },
-	{ "OElig;", "Œ" },
-	{ "Oacute;", "Ó" },
-	{ "Ocirc;", "Ô" },
-	{ "Ograve;", "Ò" },
-	{ "Omega;", "Ω" },
-	{ "Omicron;", "Ο" },
-	{ "Oslash;", "Ø" },
-	{ "Otilde;", "Õ" },
-	{ "Ouml;", "Ö" },
-	{ "Phi;", "Φ" },
-	{ "Pi;", "Π" },
-	{ "Prime;", "″" },
-	{ "Psi;", "Ψ" },
-	{ "Rho;", "Ρ" },
-	{ "Scaron;", "Š" },
-	{ "Sigma;", "Σ" },
-	{ "THORN;", "Þ" },
-	{ "Tau;", "Τ" },
-	{ "Theta;", "Θ" },
-	{ "Uacute;", "Ú" },
-	{ "Ucirc;", "Û" },
-	{ "Ugrave;", "Ù" },
-	{ "Upsilon;", "Υ" },
-	{ "Uuml;", "Ü" },
-	{ "Xi;", "Ξ" },
-	{ "Yacute;", "Ý" },
-	{ "Yuml;", "Ÿ" },
-	{ "Zeta;", "Ζ" },
-	{ "aacute;", "á" },
-	{ "acirc;", "â" },
-	{ "acute;", "´" },
-	{ "aelig;", "æ" },
-	{ "agrave;", "à" },
-	{ "alefsym;", "ℵ" },
-	{ "alpha;", "α" },
-	{ "amp;", "&" },
-	{ "and;", "∧" },
-	{ "ang;", "∠" },
-	{ "apos;", "'" },
-	{ "aring;", "å" },
-	{ "asymp;", "≈" },
-	{ "atilde;", "ã" },
-	{ "auml;", "ä" },
-	{ "bdquo;", "„" },
-	{ "beta;", "β" },
-	{ "brvbar;", "¦" },
-	{ "bull;", "•" },
-	{ "cap;", "∩" },
-	{ "ccedil;", "ç" },
-	{ "cedil;", "¸" },
-	{ "cent;", "¢" },
-	{ "chi;", "χ" },
-	{ "circ;", "ˆ" },
-	{ "clubs;", "♣" },
-	{ "cong;", "≅" },
-	{ "copy;", "©" },
-	{ "crarr;", "↵" },
-	{ "cup;", "∪" },
-	{ "curren;", "¤" },
-	{ "dArr;", "⇓" },
-	{ "dagger;", "†" },
-	{ "darr;", "↓" },
-	{ "deg;", "°" },
-	{ "delta;", "δ" },
-	{ "diams;", "♦" },
-	{ "divide;", "÷" },
-	{ "eacute;", "é" },
-	{ "ecirc;", "ê" },
-	{ "egrave;", "è" },
-	{ "empty;", "∅" },
-	{ "emsp;", "\xE2\x80\x83" },
-	{ "ensp;", "\xE2\x80\x82" },
-	{ "epsilon;", "ε" },
-	{ "equiv;", "≡" },
-	{ "eta;", "η" },
-	{ "eth;", "ð" },
-	{ "euml;", "ë" },
-	{ "euro;", "€" },
-	{ "exist;", "∃" },
-	{ "fnof;", "ƒ" },
-	{ "forall;", "∀" },
-	{ "frac12;", "½" },
-	{ "frac14;", "¼" },
-	{ "frac34;", "¾" },
-	{ "frasl;", "⁄" },
-	{ "gamma;", "γ" },
-	{ "ge;", "≥" },
-	{ "gt;", ">" },
-	{ "hArr;", "⇔" },
-	{ "harr;", "↔" },
-	{ "hearts;", "♥" },
-	{ "hellip;", "…" },
-	{ "iacute;", "í" },
-	{ "icirc;", "î" },
-	{ "iexcl;", "¡" },
-	{ "igrave;", "ì" },
-	{ "image;", "ℑ" },
-	{ "infin;", "∞" },
-	{ "int;", "∫" },
-	{ "iota;", "ι" },
-	{ "iquest;", "¿" },
-	{ "isin;", "∈" },
-	{ "iuml;", "ï" },
-	{ "kappa;", "κ" },
-	{ "lArr;", "⇐" },
-	{ "lambda;", "λ" },
-	{ "lang;", "〈" },
-	{ "laquo;", "«" },
-	{ "larr;", "←" },
-	{ "lceil;", "⌈" },
-	{ "ldquo;", "“" },
-	{ "le;", "≤" },
-	{ "lfloor;", "⌊" },
-	{ "lowast;", "∗" },
-	{ "loz;", "◊" },
-	{ "lrm;", "\xE2\x80\x8E" },
-	{ "lsaquo;", "‹" },
-	{ "lsquo;", "‘" },
-	{ "lt;", "<" },
-	{ "macr;", "¯" },
-	{ "mdash;", "—" },
-	{ "micro;", "µ" },
-	{ "middot;", "·" },
-	{ "minus;", "−" },
-	{ "mu;", "μ" },
-	{ "nabla;", "∇" },
-	{ "nbsp;", "\xC2\xA0" },
-	{ "ndash;", "–" },
-	{ "ne;", "≠" },
-	{ "ni;", "∋" },
-	{ "not;", "¬" },
-	{ "notin;", "∉" },
-	{ "nsub;", "⊄" },
-	{ "ntilde;", "ñ" },
-	{ "nu;", "ν" },
-	{ "oacute;", "ó" },
-	{ "ocirc;", "ô" },
-	{ "oelig;", "œ" },
-	{ "ograve;", "ò" },
-	{ "oline;", "‾" },
-	{ "omega;", "ω" },
-	{ "omicron;", "ο" },
-	{ "oplus;", "⊕" },
-	{ "or;", "∨" },
-	{ "ordf;", "ª" },
-	{ "ordm;", "º" },
-	{ "oslash;", "ø" },
-	{ "otilde;", "õ" },
-	{ "otimes;", "⊗" },
-	{ "ouml;", "ö" },
-	{ "para;", "¶" },
-	{ "part;", "∂" },
-	{ "permil;", "‰" },
-	{ "perp;", "⊥" },
-	{ "phi;", "φ" },
-	{ "pi;", "π" },
-	{ "piv;", "ϖ" },
-	{ "plusmn;", "±" },
-	{ "pound;", "£" },
-	{ "prime;", "′" },
-	{ "prod;", "∏" },
-	{ "prop;", "∝" },
-	{ "psi;", "ψ" },
-	{ "quot;", "\"" },
-	{ "rArr;", "⇒" },
-	{ "radic;", "√" },
-	{ "rang;", "〉" },
-	{ "raquo;", "»" },
-	{ "rarr;", "→" },
-	{ "rceil;", "⌉" },
-	{ "rdquo;", "”" },
-	{ "real;", "ℜ" },
-	{ "reg;", "®" },
-	{ "rfloor;", "⌋" },
-	{ "rho;", "ρ" },
-	{ "rlm;", "\xE2\x80\x8F" },
-	{ "rsaquo;", "›" },
-	{ "rsquo;", "’" },
-	{ "sbquo;", "‚" },
-	{ "scaron;", "š" },
-	{ "sdot;", "⋅" },
-	{ "sect;", "§" },
-	{ "shy;", "\xC2\xAD" },
-	{ "sigma;", "σ" },
-	{ "sigmaf;", "ς" },
-	{ "sim;", "∼" },
-	{ "spades;", "♠" },
-	{ "sub;", "⊂" },
-	{ "sube;", "⊆" },
-	{ "sum;", "∑" },
-	{ "sup1;", "¹" },
-	{ "sup2;", "²" },
-	{ "sup3;", "³" },
-	{ "sup;", "⊃" },
-	{ "supe;", "⊇" },
-	{ "szlig;", "ß" },
-	{ "tau;", "τ" },
-	{ "there4;", "∴" },
-	{ "theta;", "θ" },
-	{ "thetasym;", "ϑ" },
-	{ "thinsp;", "\xE2\x80\x89" },
-	{ "thorn;", "þ" },
-	{ "tilde;", "˜" },
-	{ "times;", "×" },
-	{ "trade;", "™" },
-	{ "uArr;", "⇑" },
-	{ "uacute;", "ú" },
-	{ "uarr;", "↑" },
-	{ "ucirc;", "û" },
-	{ "ugrave;", "ù" },
-	{ "uml;", "¨" },
-	{ "upsih;", "ϒ" },
-	{ "upsilon;", "υ" },
-	{ "uuml;", "ü" },
-	{ "weierp;", "℘" },
-	{ "xi;", "ξ" },
-	{ "yacute;", "ý" },
-	{ "yen;", "¥" },
-	{ "yuml;", "ÿ" },
-	{ "zeta;", "ζ" },
-	{ "zwj;", "\xE2\x80\x8D" },
-	{ "zwnj;", "\xE2\x80\x8C" }
+struct named_entity {
+	const char *name;
+	size_t nameLength;
+	const char *value;
+	size_t valueLength;
 };
 
-static int cmp(const void *key, const void *value)
+/*	Entity names are stored without the leading '&' and trailing ';'. After
+	changing this list run Scripts/generate_entities_hash.py to rebuild the
+	perfect hash in entities_hash.h.
+*/
+#define ENTITY(name, value) { name, sizeof(name) - 1, value, sizeof(value) - 1 }
+
+static const struct named_entity NAMED_ENTITIES[] = {
+	ENTITY("AElig", "Æ"),
+	ENTITY("Aacute", "Á"),
+	ENTITY("Acirc", "Â"),
+	ENTITY("Agrave", "À"),
+	ENTITY("Alpha", "Α"),
+	ENTITY("Aring", "Å"),
+	ENTITY("Atilde", "Ã"),
+	ENTITY("Auml", "Ä"),
+	ENTITY("Beta", "Β"),
+	ENTITY("Ccedil", "Ç"),
+	ENTITY("Chi", "Χ"),
+	ENTITY("Dagger", "‡"),
+	ENTITY("Delta", "Δ"),
+	ENTITY("ETH", "Ð"),
+	ENTITY("Eacute", "É"),
+	ENTITY("Ecirc", "Ê"),
+	ENTITY("Egrave", "È"),
+	ENTITY("Epsilon", "Ε"),
+	ENTITY("Eta", "Η"),
+	ENTITY("Euml", "Ë"),
+	ENTITY("Gamma", "Γ"),
+	ENTITY("Iacute", "Í"),
+	ENTITY("Icirc", "Î"),
+	ENTITY("Igrave", "Ì"),
+	ENTITY("Iota", "Ι"),
+	ENTITY("Iuml", "Ï"),
+	ENTITY("Kappa", "Κ"),
+	ENTITY("Lambda", "Λ"),
+	ENTITY("Mu", "Μ"),
+	ENTITY("Ntilde", "Ñ"),
+	ENTITY("Nu", "Ν"),
+	ENTITY("OElig", "Œ"),
+	ENTITY("Oacute", "Ó"),
+	ENTITY("Ocirc", "Ô"),
+	ENTITY("Ograve", "Ò"),
+	ENTITY("Omega", "Ω"),
+	ENTITY("Omicron", "Ο"),
+	ENTITY("Oslash", "Ø"),
+	ENTITY("Otilde", "Õ"),
+	ENTITY("Ouml", "Ö"),
+	ENTITY("Phi", "Φ"),
+	ENTITY("Pi", "Π"),
+	ENTITY("Prime", "″"),
+	ENTITY("Psi", "Ψ"),
+	ENTITY("Rho", "Ρ"),
+	ENTITY("Scaron", "Š"),
+	ENTITY("Sigma", "Σ"),
+	ENTITY("THORN", "Þ"),
+	ENTITY("Tau", "Τ"),
+	ENTITY("Theta", "Θ"),
+	ENTITY("Uacute", "Ú"),
+	ENTITY("Ucirc", "Û"),
+	ENTITY("Ugrave", "Ù"),
+	ENTITY("Upsilon", "Υ"),
+	ENTITY("Uuml", "Ü"),
+	ENTITY("Xi", "Ξ"),
+	ENTITY("Yacute", "Ý"),
+	ENTITY("Yuml", "Ÿ"),
+	ENTITY("Zeta", "Ζ"),
+	ENTITY("aacute", "á"),
+	ENTITY("acirc", "â"),
+	ENTITY("acute", "´"),
+	ENTITY("aelig", "æ"),
+	ENTITY("agrave", "à"),
+	ENTITY("alefsym", "ℵ"),
+	ENTITY("alpha", "α"),
+	ENTITY("amp", "&"),
+	ENTITY("and", "∧"),
+	ENTITY("ang", "∠"),
+	ENTITY("apos", "'"),
+	ENTITY("aring", "å"),
+	ENTITY("asymp", "≈"),
+	ENTITY("atilde", "ã"),
+	ENTITY("auml", "ä"),
+	ENTITY("bdquo", "„"),
+	ENTITY("beta", "β"),
+	ENTITY("brvbar", "¦"),
+	ENTITY("bull", "•"),
+	ENTITY("cap", "∩"),
+	ENTITY("ccedil", "ç"),
+	ENTITY("cedil", "¸"),
+	ENTITY("cent", "¢"),
+	ENTITY("chi", "χ"),
+	ENTITY("circ", "ˆ"),
+	ENTITY("clubs", "♣"),
+	ENTITY("cong", "≅"),
+	ENTITY("copy", "©"),
+	ENTITY("crarr", "↵"),
+	ENTITY("cup", "∪"),
+	ENTITY("curren", "¤"),
+	ENTITY("dArr", "⇓"),
+	ENTITY("dagger", "†"),
+	ENTITY("darr", "↓"),
+	ENTITY("deg", "°"),
+	ENTITY("delta", "δ"),
+	ENTITY("diams", "♦"),
+	ENTITY("divide", "÷"),
+	ENTITY("eacute", "é"),
+	ENTITY("ecirc", "ê"),
+	ENTITY("egrave", "è"),
+	ENTITY("empty", "∅"),
+	ENTITY("emsp", "\xE2\x80\x83"),
+	ENTITY("ensp", "\xE2\x80\x82"),
+	ENTITY("epsilon", "ε"),
+	ENTITY("equiv", "≡"),
+	ENTITY("eta", "η"),
+	ENTITY("eth", "ð"),
+	ENTITY("euml", "ë"),
+	ENTITY("euro", "€"),
+	ENTITY("exist", "∃"),
+	ENTITY("fnof", "ƒ"),
+	ENTITY("forall", "∀"),
+	ENTITY("frac12", "½"),
+	ENTITY("frac14", "¼"),
+	ENTITY("frac34", "¾"),
+	ENTITY("frasl", "⁄"),
+	ENTITY("gamma", "γ"),
+	ENTITY("ge", "≥"),
+	ENTITY("gt", ">"),
+	ENTITY("hArr", "⇔"),
+	ENTITY("harr", "↔"),
+	ENTITY("hearts", "♥"),
+	ENTITY("hellip", "…"),
+	ENTITY("iacute", "í"),
+	ENTITY("icirc", "î"),
+	ENTITY("iexcl", "¡"),
+	ENTITY("igrave", "ì"),
+	ENTITY("image", "ℑ"),
+	ENTITY("infin", "∞"),
+	ENTITY("int", "∫"),
+	ENTITY("iota", "ι"),
+	ENTITY("iquest", "¿"),
+	ENTITY("isin", "∈"),
+	ENTITY("iuml", "ï"),
+	ENTITY("kappa", "κ"),
+	ENTITY("lArr", "⇐"),
+	ENTITY("lambda", "λ"),
+	ENTITY("lang", "〈"),
+	ENTITY("laquo", "«"),
+	ENTITY("larr", "←"),
+	ENTITY("lceil", "⌈"),
+	ENTITY("ldquo", "“"),
+	ENTITY("le", "≤"),
+	ENTITY("lfloor", "⌊"),
+	ENTITY("lowast", "∗"),
+	ENTITY("loz", "◊"),
+	ENTITY("lrm", "\xE2\x80\x8E"),
+	ENTITY("lsaquo", "‹"),
+	ENTITY("lsquo", "‘"),
+	ENTITY("lt", "<"),
+	ENTITY("macr", "¯"),
+	ENTITY("mdash", "—"),
+	ENTITY("micro", "µ"),
+	ENTITY("middot", "·"),
+	ENTITY("minus", "−"),
+	ENTITY("mu", "μ"),
+	ENTITY("nabla", "∇"),
+	ENTITY("nbsp", "\xC2\xA0"),
+	ENTITY("ndash", "–"),
+	ENTITY("ne", "≠"),
+	ENTITY("ni", "∋"),
+	ENTITY("not", "¬"),
+	ENTITY("notin", "∉"),
+	ENTITY("nsub", "⊄"),
+	ENTITY("ntilde", "ñ"),
+	ENTITY("nu", "ν"),
+	ENTITY("oacute", "ó"),
+	ENTITY("ocirc", "ô"),
+	ENTITY("oelig", "œ"),
+	ENTITY("ograve", "ò"),
+	ENTITY("oline", "‾"),
+	ENTITY("omega", "ω"),
+	ENTITY("omicron", "ο"),
+	ENTITY("oplus", "⊕"),
+	ENTITY("or", "∨"),
+	ENTITY("ordf", "ª"),
+	ENTITY("ordm", "º"),
+	ENTITY("oslash", "ø"),
+	ENTITY("otilde", "õ"),
+	ENTITY("otimes", "⊗"),
+	ENTITY("ouml", "ö"),
+	ENTITY("para", "¶"),
+	ENTITY("part", "∂"),
+	ENTITY("permil", "‰"),
+	ENTITY("perp", "⊥"),
+	ENTITY("phi", "φ"),
+	ENTITY("pi", "π"),
+	ENTITY("piv", "ϖ"),
+	ENTITY("plusmn", "±"),
+	ENTITY("pound", "£"),
+	ENTITY("prime", "′"),
+	ENTITY("prod", "∏"),
+	ENTITY("prop", "∝"),
+	ENTITY("psi", "ψ"),
+	ENTITY("quot", "\""),
+	ENTITY("rArr", "⇒"),
+	ENTITY("radic", "√"),
+	ENTITY("rang", "〉"),
+	ENTITY("raquo", "»"),
+	ENTITY("rarr", "→"),
+	ENTITY("rceil", "⌉"),
+	ENTITY("rdquo", "”"),
+	ENTITY("real", "ℜ"),
+	ENTITY("reg", "®"),
+	ENTITY("rfloor", "⌋"),
+	ENTITY("rho", "ρ"),
+	ENTITY("rlm", "\xE2\x80\x8F"),
+	ENTITY("rsaquo", "›"),
+	ENTITY("rsquo", "’"),
+	ENTITY("sbquo", "‚"),
+	ENTITY("scaron", "š"),
+	ENTITY("sdot", "⋅"),
+	ENTITY("sect", "§"),
+	ENTITY("shy", "\xC2\xAD"),
+	ENTITY("sigma", "σ"),
+	ENTITY("sigmaf", "ς"),
+	ENTITY("sim", "∼"),
+	ENTITY("spades", "♠"),
+	ENTITY("sub", "⊂"),
+	ENTITY("sube", "⊆"),
+	ENTITY("sum", "∑"),
+	ENTITY("sup1", "¹"),
+	ENTITY("sup2", "²"),
+	ENTITY("sup3", "³"),
+	ENTITY("sup", "⊃"),
+	ENTITY("supe", "⊇"),
+	ENTITY("szlig", "ß"),
+	ENTITY("tau", "τ"),
+	ENTITY("there4", "∴"),
+	ENTITY("theta", "θ"),
+	ENTITY("thetasym", "ϑ"),
+	ENTITY("thinsp", "\xE2\x80\x89"),
+	ENTITY("thorn", "þ"),
+	ENTITY("tilde", "˜"),
+	ENTITY("times", "×"),
+	ENTITY("trade", "™"),
+	ENTITY("uArr", "⇑"),
+	ENTITY("uacute", "ú"),
+	ENTITY("uarr", "↑"),
+	ENTITY("ucirc", "û"),
+	ENTITY("ugrave", "ù"),
+	ENTITY("uml", "¨"),
+	ENTITY("upsih", "ϒ"),
+	ENTITY("upsilon", "υ"),
+	ENTITY("uuml", "ü"),
+	ENTITY("weierp", "℘"),
+	ENTITY("xi", "ξ"),
+	ENTITY("yacute", "ý"),
+	ENTITY("yen", "¥"),
+	ENTITY("yuml", "ÿ"),
+	ENTITY("zeta", "ζ"),
+	ENTITY("zwj", "\xE2\x80\x8D"),
+	ENTITY("zwnj", "\xE2\x80\x8C")
+};
+
+_Static_assert(sizeof NAMED_ENTITIES / sizeof *NAMED_ENTITIES == NAMED_ENTITY_COUNT,
+	"entities_hash.h is out of date, run Scripts/generate_entities_hash.py");
+
+/*	FNV-1a, seeded. Must match entity_hash() in the generator script */
+static uint32_t entity_hash(uint32_t seed, const char *name, size_t length)
+{
+	uint32_t hash = 2166136261u ^ seed;
+	for(size_t i = 0; i < length; i++)
+	{
+		hash ^= (unsigned char)name[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/*	Look up an entity by name (without the '&' and ';') using the perfect
+	hash, so only one table entry ever needs to be compared.
+*/
+static const struct named_entity *get_named_entity(
+	const char *name, size_t length)
 {
-	return strncmp((const char *)key, *(const char *const *)value,
-		strlen(*(const char *const *)value));
+	short displacement = NAMED_ENTITY_DISPLACEMENTS[
+		entity_hash(0, name, length) % NAMED_ENTITY_COUNT];
+	size_t slot = displacement < 0
+		? (size_t)(-displacement - 1)
+		: entity_hash((uint32_t)displacement, name, length) % NAMED_ENTITY_COUNT;
+
+	const struct named_entity *entity = &NAMED_ENTITIES[NAMED_ENTITY_SLOTS[slot]];
+	if(entity->nameLength != length || memcmp(entity->name, name, length) != 0)
+		return NULL;
+
+	return entity;
 }
 
-static const char *get_named_entity(const char *name)
+size_t named_entity_count(void)
 {
-	const char *const *entity = (const char *const *)bsearch(name,
-		NAMED_ENTITIES, sizeof NAMED_ENTITIES / sizeof *NAMED_ENTITIES,
-		sizeof *NAMED_ENTITIES, cmp);
+	return NAMED_ENTITY_COUNT;
+}
 
-	return entity ? entity[1] : NULL;
+void named_entity_at(size_t index, const char **name, size_t *name_length,
+	const char **value, size_t *value_length)
+{
+	const struct named_entity *entity = &NAMED_ENTITIES[index];
+	*name = entity->name;
+	*name_length = entity->nameLength;
+	*value = entity->value;
+	*value_length = entity->valueLength;
 }
 
 static size_t putc_utf8(unsigned long cp, char *buffer)
@@ -321,42 +370,66 @@ static size_t putc_utf8(unsigned long cp, char *buffer)
 	return 0;
 }
 
-static bool parse_entity(
-	const char *current, char **to, const char **from)
+/*	Parse the decimal or hex digits of a numeric reference, which run from
+	<digits> up to <end>. Every character must be a digit and parsing gives up
+	as soon as the value passes UNICODE_MAX, so this never needs more than
+	seven significant digits and can't overflow.
+*/
+static inline bool parse_code_point(
+	const char *digits, const char *end, bool hex, unsigned long *cp)
 {
-	const char *end = strchr(current, ';');
-	if(!end) return 0;
+	if(digits >= end) return 0;
+
+	unsigned long value = 0;
+	for(const char *current = digits; current < end; current++)
+	{
+		unsigned char c = (unsigned char)*current;
+		unsigned long digit;
+		if(c >= '0' && c <= '9')
+			digit = c - '0';
+		else if(hex && (c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+			digit = (c | 0x20) - 'a' + 10;
+		else
+			return 0;
+
+		value = (hex ? value << 4 : value * 10) + digit;
+		if(value > UNICODE_MAX) return 0;
+	}
+
+	*cp = value;
+	return 1;
+}
 
+/*	Decode the entity between <current> (the '&') and <end> (the ';') */
+static bool parse_entity(
+	const char *current, const char *end, char **to)
+{
 	if(current[1] == '#')
 	{
-		char *tail = NULL;
-		int errno_save = errno;
 		bool hex = current[2] == 'x' || current[2] == 'X';
+		unsigned long cp;
 
-		errno = 0;
-		unsigned long cp = strtoul(
-			current + (hex ? 3 : 2), &tail, hex ? 16 : 10);
+        //                                                      do not allow nullbytes to be inserted via HTML entities
+		if(!parse_code_point(current + (hex ? 3 : 2), end, hex, &cp) || cp == 0x0)
+			return 0;
 
-        //                                                      do not allow nullbytes to be inserted via HTML entities 
-		bool fail = errno || tail != end || cp > UNICODE_MAX || cp == 0x0;
-		errno = errno_save;
-		if(fail) return 0;
+		/*	Surrogates can't be encoded in UTF-8, so do what browsers do and
+			show U+FFFD instead of writing bytes which aren't valid */
+		if(cp >= 0xD800ul && cp <= 0xDFFFul)
+			cp = 0xFFFDul;
 
 		*to += putc_utf8(cp, *to);
-		*from = end + 1;
 
 		return 1;
 	}
 	else
 	{
-		const char *entity = get_named_entity(&current[1]);
+		const struct named_entity *entity =
+			get_named_entity(&current[1], (size_t)(end - current - 1));
 		if(!entity) return 0;
 
-		size_t len = strlen(entity);
-		memcpy(*to, entity, len);
-
-		*to += len;
-		*from = end + 1;
+		memcpy(*to, entity->value, entity->valueLength);
+		*to += entity->valueLength;
 
 		return 1;
 	}
@@ -374,8 +447,12 @@ size_t decode_html_entities_utf8(char *dest, const char *src)
 		memmove(to, from, (size_t)(current - from));
 		to += current - from;
 
-		if(parse_entity(current, &to, &from))
+		const char *end = strchr(current, ';');
+		if(end && parse_entity(current, end, &to))
+		{
+			from = end + 1;
 			continue;
+		}
 
 		from = current;
 		*to++ = *from++;
@@ -389,3 +466,14 @@ size_t decode_html_entities_utf8(char *dest, const char *src)
 
 	return (size_t)(to - dest);
 }
+
+size_t decode_html_entity_utf8(char *dest, const char *src, size_t length)
+{
+	char *to = dest;
+	if(length >= 2 && src[0] == '&' && src[length - 1] == ';'
+		&& parse_entity(src, &src[length - 1], &to))
+		return (size_t)(to - dest);
+
+	memmove(dest, src, length);
+	return length;
+}
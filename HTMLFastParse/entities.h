@@ -19,4 +19,24 @@
 */
 extern size_t decode_html_entities_utf8(char *dest, const char *src);
 
+/*    Decodes the single entity <src> of <length> bytes (including the leading
+    '&' and the trailing ';') into <dest>, which should be a buffer large
+    enough to hold <length> characters. Unlike decode_html_entities_utf8 the
+    input does not need to be null terminated and the output is not.
+
+    Input which is not a known entity is copied through unchanged.
+
+    The function returns the number of bytes written.
+*/
+extern size_t decode_html_entity_utf8(char *dest, const char *src, size_t length);
+
+/*    The named entities the decoders know, so that the list can be walked.
+    <index> must be less than <named_entity_count()>. The name is without
+    the leading '&' and trailing ';' and the value is its UTF-8. Both are
+    null terminated.
+*/
+extern size_t named_entity_count(void);
+extern void named_entity_at(size_t index, const char **name, size_t *name_length,
+    const char **value, size_t *value_length);
+
 #endif
@@ -0,0 +1,64 @@
+/*	Generated by Scripts/generate_entities_hash.py from the entity list in
+	entities.c. Do not edit by hand.
+*/
+
+#ifndef DECODE_HTML_ENTITIES_HASH_
+#define DECODE_HTML_ENTITIES_HASH_
+
+#define NAMED_ENTITY_COUNT 253
+
+/*	Indexed by entity_hash(0, name) % NAMED_ENTITY_COUNT. Negative values are
+	-slot - 1, otherwise the value is the seed to rehash the name with.
+*/
+static const short NAMED_ENTITY_DISPLACEMENTS[NAMED_ENTITY_COUNT] = {
+	0, -245, 0, -243, -242, -239, 1, 0, 0, -236, -222, 1,
+	0, -219, 1, 0, -218, 2, 0, 0, -217, 1, 1, -215,
+	1, 0, -213, -211, 0, 0, 1, 3, -209, 2, -208, -202,
+	0, -198, -196, 0, 0, -193, -192, 1, 2, 3, -190, -187,
+	0, 0, 1, -185, 0, -184, -181, 0, 1, -180, 0, 0,
+	0, -179, -178, -176, -175, 0, -173, 0, 0, -171, 0, -168,
+	0, -161, 2, 2, 1, -159, 0, -158, 1, -157, 5, -153,
+	-152, 0, 1, 0, -151, -149, 0, 0, 0, 0, 2, 0,
+	2, -148, -147, 1, 1, 14, 0, -143, 0, 3, 2, -142,
+	0, 0, 1, -141, -139, 0, 0, -136, 0, -135, 0, 0,
+	0, 0, 3, 1, 5, -130, 0, -125, 0, 4, -120, 3,
+	0, 0, -118, 3, 1, -117, -116, 6, 6, 0, 0, 0,
+	0, 0, 0, -115, -114, -113, 0, 1, 12, -112, -102, 20,
+	-99, -95, 1, 0, -94, 0, -91, 0, 0, -90, -89, 0,
+	0, -82, 0, 0, -79, -69, -68, -67, 2, 2, 0, 1,
+	-66, 15, -65, -62, -61, 0, -58, 0, 1, 2, 0, 5,
+	0, -52, 0, -51, 0, 4, 13, 0, 7, 1, 0, 0,
+	0, 3, 0, -46, -44, -43, -42, -41, -35, -33, 0, 10,
+	0, 4, 0, -25, 0, -21, 9, 1, 0, 0, 0, -17,
+	-15, 0, -14, 13, 0, 0, -13, 3, 2, -11, -9, 0,
+	0, 0, 0, 0, 0, 1, 0, -6, 0, -3, 17, 0,
+	4,
+};
+
+/*	The index into NAMED_ENTITIES for each slot */
+static const short NAMED_ENTITY_SLOTS[NAMED_ENTITY_COUNT] = {
+	174, 11, 19, 204, 181, 111, 25, 247, 45, 203, 93, 83,
+	3, 54, 238, 94, 193, 138, 128, 151, 96, 155, 175, 163,
+	233, 51, 68, 136, 237, 223, 211, 38, 241, 242, 65, 14,
+	129, 22, 229, 188, 177, 104, 139, 178, 232, 221, 16, 84,
+	225, 149, 85, 251, 122, 119, 215, 77, 98, 245, 17, 236,
+	208, 110, 116, 75, 217, 220, 117, 159, 28, 63, 168, 43,
+	222, 78, 196, 200, 55, 29, 130, 60, 6, 154, 86, 214,
+	92, 15, 20, 36, 158, 140, 125, 134, 102, 106, 123, 244,
+	235, 176, 135, 132, 213, 150, 198, 239, 172, 166, 27, 101,
+	2, 113, 32, 164, 219, 162, 145, 192, 97, 4, 57, 7,
+	180, 160, 182, 206, 197, 246, 171, 189, 185, 165, 240, 167,
+	46, 146, 133, 69, 9, 144, 76, 82, 226, 210, 66, 121,
+	59, 108, 58, 10, 141, 216, 227, 99, 71, 105, 88, 89,
+	190, 137, 186, 183, 41, 8, 0, 70, 194, 249, 148, 143,
+	81, 39, 13, 90, 73, 5, 231, 107, 100, 52, 153, 202,
+	72, 152, 170, 62, 74, 201, 118, 120, 61, 195, 37, 209,
+	234, 80, 64, 42, 114, 103, 44, 18, 53, 21, 127, 184,
+	109, 126, 179, 250, 252, 95, 12, 87, 124, 49, 212, 56,
+	248, 169, 115, 228, 35, 156, 112, 26, 30, 207, 142, 131,
+	23, 1, 50, 48, 224, 199, 34, 230, 187, 157, 79, 91,
+	33, 67, 218, 191, 205, 24, 47, 31, 161, 147, 173, 40,
+	243,
+};
+
+#endif
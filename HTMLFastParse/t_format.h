@@ -42,10 +42,33 @@ struct t_format {
 	unsigned char exponentLevel;
 	unsigned char quoteLevel;
     unsigned char listNestLevel;
-	char *linkURL;
+    /**
+        The link, as 1 + the index of its URL in the document's t_link_table. Use linkURLForFormat to look it up
+     */
+    unsigned int linkIndex;
 	
 	unsigned int startPosition;
 	unsigned int endPosition;
 };
 
+/**
+ The link URLs of a document. Each URL is stored once, however many runs use it
+ */
+struct t_link_table {
+    //The null terminated URLs. The array and the URLs are a single allocation
+    char **urls;
+    int numberOfURLs;
+};
+
+/**
+ Get the URL a run links to
+
+ @param links The link table of the run's document
+ @param format The run
+ @return The URL, or NULL if the run isn't a link
+ */
+static inline const char * linkURLForFormat(const struct t_link_table *links, struct t_format format) {
+    return format.linkIndex > 0 ? links->urls[format.linkIndex - 1] : NULL;
+}
+
 #endif /* t_format_h */
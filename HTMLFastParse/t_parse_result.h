@@ -0,0 +1,29 @@
+//
+//  t_parse_result.h
+//  HTMLFastParse
+//
+//  Copyright © 2026 CarbonDev. All rights reserved.
+//
+
+#ifndef t_parse_result_h
+#define t_parse_result_h
+
+#include "t_format.h"
+
+/**
+ Everything tokenizeHTML and makeAttributesLinear produce for one document
+ */
+struct t_parse_result {
+    //The null terminated display text
+    char *displayText;
+    int numberOfHumanVisibleCharacters;
+    
+    //The flattened styles
+    struct t_format *formats;
+    int numberOfFormats;
+    
+    //The URLs the styles link to. They live in the same block as the display text
+    struct t_link_table links;
+};
+
+#endif /* t_parse_result_h */
@@ -0,0 +1,82 @@
+//
+//  t_run.h
+//  HTMLFastParse
+//
+//  Copyright © 2026 CarbonDev. All rights reserved.
+//
+
+#ifndef t_run_h
+#define t_run_h
+
+#include <stdint.h>
+#include "t_format.h"
+
+/*
+ A t_format packed into 16 bits
+
+ BIT MAP:
+ 0-6   formatTag (bold, italics, struck, code and the H level, exactly as in t_format)
+ 7-8   exponentLevel, capped at 3 (everything from 3 up is drawn the same)
+ 9-12  quoteLevel, capped at 15
+ 13-15 listNestLevel, capped at 7
+ */
+#define RUN_STYLE_FORMAT_TAG_MASK            0x7F
+#define RUN_STYLE_EXPONENT_LEVEL_OFFSET      7
+#define RUN_STYLE_EXPONENT_LEVEL_MAX         3
+#define RUN_STYLE_QUOTE_LEVEL_OFFSET         9
+#define RUN_STYLE_QUOTE_LEVEL_MAX            15
+#define RUN_STYLE_LIST_NEST_LEVEL_OFFSET     13
+#define RUN_STYLE_LIST_NEST_LEVEL_MAX        7
+
+#define RUN_STYLE_GET_FORMAT_TAG(v) ((v) & RUN_STYLE_FORMAT_TAG_MASK)
+#define RUN_STYLE_GET_EXPONENT_LEVEL(v) (((v) >> RUN_STYLE_EXPONENT_LEVEL_OFFSET) & RUN_STYLE_EXPONENT_LEVEL_MAX)
+#define RUN_STYLE_GET_QUOTE_LEVEL(v) (((v) >> RUN_STYLE_QUOTE_LEVEL_OFFSET) & RUN_STYLE_QUOTE_LEVEL_MAX)
+#define RUN_STYLE_GET_LIST_NEST_LEVEL(v) (((v) >> RUN_STYLE_LIST_NEST_LEVEL_OFFSET) & RUN_STYLE_LIST_NEST_LEVEL_MAX)
+
+//The largest linkIndex a packed run can hold
+#define RUN_LINK_INDEX_MAX UINT16_MAX
+
+/**
+ A compact t_format, half the size. Runs always cover the whole display text in order, so a run ends where the next one starts (and the last one at the end of the text)
+ */
+struct t_run {
+    unsigned int startPosition;
+    //See the bit map above
+    unsigned short style;
+    //Same as t_format's linkIndex
+    unsigned short linkIndex;
+};
+
+/**
+ The same runs as a struct of arrays, for consumers which scan one property across every run. Each array needs room for maximumNumberOfSimplifiedTags runs
+ */
+struct t_run_columns {
+    unsigned int *startPositions;
+    unsigned short *styles;
+    unsigned short *linkIndices;
+    int numberOfRuns;
+};
+
+/**
+ Unpack a run back into a t_format
+
+ @param runs The runs of a document
+ @param index The run to unpack
+ @param numberOfRuns The number of runs
+ @param displayTextLength The number of visible characters in the document
+ @return The run as a t_format
+ */
+static inline struct t_format formatForRun(const struct t_run runs[], int index, int numberOfRuns, int displayTextLength) {
+    struct t_format format;
+    unsigned short style = runs[index].style;
+    format.formatTag = RUN_STYLE_GET_FORMAT_TAG(style);
+    format.exponentLevel = RUN_STYLE_GET_EXPONENT_LEVEL(style);
+    format.quoteLevel = RUN_STYLE_GET_QUOTE_LEVEL(style);
+    format.listNestLevel = RUN_STYLE_GET_LIST_NEST_LEVEL(style);
+    format.linkIndex = runs[index].linkIndex;
+    format.startPosition = runs[index].startPosition;
+    format.endPosition = index + 1 < numberOfRuns ? runs[index + 1].startPosition : (unsigned int)displayTextLength;
+    return format;
+}
+
+#endif /* t_run_h */
@@ -0,0 +1,48 @@
+//
+//  t_table.h
+//  HTMLFastParse
+//
+//  Copyright © 2026 CarbonDev. All rights reserved.
+//
+
+#ifndef t_table_h
+#define t_table_h
+
+#include <stdbool.h>
+#include "t_parse_result.h"
+
+/**
+ A cell's align attribute
+ */
+enum t_table_align {
+    TABLE_ALIGN_NONE = 0,
+    TABLE_ALIGN_LEFT,
+    TABLE_ALIGN_CENTER,
+    TABLE_ALIGN_RIGHT
+};
+
+struct t_table_cell {
+    //The cell's display text and runs, positioned from the start of the cell. Every cell of a table shares the table's link table
+    struct t_parse_result content;
+    //A t_table_align
+    unsigned char align;
+    //Set for <th> cells
+    bool isHeader;
+};
+
+/**
+ A table as a grid of cells, see parseTableHTML
+ */
+struct t_table {
+    //Every cell, row by row
+    struct t_table_cell *cells;
+    int numberOfCells;
+    
+    //The cells of row i are cells[rowStarts[i]] up to (but not including) cells[rowStarts[i + 1]]. There are numberOfRows + 1 entries
+    int *rowStarts;
+    int numberOfRows;
+    //The number of cells in the longest row
+    int numberOfColumns;
+};
+
+#endif /* t_table_h */
@@ -4,12 +4,68 @@
 
 #ifndef HTMLTOATTR_FORMAT_H
 #define HTMLTOATTR_FORMAT_H
+
+/**
+ What a tag is, worked out once when the tag is read. Matching is by prefix, so "strong class=x" is TAG_KIND_STRONG
+ */
+enum t_tag_kind {
+    TAG_KIND_OTHER = 0,
+    TAG_KIND_LINK,
+    TAG_KIND_BLOCKQUOTE,
+    TAG_KIND_CODE,
+    TAG_KIND_DEL,
+    TAG_KIND_EM,
+    TAG_KIND_STRONG,
+    TAG_KIND_SUP,
+    TAG_KIND_TABLE,
+    TAG_KIND_ORDERED_LIST,
+    TAG_KIND_UNORDERED_LIST,
+    TAG_KIND_LIST_ITEM,
+    //Only seen when a table's own HTML is tokenized (see Table.h), everywhere else tables are skipped whole
+    TAG_KIND_TABLE_ROW,
+    TAG_KIND_TABLE_HEADER_CELL,
+    TAG_KIND_TABLE_DATA_CELL,
+    //h1 through h6 are consecutive so the level is kind - TAG_KIND_H1 + 1
+    TAG_KIND_H1,
+    TAG_KIND_H2,
+    TAG_KIND_H3,
+    TAG_KIND_H4,
+    TAG_KIND_H5,
+    TAG_KIND_H6
+};
+
+/**
+ The attributes the tokenizer records. Everything else in a tag is skipped
+ */
+enum t_tag_attribute {
+    TAG_ATTRIBUTE_HREF = 0,
+    TAG_ATTRIBUTE_TITLE,
+    TAG_ATTRIBUTE_ALIGN,
+    TAG_ATTRIBUTE_COUNT
+};
+
+//Where an attribute value sits in the tag text. A start of 0 means the attribute isn't there since the tag name always comes first
+struct t_tag_span {
+    unsigned int start;
+    unsigned int length;
+};
+
 struct t_tag {
     unsigned int startPosition;
     unsigned int endPosition;
+    //A t_tag_kind
+    unsigned char kind;
+
+    //The entity decoded tag text with every recorded attribute value null terminated in place. Only kept for links and tags with recorded attributes, NULL otherwise
     char *tag;
-    
+    //Indexed by t_tag_attribute. Use tagAttribute rather than reading these directly
+    struct t_tag_span attributes[TAG_ATTRIBUTE_COUNT];
+
+    //The base64 encoded table HTML for tables, unless the tokenizer was asked to capture tables lazily
     size_t tableDataLength;
     char *tableData;
+    //Where the table's raw HTML (from "<table" through the closing '>') sits in the input, as byte offsets. Always set for tables
+    size_t tableSourceStart;
+    size_t tableSourceLength;
 };
 #endif //HTMLTOATTR_FORMAT_H
@@ -0,0 +1,696 @@
+//
+//  main.c
+//  HTMLFastParseBenchmark
+//
+//  Copyright © 2026 CarbonDev. All rights reserved.
+//
+//  Times each stage of the C core on its own, without UIKit or a simulator, so it
+//  can run on Linux CI. See the Makefile for how to build it.
+//
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "../HTMLFastParse/C_HTML_Parser.h"
+#include "../HTMLFastParse/entities.h"
+#include "../HTMLFastParse/base64.h"
+#include "../HTMLFastParse/UTF16.h"
+#include "../HTMLFastParse/UTF8.h"
+#include "../HTMLFastParse/ParseCache.h"
+#include "../HTMLFastParse/Pack.h"
+
+/*
+ Allocation counting. The Makefile links with --wrap on Linux so that every
+ malloc/calloc/realloc made by the library comes through here first
+ */
+#ifndef COUNT_ALLOCATIONS
+#define COUNT_ALLOCATIONS 0
+#endif
+
+static unsigned long numberOfAllocations = 0;
+
+#if COUNT_ALLOCATIONS
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    numberOfAllocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    numberOfAllocations++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *pointer, size_t size) {
+    numberOfAllocations++;
+    return __real_realloc(pointer, size);
+}
+#endif
+
+struct document {
+    char *input;
+    size_t inputLength;
+    //Where the document is in its corpus's pack file, once packCorpus has written it
+    struct PackReader *pack;
+    uint64_t packIndex;
+};
+
+struct corpus {
+    const char *name;
+    struct document *documents;
+    int numberOfDocuments;
+    size_t numberOfBytes;
+};
+
+static void addDocument(struct corpus *corpus, char *input, size_t inputLength) {
+    corpus->documents = realloc(corpus->documents, (corpus->numberOfDocuments + 1) * sizeof(struct document));
+    corpus->documents[corpus->numberOfDocuments].input = input;
+    corpus->documents[corpus->numberOfDocuments].inputLength = inputLength;
+    corpus->documents[corpus->numberOfDocuments].pack = NULL;
+    corpus->numberOfDocuments++;
+    corpus->numberOfBytes += inputLength;
+}
+
+static char *readFile(const char *path, size_t *length) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long fileLength = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *contents = malloc(fileLength + 1);
+    *length = fread(contents, 1, fileLength, file);
+    contents[*length] = 0x00;
+    fclose(file);
+    return contents;
+}
+
+/*
+ CORPORA
+ */
+
+/**
+ Undo the XML escaping of a plist string in place
+
+ @return The unescaped length
+ */
+static size_t unescapeXML(char *text, size_t length) {
+    static const struct { const char *entity; char character; } XML_ENTITIES[] = {
+        {"&lt;", '<'}, {"&gt;", '>'}, {"&amp;", '&'}, {"&quot;", '"'}, {"&apos;", '\''}
+    };
+    size_t out = 0;
+    for (size_t i = 0; i < length; i++) {
+        char current = text[i];
+        if (current == '&') {
+            for (int e = 0; e < sizeof(XML_ENTITIES) / sizeof(XML_ENTITIES[0]); e++) {
+                size_t entityLength = strlen(XML_ENTITIES[e].entity);
+                if (i + entityLength <= length && strncmp(&text[i], XML_ENTITIES[e].entity, entityLength) == 0) {
+                    current = XML_ENTITIES[e].character;
+                    i += entityLength - 1;
+                    break;
+                }
+            }
+        }
+        text[out++] = current;
+    }
+    text[out] = 0x00;
+    return out;
+}
+
+/**
+ Load every <string> of TestData.plist as a document. This is the same corpus the XCTest cases use
+ */
+static void loadPlistCorpus(struct corpus *corpus, const char *path) {
+    size_t length;
+    char *plist = readFile(path, &length);
+    if (!plist) {
+        fprintf(stderr, "Can't read %s\n", path);
+        exit(1);
+    }
+    for (char *start = plist; (start = strstr(start, "<string>")); ) {
+        start += strlen("<string>");
+        char *end = strstr(start, "</string>");
+        if (!end) {
+            break;
+        }
+        size_t inputLength = end - start;
+        char *input = malloc(inputLength + 1);
+        memcpy(input, start, inputLength);
+        inputLength = unescapeXML(input, inputLength);
+        addDocument(corpus, input, inputLength);
+        start = end;
+    }
+    free(plist);
+}
+
+static void loadFileCorpus(struct corpus *corpus, const char *path) {
+    size_t length;
+    char *input = readFile(path, &length);
+    if (!input) {
+        fprintf(stderr, "Can't read %s\n", path);
+        exit(1);
+    }
+    addDocument(corpus, input, length);
+}
+
+//A small deterministic generator so that the generated corpora are the same on every run
+static uint32_t randomState = 0x12345678;
+static uint32_t nextRandom(void) {
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+static const char *WORDS[] = {"the", "parser", "reddit", "comment", "quick", "brown", "fox", "thread", "über", "naïve", "日本語", "😀"};
+#define NUMBER_OF_WORDS (sizeof(WORDS) / sizeof(WORDS[0]))
+
+struct generated_text {
+    char *text;
+    size_t length;
+    size_t capacity;
+};
+
+static void appendText(struct generated_text *text, const char *append) {
+    size_t appendLength = strlen(append);
+    if (text->length + appendLength + 1 > text->capacity) {
+        text->capacity = (text->length + appendLength + 1) * 2;
+        text->text = realloc(text->text, text->capacity);
+    }
+    memcpy(text->text + text->length, append, appendLength + 1);
+    text->length += appendLength;
+}
+
+static void appendWords(struct generated_text *text, int numberOfWords) {
+    for (int i = 0; i < numberOfWords; i++) {
+        appendText(text, WORDS[nextRandom() % NUMBER_OF_WORDS]);
+        appendText(text, " ");
+    }
+}
+
+//Short comments with the occasional bit of formatting, like most of a comment thread
+static void generateComment(struct generated_text *text) {
+    appendText(text, "<div class=\"md\"><p>");
+    appendWords(text, 1 + nextRandom() % 40);
+    if (nextRandom() % 2) {
+        appendText(text, "<em>");
+        appendWords(text, 1 + nextRandom() % 4);
+        appendText(text, "</em> ");
+    }
+    if (nextRandom() % 4 == 0) {
+        appendText(text, "<a href=\"https://www.reddit.com/r/programming/\">");
+        appendWords(text, 2);
+        appendText(text, "</a>");
+    }
+    appendText(text, "</p>\n</div>");
+}
+
+//Text where a large share of the bytes are entities
+static void generateEntities(struct generated_text *text) {
+    static const char *ENTITIES[] = {"&amp;", "&lt;", "&gt;", "&quot;", "&#39;", "&#x27;", "&#8217;", "&#x1F600;", "&nbsp;", "&eacute;", "&bogus;"};
+    appendText(text, "<div class=\"md\"><p>");
+    int numberOfEntities = 10 + nextRandom() % 200;
+    for (int i = 0; i < numberOfEntities; i++) {
+        appendWords(text, nextRandom() % 3);
+        appendText(text, ENTITIES[nextRandom() % (sizeof(ENTITIES) / sizeof(ENTITIES[0]))]);
+    }
+    appendText(text, "</p>\n</div>");
+}
+
+//Deeply nested quotes, lists and styles so that the flattening has lots of overlapping tags to sweep
+static void generateNested(struct generated_text *text) {
+    static const char *TAGS[] = {"blockquote", "strong", "em", "del", "sup", "code", "h3", "ul", "li"};
+    int depth = 1 + nextRandom() % 24;
+    const char *opened[24];
+    appendText(text, "<div class=\"md\">");
+    for (int i = 0; i < depth; i++) {
+        opened[i] = TAGS[nextRandom() % (sizeof(TAGS) / sizeof(TAGS[0]))];
+        appendText(text, "<");
+        appendText(text, opened[i]);
+        appendText(text, ">");
+        appendWords(text, 1 + nextRandom() % 6);
+    }
+    for (int i = depth - 1; i >= 0; i--) {
+        appendText(text, "</");
+        appendText(text, opened[i]);
+        appendText(text, ">\n");
+    }
+    appendText(text, "</div>");
+}
+
+//Comments with no markup at all, which skip the parser entirely
+static void generatePlain(struct generated_text *text) {
+    appendWords(text, 1 + nextRandom() % 40);
+    if (nextRandom() % 2) {
+        appendText(text, "\n");
+        appendWords(text, 1 + nextRandom() % 20);
+    }
+}
+
+//Tables, which are encoded into data URIs
+static void generateTable(struct generated_text *text) {
+    appendText(text, "<div class=\"md\"><p>Results:</p>\n<table><thead>\n<tr>\n<th>Name</th>\n<th align=\"right\">Score</th>\n</tr>\n</thead><tbody>\n");
+    int numberOfRows = 1 + nextRandom() % 40;
+    for (int i = 0; i < numberOfRows; i++) {
+        appendText(text, "<tr>\n<td>");
+        appendWords(text, 1 + nextRandom() % 3);
+        appendText(text, "</td>\n<td align=\"right\">42</td>\n</tr>\n");
+    }
+    appendText(text, "</tbody></table>\n</div>");
+}
+
+static void generateCorpus(struct corpus *corpus, void (*generator)(struct generated_text *), int numberOfDocuments) {
+    for (int i = 0; i < numberOfDocuments; i++) {
+        struct generated_text text = {NULL, 0, 0};
+        generator(&text);
+        addDocument(corpus, text.text, text.length);
+    }
+}
+
+/**
+ Write every document of a corpus to a pack file and map it back in for the pack stage. The file is unlinked straight away, the mapping keeps it alive until the reader is closed
+ */
+static struct PackReader * packCorpus(struct corpus *corpus, int number) {
+    char path[4096];
+    snprintf(path, sizeof(path), "/tmp/HTMLFastParseBenchmark-%d-%d.pack", (int)getpid(), number);
+    remove(path);
+    struct PackWriter *writer = openPackWriter(path);
+    for (int d = 0; writer && d < corpus->numberOfDocuments; d++) {
+        appendPackDocument(writer, corpus->documents[d].input, corpus->documents[d].inputLength);
+    }
+    struct PackReader *reader = closePackWriter(writer) ? openPackReader(path) : NULL;
+    remove(path);
+    if (!reader || numberOfPackDocuments(reader) != (uint64_t)corpus->numberOfDocuments) {
+        fprintf(stderr, "Can't write a pack file to %s\n", path);
+        exit(1);
+    }
+    for (int d = 0; d < corpus->numberOfDocuments; d++) {
+        corpus->documents[d].pack = reader;
+        corpus->documents[d].packIndex = d;
+    }
+    return reader;
+}
+
+/*
+ STAGES
+
+ Each stage runs once per document per iteration. Only the work inside the stage is timed and counted, set up and clean up happen outside of it.
+ */
+
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+//The preview stage reads this many visible characters, about what a feed shows of each post
+#define PREVIEW_LENGTH 300
+
+struct stage_result {
+    double nanoseconds;
+    unsigned long allocations;
+};
+
+static struct stage_result runTokenize(struct document *document) {
+    struct t_tag *tags = malloc((maximumNumberOfTags(document->input, document->inputLength) + 1) * sizeof(struct t_tag));
+    int numberOfTags;
+    int numberOfHumanVisibleCharacters;
+
+    unsigned long allocations = numberOfAllocations;
+    double start = now();
+    char *displayText = tokenizeHTML(document->input, document->inputLength, tags, &numberOfTags, &numberOfHumanVisibleCharacters);
+    struct stage_result result = {now() - start, numberOfAllocations - allocations};
+
+    for (int i = 0; i < numberOfTags; i++) {
+        free(tags[i].tag);
+        free(tags[i].tableData);
+    }
+    free(tags);
+    free(displayText);
+    return result;
+}
+
+static struct stage_result runTokenizeLazyTables(struct document *document) {
+    struct t_tag *tags = malloc((maximumNumberOfTags(document->input, document->inputLength) + 1) * sizeof(struct t_tag));
+    int numberOfTags;
+    int numberOfHumanVisibleCharacters;
+
+    unsigned long allocations = numberOfAllocations;
+    double start = now();
+    char *displayText = tokenizeHTMLWithOptions(document->input, document->inputLength, tags, &numberOfTags, &numberOfHumanVisibleCharacters, TOKENIZER_OPTION_LAZY_TABLES, NULL);
+    struct stage_result result = {now() - start, numberOfAllocations - allocations};
+
+    for (int i = 0; i < numberOfTags; i++) {
+        free(tags[i].tag);
+    }
+    free(tags);
+    free(displayText);
+    return result;
+}
+
+static struct stage_result runTokenizePreview(struct document *document) {
+    struct t_tag *tags = malloc((maximumNumberOfTags(document->input, document->inputLength) + 1) * sizeof(struct t_tag));
+    int numberOfTags;
+    int numberOfHumanVisibleCharacters;
+    bool isTruncated;
+
+    unsigned long allocations = numberOfAllocations;
+    double start = now();
+    char *displayText = tokenizeHTMLPreview(document->input, document->inputLength, tags, &numberOfTags, &numberOfHumanVisibleCharacters, PREVIEW_LENGTH, &isTruncated, TOKENIZER_OPTION_NONE, NULL);
+    struct stage_result result = {now() - start, numberOfAllocations - allocations};
+
+    for (int i = 0; i < numberOfTags; i++) {
+        free(tags[i].tag);
+        free(tags[i].tableData);
+    }
+    free(tags);
+    free(displayText);
+    return result;
+}
+
+static struct stage_result runFlatten(struct document *document) {
+    struct t_tag *tags = malloc((maximumNumberOfTags(document->input, document->inputLength) + 1) * sizeof(struct t_tag));
+    int numberOfTags;
+    int numberOfHumanVisibleCharacters;
+    char *displayText = tokenizeHTML(document->input, document->inputLength, tags, &numberOfTags, &numberOfHumanVisibleCharacters);
+    struct t_format *formats = malloc((maximumNumberOfSimplifiedTags(numberOfTags, numberOfHumanVisibleCharacters) + 1) * sizeof(struct t_format));
+    int numberOfFormats;
+
+    unsigned long allocations = numberOfAllocations;
+    double start = now();
+    struct t_link_table links;
+    makeAttributesLinear(tags, numberOfTags, formats, &numberOfFormats, &links, numberOfHumanVisibleCharacters);
+    struct stage_result result = {now() - start, numberOfAllocations - allocations};
+
+    freeLinkTable(&links);
+    free(formats);
+    free(tags);
+    free(displayText);
+    return result;
+}
+
+static struct stage_result runFlattenPacked(struct document *document) {
+    struct t_tag *tags = malloc((maximumNumberOfTags(document->input, document->inputLength) + 1) * sizeof(struct t_tag));
+    int numberOfTags;
+    int numberOfHumanVisibleCharacters;
+    char *displayText = tokenizeHTML(document->input, document->inputLength, tags, &numberOfTags, &numberOfHumanVisibleCharacters);
+    struct t_run *runs = malloc((maximumNumberOfSimplifiedTags(numberOfTags, numberOfHumanVisibleCharacters) + 1) * sizeof(struct t_run));
+    int numberOfRuns;
+
+    unsigned long allocations = numberOfAllocations;
+    double start = now();
+    struct t_link_table links;
+    makeRunsLinearWithArena(tags, numberOfTags, runs, &numberOfRuns, &links, numberOfHumanVisibleCharacters, NULL);
+    struct stage_result result = {now() - start, numberOfAllocations - allocations};
+
+    freeLinkTable(&links);
+    free(runs);
+    free(tags);
+    free(displayText);
+    return result;
+}
+
+//What a renderer applying styles straight from the visitor would do with each run
+static void visitRun(void *context, const struct t_format *run, const char *linkURL, size_t linkURLLength) {
+    *(size_t *)context += run->endPosition - run->startPosition + run->formatTag + linkURLLength;
+}
+
+static struct stage_result runFlattenVisitor(struct document *document) {
+    struct t_tag *tags = malloc((maximumNumberOfTags(document->input, document->inputLength) + 1) * sizeof(struct t_tag));
+    int numberOfTags;
+    int numberOfHumanVisibleCharacters;
+    char *displayText = tokenizeHTML(document->input, document->inputLength, tags, &numberOfTags, &numberOfHumanVisibleCharacters);
+
+    unsigned long allocations = numberOfAllocations;
+    double start = now();
+    size_t sum = 0;
+    visitAttributesLinear(tags, numberOfTags, numberOfHumanVisibleCharacters, visitRun, &sum, NULL);
+    struct stage_result result = {now() - start, numberOfAllocations - allocations};
+
+    free(tags);
+    free(displayText);
+    return result;
+}
+
+static struct stage_result runRepairUTF8(struct document *document) {
+    //The pass parseHTMLBatch and appendPackDocument make over every document. Timing validateUTF8 alone would stop at the first bad byte
+    unsigned long allocations = numberOfAllocations;
+    double start = now();
+    size_t repairedLength;
+    char *repaired = repairUTF8(document->input, document->inputLength, &repairedLength, NULL);
+    struct stage_result result = {now() - start, numberOfAllocations - allocations};
+
+    free(repaired);
+    return result;
+}
+
+static struct stage_result runCached(struct document *document) {
+    //Every document is seen once per pass, so after the first pass this is the cost of a hit
+    static struct ParseCache *cache;
+    if (!cache) {
+        cache = createParseCache(64 * 1024 * 1024);
+    }
+
+    unsigned long allocations = numberOfAllocations;
+    double start = now();
+    const struct t_parse_result *result = parseHTMLCached(cache, document->input, document->inputLength);
+    releaseCachedParseResult(cache, result);
+    return (struct stage_result){now() - start, numberOfAllocations - allocations};
+}
+
+static struct stage_result runPackRead(struct document *document) {
+    //Touch every run and URL the way a renderer would, to show that reading a pack needs no deserialization
+    volatile size_t checksum = 0;
+
+    unsigned long allocations = numberOfAllocations;
+    double start = now();
+    const struct t_pack_document *packed = packDocument(document->pack, document->packIndex);
+    const struct t_run *runs = packRuns(packed);
+    for (uint32_t i = 0; i < packed->numberOfRuns; i++) {
+        struct t_format format = formatForRun(runs, i, packed->numberOfRuns, packed->numberOfHumanVisibleCharacters);
+        const char *url = packLinkURL(packed, format.linkIndex);
+        checksum += format.endPosition - format.startPosition + format.formatTag + (url ? url[0] : 0);
+    }
+    return (struct stage_result){now() - start, numberOfAllocations - allocations};
+}
+
+static struct stage_result runPlainText(struct document *document) {
+    struct t_format run;
+    struct t_parse_result plainText;
+
+    unsigned long allocations = numberOfAllocations;
+    double start = now();
+    parsePlainText(document->input, document->inputLength, &run, &plainText);
+    return (struct stage_result){now() - start, numberOfAllocations - allocations};
+}
+
+static struct stage_result runTranscode(struct document *document) {
+    struct t_tag *tags = malloc((maximumNumberOfTags(document->input, document->inputLength) + 1) * sizeof(struct t_tag));
+    int numberOfTags;
+    int numberOfHumanVisibleCharacters;
+    char *displayText = tokenizeHTML(document->input, document->inputLength, tags, &numberOfTags, &numberOfHumanVisibleCharacters);
+    uint16_t *characters = malloc((numberOfHumanVisibleCharacters + 1) * sizeof(uint16_t));
+    bool isValid;
+
+    unsigned long allocations = numberOfAllocations;
+    double start = now();
+    struct t_utf16_index index;
+    transcodeToUTF16(displayText, strlen(displayText), characters, numberOfHumanVisibleCharacters + 1, &index, &isValid);
+    struct stage_result result = {now() - start, numberOfAllocations - allocations};
+
+    freeUTF16Index(&index);
+    free(characters);
+    for (int i = 0; i < numberOfTags; i++) {
+        free(tags[i].tag);
+        free(tags[i].tableData);
+    }
+    free(tags);
+    free(displayText);
+    return result;
+}
+
+static struct stage_result runEntities(struct document *document) {
+    char *decoded = malloc(document->inputLength + 1);
+
+    unsigned long allocations = numberOfAllocations;
+    double start = now();
+    decode_html_entities_utf8(decoded, document->input);
+    struct stage_result result = {now() - start, numberOfAllocations - allocations};
+
+    free(decoded);
+    return result;
+}
+
+static struct stage_result runBase64(struct document *document) {
+    char *encoded = malloc(Base64encode_len(document->inputLength));
+
+    unsigned long allocations = numberOfAllocations;
+    double start = now();
+    Base64encode(encoded, document->input, document->inputLength);
+    struct stage_result result = {now() - start, numberOfAllocations - allocations};
+
+    free(encoded);
+    return result;
+}
+
+struct stage {
+    const char *name;
+    struct stage_result (*run)(struct document *document);
+};
+
+static const struct stage STAGES[] = {
+    {"repairUTF8", runRepairUTF8},
+    {"tokenizeHTML", runTokenize},
+    {"tokenizeHTML lazy", runTokenizeLazyTables},
+    {"tokenizeHTML preview", runTokenizePreview},
+    {"makeAttributesLinear", runFlatten},
+    {"makeRunsLinear", runFlattenPacked},
+    {"visitAttributesLinear", runFlattenVisitor},
+    {"parseHTMLCached", runCached},
+    {"packDocument", runPackRead},
+    {"parsePlainText", runPlainText},
+    {"transcodeToUTF16", runTranscode},
+    {"decode_html_entities", runEntities},
+    {"Base64encode", runBase64},
+};
+
+static int compareDoubles(const void *a, const void *b) {
+    double difference = *(const double *)a - *(const double *)b;
+    return difference < 0 ? -1 : difference > 0;
+}
+
+static double percentile(double *sortedSamples, size_t numberOfSamples, double fraction) {
+    size_t index = (size_t)(fraction * (numberOfSamples - 1) + 0.5);
+    return sortedSamples[index];
+}
+
+static void benchmark(const struct stage *stage, struct corpus *corpus, int iterations, int csv) {
+    size_t numberOfSamples = (size_t)iterations * corpus->numberOfDocuments;
+    double *samples = malloc(numberOfSamples * sizeof(double));
+    double totalNanoseconds = 0;
+    unsigned long totalAllocations = 0;
+
+    //One untimed pass to warm up the caches and the allocator
+    for (int d = 0; d < corpus->numberOfDocuments; d++) {
+        stage->run(&corpus->documents[d]);
+    }
+
+    size_t sample = 0;
+    for (int i = 0; i < iterations; i++) {
+        for (int d = 0; d < corpus->numberOfDocuments; d++) {
+            struct stage_result result = stage->run(&corpus->documents[d]);
+            samples[sample++] = result.nanoseconds;
+            totalNanoseconds += result.nanoseconds;
+            totalAllocations += result.allocations;
+        }
+    }
+    qsort(samples, numberOfSamples, sizeof(double), compareDoubles);
+
+    double nanosecondsPerByte = totalNanoseconds / ((double)corpus->numberOfBytes * iterations);
+    double allocationsPerDocument = (double)totalAllocations / numberOfSamples;
+    double p50 = percentile(samples, numberOfSamples, 0.50) / 1000;
+    double p90 = percentile(samples, numberOfSamples, 0.90) / 1000;
+    double p99 = percentile(samples, numberOfSamples, 0.99) / 1000;
+    if (csv) {
+        printf("%s,%s,%.3f,%.2f,%.3f,%.3f,%.3f\n", stage->name, corpus->name, nanosecondsPerByte, allocationsPerDocument, p50, p90, p99);
+    } else {
+        printf("%-22s %-22s %10.3f %12.2f %11.3f %11.3f %11.3f\n", stage->name, corpus->name, nanosecondsPerByte, allocationsPerDocument, p50, p90, p99);
+    }
+    fflush(stdout);
+    free(samples);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-d test data directory] [-i iterations] [-s stage] [-c]\n", name);
+    fprintf(stderr, "  -d  Where TestData.plist and 2MB_dev_random.txt are (default ../HTMLFastParseTests)\n");
+    fprintf(stderr, "  -i  Passes over each corpus (default 20)\n");
+    fprintf(stderr, "  -s  Only run stages whose name contains this\n");
+    fprintf(stderr, "  -c  Print CSV instead of a table\n");
+}
+
+int main(int argc, char * const argv[]) {
+    const char *dataDirectory = "../HTMLFastParseTests";
+    const char *stageFilter = NULL;
+    int iterations = 20;
+    int csv = 0;
+
+    int option;
+    while ((option = getopt(argc, argv, "d:i:s:ch")) != -1) {
+        switch (option) {
+            case 'd':
+                dataDirectory = optarg;
+                break;
+            case 'i':
+                iterations = atoi(optarg);
+                break;
+            case 's':
+                stageFilter = optarg;
+                break;
+            case 'c':
+                csv = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (iterations < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    char path[4096];
+    struct corpus corpora[7] = {
+        {"TestData.plist"}, {"2MB_dev_random.txt"}, {"generated/comments"}, {"generated/entities"}, {"generated/nested"}, {"generated/tables"}, {"generated/plain"}
+    };
+    snprintf(path, sizeof(path), "%s/TestData.plist", dataDirectory);
+    loadPlistCorpus(&corpora[0], path);
+    snprintf(path, sizeof(path), "%s/2MB_dev_random.txt", dataDirectory);
+    loadFileCorpus(&corpora[1], path);
+    generateCorpus(&corpora[2], generateComment, 1000);
+    generateCorpus(&corpora[3], generateEntities, 200);
+    generateCorpus(&corpora[4], generateNested, 500);
+    generateCorpus(&corpora[5], generateTable, 100);
+    generateCorpus(&corpora[6], generatePlain, 1000);
+
+    if (csv) {
+        printf("stage,corpus,ns_per_byte,allocations_per_document,p50_us,p90_us,p99_us\n");
+    } else {
+        printf("%-22s %-22s %10s %12s %11s %11s %11s\n", "stage", "corpus", "ns/byte", "allocs/doc", "p50 (us)", "p90 (us)", "p99 (us)");
+    }
+#if !COUNT_ALLOCATIONS
+    fprintf(stderr, "Allocation counting is not available on this platform, allocs/doc will read 0\n");
+#endif
+
+    struct PackReader *packs[sizeof(corpora) / sizeof(corpora[0])] = {NULL};
+    for (int s = 0; s < sizeof(STAGES) / sizeof(STAGES[0]); s++) {
+        if (stageFilter && !strstr(STAGES[s].name, stageFilter)) {
+            continue;
+        }
+        //Only the pack stage needs the pack files, so they are written the first time it runs
+        if (STAGES[s].run == runPackRead && !packs[0]) {
+            for (int c = 0; c < sizeof(corpora) / sizeof(corpora[0]); c++) {
+                packs[c] = packCorpus(&corpora[c], c);
+            }
+        }
+        for (int c = 0; c < sizeof(corpora) / sizeof(corpora[0]); c++) {
+            benchmark(&STAGES[s], &corpora[c], iterations, csv);
+        }
+    }
+
+    for (int c = 0; c < sizeof(corpora) / sizeof(corpora[0]); c++) {
+        closePackReader(packs[c]);
+        for (int d = 0; d < corpora[c].numberOfDocuments; d++) {
+            free(corpora[c].documents[d].input);
+        }
+        free(corpora[c].documents);
+    }
+    return 0;
+}
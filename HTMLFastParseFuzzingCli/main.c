@@ -37,8 +37,8 @@ void do_fuzz_case(uint8_t* buffer, size_t fuzz_size) {
     char *input = (char *)buffer;
     unsigned long inputLength = strnlen(input, fuzz_size);
     
-    if (!(tokens = malloc(inputLength * sizeof(struct t_tag)))
-          || !(format_tokens =  malloc(inputLength * sizeof(struct t_format)))) {
+    //+1 so that we never ask malloc for zero bytes
+    if (!(tokens = malloc((maximumNumberOfTags(input, inputLength) + 1) * sizeof(struct t_tag)))) {
         goto CLEANUP;
     }
 
@@ -47,9 +47,14 @@ void do_fuzz_case(uint8_t* buffer, size_t fuzz_size) {
     int numberOfHumanVisibleCharachters = -1;
     display_text = tokenizeHTML(input, inputLength, tokens, &numberOfTags, &numberOfHumanVisibleCharachters);
 
+    if (!(format_tokens = malloc((maximumNumberOfSimplifiedTags(numberOfTags, numberOfHumanVisibleCharachters) + 1) * sizeof(struct t_format)))) {
+        goto CLEANUP;
+    }
     
     int numberOfSimplifiedTags = -1;
-    makeAttributesLinear(tokens, (int)numberOfTags, format_tokens, &numberOfSimplifiedTags, numberOfHumanVisibleCharachters);
+    struct t_link_table links;
+    makeAttributesLinear(tokens, (int)numberOfTags, format_tokens, &numberOfSimplifiedTags, &links, numberOfHumanVisibleCharachters);
+    freeLinkTable(&links);
     
 CLEANUP:
     if (tokens) {
@@ -9,11 +9,200 @@
 #import <XCTest/XCTest.h>
 #import "FormatToAttributedString.h"
 #import "C_HTML_Parser.h"
+#import "entities.h"
+#import "Batch.h"
+#import "Table.h"
+#import "base64.h"
+#import "UTF16.h"
+#import "UTF8.h"
+#import "TextScan.h"
+#import "ParseCache.h"
+#import "Pack.h"
 @interface HTMLFastParseTests : XCTestCase
 @property (nonatomic,strong) NSDictionary *testData;
 @property (nonatomic,strong) NSDictionary *answerData;
 @end
 
+/**
+ The strtoul based numeric entity decoder which entities.c used to use. Kept here as a reference for the faster decoder.
+ */
+static size_t referenceDecodeNumericEntity(char *dest, const char *src, size_t length) {
+    const char *end = src + length - 1;
+    bool hex = src[2] == 'x' || src[2] == 'X';
+    char *tail = NULL;
+    errno = 0;
+    unsigned long cp = strtoul(src + (hex ? 3 : 2), &tail, hex ? 16 : 10);
+    if (errno || tail != end || cp > 0x10FFFF || cp == 0x0) {
+        memcpy(dest, src, length);
+        return length;
+    }
+
+    unsigned char *out = (unsigned char *)dest;
+    if (cp <= 0x7F) {
+        out[0] = cp;
+        return 1;
+    } else if (cp <= 0x7FF) {
+        out[0] = 0xC0 | (cp >> 6);
+        out[1] = 0x80 | (cp & 0x3F);
+        return 2;
+    } else if (cp <= 0xFFFF) {
+        out[0] = 0xE0 | (cp >> 12);
+        out[1] = 0x80 | ((cp >> 6) & 0x3F);
+        out[2] = 0x80 | (cp & 0x3F);
+        return 3;
+    }
+    out[0] = 0xF0 | (cp >> 18);
+    out[1] = 0x80 | ((cp >> 12) & 0x3F);
+    out[2] = 0x80 | ((cp >> 6) & 0x3F);
+    out[3] = 0x80 | (cp & 0x3F);
+    return 4;
+}
+
+/**
+ The one group at a time encoder which base64.c used to use. Kept here as a reference for the vectorized encoders.
+ */
+static size_t referenceBase64encode(char *encoded, const char *string, size_t len) {
+    static const char basis_64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const unsigned char *input = (const unsigned char *)string;
+    char *p = encoded;
+    size_t i;
+    for (i = 0; i + 2 < len; i += 3) {
+        *p++ = basis_64[input[i] >> 2];
+        *p++ = basis_64[((input[i] & 0x3) << 4) | (input[i + 1] >> 4)];
+        *p++ = basis_64[((input[i + 1] & 0xF) << 2) | (input[i + 2] >> 6)];
+        *p++ = basis_64[input[i + 2] & 0x3F];
+    }
+    if (i < len) {
+        *p++ = basis_64[input[i] >> 2];
+        if (i == len - 1) {
+            *p++ = basis_64[(input[i] & 0x3) << 4];
+            *p++ = '=';
+        } else {
+            *p++ = basis_64[((input[i] & 0x3) << 4) | (input[i + 1] >> 4)];
+            *p++ = basis_64[(input[i + 1] & 0xF) << 2];
+        }
+        *p++ = '=';
+    }
+    *p++ = '\0';
+    return p - encoded;
+}
+
+/**
+ The byte at a time scanners which the vectorized ones in TextScan.c must agree with
+ */
+static size_t referenceScanTextRun(const char *text, size_t length, int *visibleCharacters) {
+    size_t i = 0;
+    for (; i < length; i++) {
+        unsigned char c = text[i];
+        if (c == '<' || c == '>' || c == '&' || c == '\n') {
+            break;
+        }
+        *visibleCharacters += ((c & 0xC0) != 0x80) + (c >= 0xF0);
+    }
+    return i;
+}
+
+static size_t referenceScanToTagDelimiter(const char *text, size_t length) {
+    size_t i = 0;
+    while (i < length && text[i] != '<' && text[i] != '>') {
+        i++;
+    }
+    return i;
+}
+
+static bool textScannersMatchReference(const char *text, size_t length) {
+    int visibleCharacters = 0;
+    int expectedVisibleCharacters = 0;
+    return scanTextRun(text, length, &visibleCharacters) == referenceScanTextRun(text, length, &expectedVisibleCharacters)
+        && visibleCharacters == expectedVisibleCharacters
+        && scanToTagDelimiter(text, length) == referenceScanToTagDelimiter(text, length);
+}
+
+/**
+ Tokenize input into a tags buffer with room for every tag. Release the tags with freeTags, unless they have been flattened
+ */
+static char * tokenizeForTest(const char *input, unsigned int options, struct t_tag **tags, int *numberOfTags, int *visibleCharacters) {
+    size_t inputLength = strlen(input);
+    *tags = malloc((maximumNumberOfTags(input, inputLength) + 1) * sizeof(struct t_tag));
+    return tokenizeHTMLWithOptions((char *)input, inputLength, *tags, numberOfTags, visibleCharacters, options, NULL);
+}
+
+static void freeTags(struct t_tag *tags, int numberOfTags) {
+    for (int i = 0; i < numberOfTags; i++) {
+        free(tags[i].tag);
+        free(tags[i].tableData);
+    }
+    free(tags);
+}
+
+/**
+ Tokenize and flatten input with malloc, which is what the other ways of parsing are checked against. Release it with freeParseForTest
+ */
+static struct t_parse_result parseForTest(const char *input, unsigned int options) {
+    struct t_parse_result result;
+    struct t_tag *tags;
+    int numberOfTags = 0;
+    result.displayText = tokenizeForTest(input, options, &tags, &numberOfTags, &result.numberOfHumanVisibleCharacters);
+    result.formats = malloc((maximumNumberOfSimplifiedTags(numberOfTags, result.numberOfHumanVisibleCharacters) + 1) * sizeof(struct t_format));
+    makeAttributesLinear(tags, numberOfTags, result.formats, &result.numberOfFormats, &result.links, result.numberOfHumanVisibleCharacters);
+    free(tags);
+    return result;
+}
+
+static void freeParseForTest(struct t_parse_result *result) {
+    freeLinkTable(&result->links);
+    free(result->formats);
+    free(result->displayText);
+}
+
+/**
+ Whether "&name;" decodes to the value of the entity with exactly that name, or is left alone if there isn't one
+ */
+static bool namedEntityDecodesAsExpected(const char *name, size_t nameLength) {
+    char entity[64];
+    char output[64];
+    entity[0] = '&';
+    memcpy(entity + 1, name, nameLength);
+    entity[nameLength + 1] = ';';
+    size_t length = nameLength + 2;
+    
+    const char *expected = entity;
+    size_t expectedLength = length;
+    for (size_t i = 0; i < named_entity_count(); i++) {
+        const char *candidateName;
+        size_t candidateNameLength;
+        const char *value;
+        size_t valueLength;
+        named_entity_at(i, &candidateName, &candidateNameLength, &value, &valueLength);
+        if (candidateNameLength == nameLength && memcmp(candidateName, name, nameLength) == 0) {
+            expected = value;
+            expectedLength = valueLength;
+        }
+    }
+    size_t outputLength = decode_html_entity_utf8(output, entity, length);
+    return outputLength == expectedLength && memcmp(output, expected, expectedLength) == 0;
+}
+
+/**
+ What testVisitorMatchesMakeAttributesLinear's visitor checks each run against
+ */
+struct t_expected_runs {
+    const struct t_format *formats;
+    const struct t_link_table *links;
+    int numberOfVisitedRuns;
+    int numberOfMismatches;
+};
+
+static void checkVisitedRun(void *context, const struct t_format *run, const char *linkURL, size_t linkURLLength) {
+    struct t_expected_runs *expected = context;
+    struct t_format format = expected->formats[expected->numberOfVisitedRuns++];
+    const char *expectedURL = linkURLForFormat(expected->links, format);
+    bool isSameURL = expectedURL == NULL ? linkURL == NULL : linkURL != NULL && strcmp(linkURL, expectedURL) == 0 && strlen(linkURL) == linkURLLength;
+    if (t_format_cmp(format, *run) != 0 || format.startPosition != run->startPosition || format.endPosition != run->endPosition || !isSameURL) {
+        expected->numberOfMismatches++;
+    }
+}
+
 @implementation HTMLFastParseTests
 
 -(BOOL)testAttributedFormatUsingDebugDescriptionKey:(NSString *)key {
@@ -198,6 +387,796 @@
     XCTAssert([output length] == 231);
 }
 
+-(void)testNumericEntitiesMatchStrtoul {
+    //Every code point, in both bases, should decode exactly as the old strtoul based path did
+    char entity[32];
+    char expected[8];
+    char output[32];
+    for (unsigned long codePoint = 1; codePoint <= 0x10FFFF; codePoint += 7) {
+        for (int hex = 0; hex < 2; hex++) {
+            int length = snprintf(entity, sizeof(entity), hex ? "&#x%lX;" : "&#%lu;", codePoint);
+            size_t expectedLength = referenceDecodeNumericEntity(expected, entity, length);
+            if (codePoint >= 0xD800 && codePoint <= 0xDFFF) {
+                //Except surrogates, which used to give bytes that aren't valid UTF-8 and are now U+FFFD
+                expectedLength = 3;
+                memcpy(expected, "\xEF\xBF\xBD", 3);
+            }
+            size_t outputLength = decode_html_entity_utf8(output, entity, length);
+            XCTAssert(outputLength == expectedLength && memcmp(output, expected, outputLength) == 0, @"%s", entity);
+        }
+    }
+
+    //Out of range, empty and non-digit references are left alone
+    const char *invalid[] = {"&#0;", "&#x0;", "&#1114112;", "&#x110000;", "&#99999999999999999999;", "&#;", "&#x;", "&#12a;", "&#xG;"};
+    for (int i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        size_t length = strlen(invalid[i]);
+        XCTAssert(decode_html_entity_utf8(output, invalid[i], length) == length, @"%s", invalid[i]);
+    }
+}
+
+-(void)testNamedEntitiesDecode {
+    //Every name decodes to its value. A name cut short or in a different case is left alone, unless it happens to be another entity
+    for (size_t i = 0; i < named_entity_count(); i++) {
+        const char *name;
+        size_t nameLength;
+        const char *value;
+        size_t valueLength;
+        named_entity_at(i, &name, &nameLength, &value, &valueLength);
+        
+        char entity[64];
+        char output[64];
+        int length = snprintf(entity, sizeof(entity), "&%s;", name);
+        XCTAssert(decode_html_entity_utf8(output, entity, length) == valueLength && memcmp(output, value, valueLength) == 0, @"%s", entity);
+        //Without the ';' it isn't an entity at all
+        XCTAssert(decode_html_entity_utf8(output, entity, length - 1) == length - 1 && memcmp(output, entity, length - 1) == 0, @"%s", entity);
+        
+        for (size_t cut = 0; cut < nameLength; cut++) {
+            XCTAssert(namedEntityDecodesAsExpected(name, cut), @"%s cut to %zu", name, cut);
+        }
+        char swapped[64];
+        for (size_t k = 0; k < nameLength; k++) {
+            swapped[k] = isupper((unsigned char)name[k]) ? tolower((unsigned char)name[k]) : toupper((unsigned char)name[k]);
+        }
+        XCTAssert(namedEntityDecodesAsExpected(swapped, nameLength), @"%s", name);
+        memcpy(swapped + 1, name + 1, nameLength - 1);
+        XCTAssert(namedEntityDecodesAsExpected(swapped, nameLength), @"%s", name);
+    }
+    
+    char text[] = "&amp &lt; &AMP; &am;";
+    XCTAssert(decode_html_entities_utf8(text, NULL) == strlen("&amp < &AMP; &am;") && strcmp(text, "&amp < &AMP; &am;") == 0, @"%s", text);
+}
+
+-(void)testTextScannersMatchReference {
+    //Two, three and four byte characters in between ASCII. Every shift of it puts them across the 16 and 32 byte blocks in a different way
+    const char *filler = "ab\xC3\xA9" "c\xE2\x82\xAC" "d\xF0\x9F\x98\x80" "e";
+    size_t fillerLength = strlen(filler);
+    const char delimiters[] = {'<', '>', '&', '\n'};
+    for (size_t length = 0; length <= 100; length++) {
+        //Exactly length bytes, so reading past the end is caught by the address sanitizer
+        char *text = malloc(MAX(length, 1));
+        for (size_t shift = 0; shift < fillerLength; shift++) {
+            for (size_t i = 0; i < length; i++) {
+                text[i] = filler[(i + shift) % fillerLength];
+            }
+            XCTAssert(textScannersMatchReference(text, length), @"%zu bytes, shift %zu", length, shift);
+            //Each delimiter at every position, which includes both sides of each block boundary
+            for (int d = 0; d < sizeof(delimiters); d++) {
+                for (size_t position = 0; position < length; position++) {
+                    char replaced = text[position];
+                    text[position] = delimiters[d];
+                    XCTAssert(textScannersMatchReference(text, length), @"%zu bytes, shift %zu, 0x%02X at %zu", length, shift, delimiters[d], position);
+                    text[position] = replaced;
+                }
+            }
+        }
+        free(text);
+    }
+}
+
+-(void)testBase64MatchesReferenceAndRoundTrips {
+    //Every length up to a few vector blocks exercises each way the vectorized encoders can hand over to the scalar tail
+    srand(17);
+    for (size_t length = 0; length < 1024; length++) {
+        char *input = malloc(length + 1);
+        for (size_t i = 0; i < length; i++) {
+            input[i] = (char)rand();
+        }
+        char *expected = malloc(Base64encode_len(length));
+        char *encoded = malloc(Base64encode_len(length));
+        size_t expectedLength = referenceBase64encode(expected, input, length);
+        size_t encodedLength = Base64encode(encoded, input, length);
+        XCTAssert(encodedLength == expectedLength && encodedLength == Base64encode_len(length) && memcmp(encoded, expected, encodedLength) == 0, @"%zu bytes", length);
+        
+        char *decoded = malloc(Base64decode_len(encodedLength - 1));
+        size_t decodedLength = Base64decode(decoded, encoded, encodedLength - 1);
+        XCTAssert(decodedLength == length && memcmp(decoded, input, length) == 0, @"%zu bytes", length);
+        
+        free(decoded);
+        free(encoded);
+        free(expected);
+        free(input);
+    }
+}
+
+-(void)testArenaParsesMatchMalloc {
+    //Small blocks, so that bigger documents need several and some allocations get a block of their own. Every document is parsed twice, each time into memory reset from the one before
+    struct Arena *arena = createArena(256);
+    for (int pass = 0; pass < 2; pass++) {
+        for (NSString *key in _testData) {
+            const char *input = [_testData[key] UTF8String];
+            size_t inputLength = strlen(input);
+            struct t_parse_result expected = parseForTest(input, TOKENIZER_OPTION_NONE);
+            
+            resetArena(arena);
+            struct t_tag *tags = arenaAlloc(arena, (maximumNumberOfTags(input, inputLength) + 1) * sizeof(struct t_tag));
+            int numberOfTags = 0;
+            int visibleCharacters = 0;
+            char *text = tokenizeHTMLWithArena((char *)input, inputLength, tags, &numberOfTags, &visibleCharacters, arena);
+            struct t_format *formats = arenaAlloc(arena, (maximumNumberOfSimplifiedTags(numberOfTags, visibleCharacters) + 1) * sizeof(struct t_format));
+            int numberOfFormats = 0;
+            struct t_link_table links;
+            makeAttributesLinearWithArena(tags, numberOfTags, formats, &numberOfFormats, &links, visibleCharacters, arena);
+            
+            XCTAssert(strcmp(text, expected.displayText) == 0 && visibleCharacters == expected.numberOfHumanVisibleCharacters, @"%@", key);
+            XCTAssert(numberOfFormats == expected.numberOfFormats && links.numberOfURLs == expected.links.numberOfURLs, @"%@", key);
+            for (int i = 0; i < MIN(numberOfFormats, expected.numberOfFormats); i++) {
+                XCTAssert(t_format_cmp(formats[i], expected.formats[i]) == 0 && formats[i].startPosition == expected.formats[i].startPosition && formats[i].endPosition == expected.formats[i].endPosition, @"%@", key);
+            }
+            for (int i = 0; i < MIN(links.numberOfURLs, expected.links.numberOfURLs); i++) {
+                XCTAssert(strcmp(links.urls[i], expected.links.urls[i]) == 0, @"%@", key);
+            }
+            freeParseForTest(&expected);
+        }
+    }
+    destroyArena(arena);
+}
+
+-(void)testDeepNestingOutgrowsInlineStack {
+    //Far more open tags than the stack keeps inline, so it has to move to the heap mid document
+    NSMutableString *html = [NSMutableString string];
+    for (int i = 0; i < 100; i++) {
+        [html appendString:@"<em>"];
+    }
+    [html appendString:@"x"];
+    for (int i = 0; i < 100; i++) {
+        [html appendString:@"</em>"];
+    }
+    const char *input = html.UTF8String;
+    
+    struct Tokenizer *tokenizer = createTokenizer(NULL);
+    XCTAssert(feedTokenizer(tokenizer, input, strlen(input)));
+    struct t_tag *tags = NULL;
+    int numberOfTags = 0;
+    int visibleCharacters = 0;
+    char *text = finishTokenizer(tokenizer, &tags, &numberOfTags, &visibleCharacters);
+    destroyTokenizer(tokenizer);
+    
+    XCTAssert(strcmp(text, "x") == 0 && numberOfTags == 100);
+    for (int i = 0; i < numberOfTags; i++) {
+        XCTAssert(tags[i].startPosition == 0 && tags[i].endPosition == 1 && tags[i].kind == TAG_KIND_EM);
+    }
+    freeTags(tags, numberOfTags);
+    free(text);
+}
+
+-(void)testPlainTextMatchesFullParse {
+    //Plain text has to come out exactly as the tokenizer and flattening would have produced it
+    NSArray<NSString *> *inputs = @[_testData[@"NoTags"], _testData[@"SingleChar"], @"", @"Line one\nLine two\n", @"über 日本語 😀"];
+    for (NSString *html in inputs) {
+        const char *input = html.UTF8String;
+        size_t inputLength = strlen(input);
+        struct t_format run;
+        struct t_parse_result plainText;
+        XCTAssert(parsePlainText(input, inputLength, &run, &plainText), @"%@", html);
+        XCTAssert(plainText.displayText == input);
+        
+        struct t_parse_result expected = parseForTest(input, TOKENIZER_OPTION_NONE);
+        XCTAssert(strcmp(expected.displayText, plainText.displayText) == 0 && expected.numberOfHumanVisibleCharacters == plainText.numberOfHumanVisibleCharacters, @"%@", html);
+        XCTAssert(expected.numberOfFormats == plainText.numberOfFormats && plainText.links.numberOfURLs == 0, @"%@", html);
+        XCTAssert(expected.numberOfFormats == 0 || (t_format_cmp(expected.formats[0], plainText.formats[0]) == 0 && expected.formats[0].startPosition == plainText.formats[0].startPosition && expected.formats[0].endPosition == plainText.formats[0].endPosition), @"%@", html);
+        freeParseForTest(&expected);
+    }
+    
+    //Anything the tokenizer would change has to go the long way
+    for (NSString *html in @[_testData[@"Link"], @"a &amp; b", @"a > b", @"\nLeading new line", @"Double\n\nnew line"]) {
+        struct t_format run;
+        struct t_parse_result plainText;
+        XCTAssertFalse(parsePlainText(html.UTF8String, strlen(html.UTF8String), &run, &plainText), @"%@", html);
+    }
+}
+
+-(void)testPreviewStopsAtMaximumLength {
+    //Tags still open at the cut are closed there
+    char html[] = "<p><strong>bold text</strong> and more</p>";
+    struct t_tag tags[4];
+    int numberOfTags = 0;
+    int numberOfHumanVisibleCharacters = 0;
+    bool isTruncated = false;
+    char *text = tokenizeHTMLPreview(html, strlen(html), tags, &numberOfTags, &numberOfHumanVisibleCharacters, 4, &isTruncated, TOKENIZER_OPTION_NONE, NULL);
+    XCTAssert(strcmp(text, "bold") == 0 && numberOfHumanVisibleCharacters == 4 && isTruncated);
+    XCTAssert(numberOfTags == 2);
+    XCTAssert(tags[0].kind == TAG_KIND_STRONG && tags[0].startPosition == 0 && tags[0].endPosition == 4);
+    XCTAssert(tags[1].startPosition == 0 && tags[1].endPosition == 4);
+    for (int i = 0; i < numberOfTags; i++) {
+        free(tags[i].tag);
+    }
+    free(text);
+    
+    //Every preview is the start of the full text, and is the full text when it fits
+    for (NSString *key in _testData.allKeys) {
+        const char *input = [_testData[key] UTF8String];
+        size_t inputLength = strlen(input);
+        struct t_tag *expectedTags;
+        int expectedNumberOfTags = 0;
+        int expectedVisibleCharacters = 0;
+        char *expectedText = tokenizeForTest(input, TOKENIZER_OPTION_NONE, &expectedTags, &expectedNumberOfTags, &expectedVisibleCharacters);
+        
+        for (int maximumLength = 0; maximumLength <= 300; maximumLength += 30) {
+            struct t_tag *previewTags = malloc((maximumNumberOfTags(input, inputLength) + 1) * sizeof(struct t_tag));
+            char *previewText = tokenizeHTMLPreview((char *)input, inputLength, previewTags, &numberOfTags, &numberOfHumanVisibleCharacters, maximumLength, &isTruncated, TOKENIZER_OPTION_NONE, NULL);
+            XCTAssert(isTruncated == (expectedVisibleCharacters > maximumLength), @"%@ cut at %i", key, maximumLength);
+            XCTAssert(numberOfHumanVisibleCharacters <= maximumLength || !isTruncated, @"%@ cut at %i", key, maximumLength);
+            XCTAssert(strncmp(previewText, expectedText, strlen(previewText)) == 0, @"%@ cut at %i", key, maximumLength);
+            if (!isTruncated) {
+                XCTAssert(strcmp(previewText, expectedText) == 0 && numberOfTags == expectedNumberOfTags, @"%@ cut at %i", key, maximumLength);
+            }
+            for (int i = 0; i < numberOfTags; i++) {
+                XCTAssert(previewTags[i].endPosition <= numberOfHumanVisibleCharacters);
+            }
+            freeTags(previewTags, numberOfTags);
+            free(previewText);
+        }
+        
+        freeTags(expectedTags, expectedNumberOfTags);
+        free(expectedText);
+    }
+}
+
+-(void)testUTF16MatchesNSString {
+    for (NSString *key in _testData.allKeys) {
+        struct t_tag *tags;
+        int numberOfTags = 0;
+        int numberOfHumanVisibleCharacters = 0;
+        char *text = tokenizeForTest([_testData[key] UTF8String], TOKENIZER_OPTION_NONE, &tags, &numberOfTags, &numberOfHumanVisibleCharacters);
+        size_t textLength = strlen(text);
+        
+        //There is always one code unit for every visible character, even when the text isn't valid UTF-8
+        unichar *characters = malloc((numberOfHumanVisibleCharacters + 1) * sizeof(unichar));
+        struct t_utf16_index index;
+        bool isValid;
+        size_t numberOfCharacters = transcodeToUTF16(text, textLength, characters, numberOfHumanVisibleCharacters + 1, &index, &isValid);
+        XCTAssert(numberOfCharacters == numberOfHumanVisibleCharacters, @"%@", key);
+        NSString *expected = [NSString stringWithUTF8String:text];
+        XCTAssert(isValid == (expected != nil), @"%@", key);
+        if (expected) {
+            XCTAssert([expected isEqualToString:[NSString stringWithCharacters:characters length:numberOfCharacters]], @"%@", key);
+        }
+        
+        //A buffer that's too small gets as much of the text as fits, but never half of a surrogate pair. The rest of the text is still checked
+        size_t capacity = numberOfCharacters / 2;
+        unichar *prefix = malloc((capacity + 1) * sizeof(unichar));
+        bool isPrefixValid;
+        size_t numberOfPrefixCharacters = transcodeToUTF16(text, textLength, prefix, capacity, NULL, &isPrefixValid);
+        XCTAssert(numberOfPrefixCharacters <= capacity && numberOfPrefixCharacters + 1 >= capacity, @"%@", key);
+        XCTAssert(isPrefixValid == isValid, @"%@", key);
+        XCTAssert(memcmp(prefix, characters, numberOfPrefixCharacters * sizeof(unichar)) == 0, @"%@", key);
+        free(prefix);
+        
+        //Every character start maps across and back again
+        size_t utf16Offset = 0;
+        for (size_t i = 0; i <= textLength; i++) {
+            if (i < textLength && (text[i] & 0xC0) == 0x80) {
+                continue;
+            }
+            XCTAssert(utf16OffsetForByteOffset(&index, text, i) == utf16Offset, @"%@ byte %zu", key, i);
+            XCTAssert(byteOffsetForUTF16Offset(&index, text, textLength, utf16Offset) == i, @"%@ byte %zu", key, i);
+            if (i < textLength) {
+                utf16Offset += 1 + ((unsigned char)text[i] >= 0xF0);
+            }
+        }
+        
+        freeUTF16Index(&index);
+        free(characters);
+        freeTags(tags, numberOfTags);
+        free(text);
+    }
+    
+    //Stray bytes which are never written, since they have no code units or there's no room, still make the text invalid
+    unichar unit;
+    bool isValid;
+    XCTAssert(transcodeToUTF16("\x80", 1, &unit, 0, NULL, &isValid) == 0 && !isValid);
+    XCTAssert(transcodeToUTF16("a\x80", 2, &unit, 1, NULL, &isValid) == 1 && !isValid);
+    XCTAssert(transcodeToUTF16("ab", 2, &unit, 1, NULL, &isValid) == 1 && isValid);
+}
+
+-(void)testUTF8RepairMatchesNSString {
+    //Each bad sequence becomes one U+FFFD, just as NSString's lossy decoding does
+    const char *cases[][2] = {
+        {"plain", "plain"},
+        {"caf\xC3\xA9", "caf\xC3\xA9"},
+        {"a\xC3", "a\xEF\xBF\xBD"},
+        {"\xE2\x82" "A", "\xEF\xBF\xBD" "A"},
+        {"\x80\x80", "\xEF\xBF\xBD\xEF\xBF\xBD"},
+        {"\xC0\xAF", "\xEF\xBF\xBD\xEF\xBF\xBD"},
+        {"\xED\xA0\x80", "\xEF\xBF\xBD\xEF\xBF\xBD\xEF\xBF\xBD"},
+        {"\xF4\x90\x80\x80", "\xEF\xBF\xBD\xEF\xBF\xBD\xEF\xBF\xBD\xEF\xBF\xBD"},
+        {"<b>\xFF</b>\xF0\x9F\x98\x80", "<b>\xEF\xBF\xBD</b>\xF0\x9F\x98\x80"}
+    };
+    for (int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        size_t length = strlen(cases[i][0]);
+        size_t repairedLength;
+        char *repaired = repairUTF8(cases[i][0], length, &repairedLength, NULL);
+        XCTAssert((validateUTF8(cases[i][0], length) == length) == (repaired == NULL), @"case %i", i);
+        const char *expected = repaired ? repaired : cases[i][0];
+        XCTAssert(repairedLength == strlen(cases[i][1]) && strcmp(expected, cases[i][1]) == 0, @"case %i", i);
+        free(repaired);
+    }
+    
+    //Repaired input always gives display text NSString agrees with
+    char html[] = "<strong>\xF0\x9F\x98</strong> &#xD800; \xC3";
+    size_t repairedLength;
+    char *repaired = repairUTF8(html, strlen(html), &repairedLength, NULL);
+    struct t_tag tags[4];
+    int numberOfTags = 0;
+    int numberOfHumanVisibleCharacters = 0;
+    char *text = tokenizeHTML(repaired, repairedLength, tags, &numberOfTags, &numberOfHumanVisibleCharacters);
+    NSString *string = [NSString stringWithUTF8String:text];
+    XCTAssert(string && [string length] == numberOfHumanVisibleCharacters);
+    for (int i = 0; i < numberOfTags; i++) {
+        free(tags[i].tag);
+    }
+    free(text);
+    free(repaired);
+    
+    for (NSString *key in _testData.allKeys) {
+        const char *input = [_testData[key] UTF8String];
+        XCTAssert(validateUTF8(input, strlen(input)) == strlen(input), @"%@", key);
+    }
+}
+
+-(void)testChunkedTokenizerMatchesTokenizeHTML {
+    //Splitting the input anywhere (even inside tags, entities and tables) must not change the output
+    for (NSString *key in _testData.allKeys) {
+        const char *input = [_testData[key] UTF8String];
+        size_t inputLength = strlen(input);
+        
+        struct t_tag *expectedTags;
+        int expectedNumberOfTags = 0;
+        int expectedVisibleCharacters = 0;
+        char *expectedText = tokenizeForTest(input, TOKENIZER_OPTION_NONE, &expectedTags, &expectedNumberOfTags, &expectedVisibleCharacters);
+        
+        for (size_t chunkLength = 1; chunkLength <= 17; chunkLength += 4) {
+            struct Tokenizer *tokenizer = createTokenizer(NULL);
+            for (size_t position = 0; position < inputLength; position += chunkLength) {
+                XCTAssert(feedTokenizer(tokenizer, input + position, MIN(chunkLength, inputLength - position)));
+            }
+            struct t_tag *tags = NULL;
+            int numberOfTags = 0;
+            int visibleCharacters = 0;
+            char *text = finishTokenizer(tokenizer, &tags, &numberOfTags, &visibleCharacters);
+            destroyTokenizer(tokenizer);
+            
+            XCTAssert(strcmp(text, expectedText) == 0, @"%@ split every %zu bytes", key, chunkLength);
+            XCTAssert(numberOfTags == expectedNumberOfTags && visibleCharacters == expectedVisibleCharacters, @"%@ split every %zu bytes", key, chunkLength);
+            for (int i = 0; i < MIN(numberOfTags, expectedNumberOfTags); i++) {
+                XCTAssert(tags[i].startPosition == expectedTags[i].startPosition && tags[i].endPosition == expectedTags[i].endPosition);
+                XCTAssert(tags[i].kind == expectedTags[i].kind);
+                XCTAssert((tags[i].tag == NULL && expectedTags[i].tag == NULL) || strcmp(tags[i].tag, expectedTags[i].tag) == 0);
+                XCTAssert(tags[i].tableDataLength == expectedTags[i].tableDataLength);
+                XCTAssert(tags[i].tableSourceStart == expectedTags[i].tableSourceStart && tags[i].tableSourceLength == expectedTags[i].tableSourceLength);
+            }
+            freeTags(tags, numberOfTags);
+            free(text);
+        }
+        
+        freeTags(expectedTags, expectedNumberOfTags);
+        free(expectedText);
+    }
+}
+
+-(void)testLazyTablesMatchEagerTables {
+    //A lazily captured table must encode to the same link an eagerly captured one gets. The entity in the second table's tag mustn't move its start
+    const char *input = "<p>Scores</p><table><tr><td>A &amp; B</td></tr></table> after <table class=\"a&amp;b\"><tr><td>2</td></tr></table>";
+    size_t inputLength = strlen(input);
+    
+    struct t_tag *lazyTags;
+    int numberOfLazyTags = 0;
+    int lazyVisibleCharacters = 0;
+    char *lazyText = tokenizeForTest(input, TOKENIZER_OPTION_LAZY_TABLES, &lazyTags, &numberOfLazyTags, &lazyVisibleCharacters);
+    int numberOfTables = 0;
+    for (int i = 0; i < numberOfLazyTags; i++) {
+        XCTAssert(lazyTags[i].tableData == NULL);
+        if (lazyTags[i].kind != TAG_KIND_TABLE) {
+            continue;
+        }
+        numberOfTables++;
+        char *html = tableHTMLForSource(input, inputLength, lazyTags[i].tableSourceStart, lazyTags[i].tableSourceLength);
+        XCTAssert(strncmp(html, "<table", 6) == 0 && strcmp(html + strlen(html) - 8, "</table>") == 0, @"%s", html);
+        free(html);
+    }
+    XCTAssert(numberOfTables == 2);
+    freeTags(lazyTags, numberOfLazyTags);
+    free(lazyText);
+    
+    struct t_parse_result eager = parseForTest(input, TOKENIZER_OPTION_NONE);
+    struct t_parse_result lazy = parseForTest(input, TOKENIZER_OPTION_LAZY_TABLES);
+    XCTAssert(strcmp(eager.displayText, lazy.displayText) == 0 && eager.numberOfFormats == lazy.numberOfFormats);
+    for (int i = 0; i < MIN(eager.numberOfFormats, lazy.numberOfFormats); i++) {
+        const char *eagerURL = linkURLForFormat(&eager.links, eager.formats[i]);
+        const char *lazyURL = linkURLForFormat(&lazy.links, lazy.formats[i]);
+        XCTAssert((eagerURL == NULL) == (lazyURL == NULL));
+        if (!lazyURL) {
+            continue;
+        }
+        size_t start = 0;
+        size_t length = 0;
+        XCTAssert(tableSourceForLinkURL(lazyURL, &start, &length), @"%s", lazyURL);
+        char *dataURI = tableDataURIForSource(input, inputLength, start, length);
+        XCTAssert(strcmp(dataURI, eagerURL) == 0);
+        free(dataURI);
+    }
+    XCTAssertFalse(tableSourceForLinkURL("https://reddit.com", NULL, NULL));
+    XCTAssert(tableDataURIForSource(input, inputLength, inputLength - 1, 2) == NULL);
+    
+    freeParseForTest(&eager);
+    freeParseForTest(&lazy);
+}
+
+-(void)testTableModel {
+    const char *input = "<p>Scores</p><table><thead><tr><th align=\"left\">Team</th><th align=\"right\">Pts</th></tr></thead><tbody><tr><td><strong>A &amp; B</strong></td><td>3</td></tr><tr><td><a href=\"https://reddit.com\">C</a></td><td></td></tr></tbody></table>";
+    struct t_parse_result parsed = parseForTest(input, TOKENIZER_OPTION_LAZY_TABLES);
+    
+    struct t_table_cache *cache = createTableCache(input, strlen(input));
+    const struct t_table *table = NULL;
+    for (int i = 0; i < parsed.numberOfFormats && !table; i++) {
+        table = tableForLinkURL(cache, linkURLForFormat(&parsed.links, parsed.formats[i]));
+        //The second time it comes from the cache
+        XCTAssert(table == NULL || tableForLinkURL(cache, linkURLForFormat(&parsed.links, parsed.formats[i])) == table);
+    }
+    XCTAssert(table != NULL);
+    XCTAssert(table->numberOfRows == 3 && table->numberOfColumns == 2 && table->numberOfCells == 6);
+    
+    const struct t_table_cell *header = &table->cells[table->rowStarts[0]];
+    XCTAssert(header[0].isHeader && header[0].align == TABLE_ALIGN_LEFT && strcmp(header[0].content.displayText, "Team") == 0);
+    XCTAssert(header[1].isHeader && header[1].align == TABLE_ALIGN_RIGHT && strcmp(header[1].content.displayText, "Pts") == 0);
+    
+    //Each cell is styled on its own, from the start of its text
+    const struct t_table_cell *bold = &table->cells[table->rowStarts[1]];
+    XCTAssert(!bold->isHeader && strcmp(bold->content.displayText, "A & B") == 0 && bold->content.numberOfHumanVisibleCharacters == 5);
+    XCTAssert(bold->content.numberOfFormats == 1 && bold->content.formats[0].startPosition == 0 && bold->content.formats[0].endPosition == 5);
+    XCTAssert(FORMAT_TAG_GET_BIT_FIELD(bold->content.formats[0].formatTag, FORMAT_TAG_IS_BOLD_OFFSET));
+    
+    const struct t_table_cell *link = &table->cells[table->rowStarts[2]];
+    XCTAssert(link->content.numberOfFormats == 1 && strcmp(linkURLForFormat(&link->content.links, link->content.formats[0]), "https://reddit.com") == 0);
+    XCTAssert(link[1].content.numberOfHumanVisibleCharacters == 0 && link[1].content.formats == NULL);
+    destroyTableCache(cache);
+    
+    //Nested tables are left as a link in their cell
+    const char *nested = "<table><tr><td><table><tr><td>in</td><td>2</td></tr></table></td><td>out</td></tr></table>";
+    struct t_table *nestedTable = parseTableHTML(nested, strlen(nested), NULL);
+    XCTAssert(nestedTable->numberOfRows == 1 && nestedTable->numberOfCells == 2);
+    XCTAssert(strncmp(nestedTable->cells[0].content.displayText, "[View table]", 12) == 0 && strcmp(nestedTable->cells[1].content.displayText, "out") == 0);
+    free(nestedTable);
+    
+    freeParseForTest(&parsed);
+}
+
+-(void)testBatchMatchesSingleParses {
+    FormatToAttributedString * formatter = [[FormatToAttributedString alloc]init];
+    NSArray<NSString *> *keys = _testData.allKeys;
+    NSMutableArray<NSString *> *inputs = [[NSMutableArray alloc]init];
+    for (NSString *key in keys) {
+        [inputs addObject:_testData[key]];
+    }
+    
+    NSArray<NSAttributedString *> *outputs = [formatter attributedStringsForHTML:inputs];
+    XCTAssert([outputs count] == [inputs count]);
+    for (int i = 0; i < [inputs count]; i++) {
+        NSAttributedString *expected = [formatter attributedStringForHTML:inputs[i]];
+        XCTAssert([outputs[i] isEqualToAttributedString:expected], @"%@", keys[i]);
+    }
+}
+
+-(void)testParallelBatchMatchesBatch {
+    //Plenty of documents so that the workers run out and have to steal from each other
+    NSArray<NSString *> *keys = _testData.allKeys;
+    int numberOfInputs = 2000;
+    struct t_html_input *inputs = malloc(numberOfInputs * sizeof(struct t_html_input));
+    for (int i = 0; i < numberOfInputs; i++) {
+        inputs[i].input = [_testData[keys[i % [keys count]]] UTF8String];
+        inputs[i].inputLength = strlen(inputs[i].input);
+    }
+    
+    struct t_parse_result *expected = parseHTMLBatch(inputs, numberOfInputs, NULL);
+    for (int numberOfThreads = 2; numberOfThreads <= 8; numberOfThreads *= 2) {
+        struct t_parse_result *results = parseHTMLBatchInParallel(inputs, numberOfInputs, numberOfThreads);
+        for (int i = 0; i < numberOfInputs; i++) {
+            XCTAssert(strcmp(results[i].displayText, expected[i].displayText) == 0);
+            XCTAssert(results[i].numberOfHumanVisibleCharacters == expected[i].numberOfHumanVisibleCharacters);
+            XCTAssert(results[i].numberOfFormats == expected[i].numberOfFormats);
+            for (int j = 0; j < MIN(results[i].numberOfFormats, expected[i].numberOfFormats); j++) {
+                struct t_format format = results[i].formats[j];
+                struct t_format expectedFormat = expected[i].formats[j];
+                XCTAssert(format.startPosition == expectedFormat.startPosition && format.endPosition == expectedFormat.endPosition);
+                XCTAssert(format.formatTag == expectedFormat.formatTag && format.quoteLevel == expectedFormat.quoteLevel);
+                const char *linkURL = linkURLForFormat(&results[i].links, format);
+                const char *expectedLinkURL = linkURLForFormat(&expected[i].links, expectedFormat);
+                XCTAssert((linkURL == NULL && expectedLinkURL == NULL) || strcmp(linkURL, expectedLinkURL) == 0);
+            }
+        }
+        free(results);
+    }
+    free(expected);
+    free(inputs);
+}
+
+-(void)testParseCacheMatchesBatch {
+    NSArray<NSString *> *keys = _testData.allKeys;
+    int numberOfInputs = (int)[keys count];
+    struct t_html_input *inputs = malloc(numberOfInputs * sizeof(struct t_html_input));
+    for (int i = 0; i < numberOfInputs; i++) {
+        inputs[i].input = [_testData[keys[i]] UTF8String];
+        inputs[i].inputLength = strlen(inputs[i].input);
+    }
+    struct t_parse_result *expected = parseHTMLBatch(inputs, numberOfInputs, NULL);
+    
+    //Twice through, the second time everything should be a hit
+    struct ParseCache *cache = createParseCache(64 * 1024 * 1024);
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < numberOfInputs; i++) {
+            const struct t_parse_result *result = parseHTMLCached(cache, inputs[i].input, inputs[i].inputLength);
+            XCTAssert(strcmp(result->displayText, expected[i].displayText) == 0, @"%@", keys[i]);
+            XCTAssert(result->numberOfHumanVisibleCharacters == expected[i].numberOfHumanVisibleCharacters);
+            XCTAssert(result->numberOfFormats == expected[i].numberOfFormats);
+            XCTAssert(memcmp(result->formats, expected[i].formats, MIN(result->numberOfFormats, expected[i].numberOfFormats) * sizeof(struct t_format)) == 0);
+            releaseCachedParseResult(cache, result);
+        }
+    }
+    struct t_parse_cache_statistics statistics;
+    getParseCacheStatistics(cache, &statistics);
+    XCTAssert(statistics.misses == numberOfInputs && statistics.hits == numberOfInputs && statistics.evictions == 0);
+    destroyParseCache(cache);
+    
+    //A cache too small for more than a few results keeps evicting, but results in use stay valid
+    cache = createParseCache(4096);
+    const struct t_parse_result *first = parseHTMLCached(cache, inputs[0].input, inputs[0].inputLength);
+    for (int i = 0; i < numberOfInputs; i++) {
+        releaseCachedParseResult(cache, parseHTMLCached(cache, inputs[i].input, inputs[i].inputLength));
+    }
+    XCTAssert(strcmp(first->displayText, expected[0].displayText) == 0);
+    releaseCachedParseResult(cache, first);
+    getParseCacheStatistics(cache, &statistics);
+    XCTAssert(statistics.evictions > 0 && statistics.size <= 4096);
+    destroyParseCache(cache);
+    
+    //Two inputs which share a hash (a 16 byte block that cancels the hash's multiplier throws away everything before it) must still get their own results
+    char colliding[2][33];
+    const uint64_t cancellingBlock = 0xe7037ed1a0b428dbull;
+    memcpy(colliding[0], "<b>secret</b>xyz", 16);
+    memcpy(colliding[1], "hello everyone!!", 16);
+    for (int i = 0; i < 2; i++) {
+        memcpy(&colliding[i][16], &cancellingBlock, 8);
+        memset(&colliding[i][24], 'A', 8);
+        colliding[i][32] = 0x00;
+    }
+    cache = createParseCache(1024 * 1024);
+    const struct t_parse_result *secret = parseHTMLCached(cache, colliding[0], 32);
+    const struct t_parse_result *hello = parseHTMLCached(cache, colliding[1], 32);
+    XCTAssert(secret != hello && strncmp(hello->displayText, "hello", 5) == 0);
+    releaseCachedParseResult(cache, secret);
+    releaseCachedParseResult(cache, hello);
+    destroyParseCache(cache);
+    
+    free(expected);
+    free(inputs);
+}
+
+-(void)testPackRoundTrip {
+    NSArray<NSString *> *keys = _testData.allKeys;
+    int numberOfInputs = (int)[keys count];
+    const char *table = "<p>Scores</p><table><tr><th>Team</th></tr><tr><td><strong>A</strong></td></tr></table><p><a href=\"https://reddit.com\">after</a></p>";
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"testPackRoundTrip.pack"];
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+    
+    //Written in two goes, so the second writer carries on from the first one's index
+    struct PackWriter *writer = openPackWriter(path.fileSystemRepresentation);
+    XCTAssert(appendPackDocument(writer, table, strlen(table)));
+    XCTAssert(openPackReader(path.fileSystemRepresentation) == NULL);
+    XCTAssert(closePackWriter(writer));
+    writer = openPackWriter(path.fileSystemRepresentation);
+    for (int i = 0; i < numberOfInputs; i++) {
+        const char *input = [_testData[keys[i]] UTF8String];
+        XCTAssert(appendPackDocument(writer, input, strlen(input)));
+    }
+    //Until then the pack still reads as the first writer left it
+    struct PackReader *reader = openPackReader(path.fileSystemRepresentation);
+    XCTAssert(reader && numberOfPackDocuments(reader) == 1 && packDocument(reader, 0) != NULL);
+    closePackReader(reader);
+    XCTAssert(closePackWriter(writer));
+    
+    reader = openPackReader(path.fileSystemRepresentation);
+    XCTAssert(numberOfPackDocuments(reader) == numberOfInputs + 1);
+    XCTAssert(packDocument(reader, numberOfInputs + 1) == NULL);
+    for (int i = 0; i < numberOfInputs; i++) {
+        struct t_tag *tags;
+        int numberOfTags = 0;
+        int visibleCharacters = 0;
+        char *text = tokenizeForTest([_testData[keys[i]] UTF8String], TOKENIZER_OPTION_LAZY_TABLES, &tags, &numberOfTags, &visibleCharacters);
+        struct t_run *runs = malloc((maximumNumberOfSimplifiedTags(numberOfTags, visibleCharacters) + 1) * sizeof(struct t_run));
+        int numberOfRuns = 0;
+        struct t_link_table links;
+        makeRunsLinearWithArena(tags, numberOfTags, runs, &numberOfRuns, &links, visibleCharacters, NULL);
+        
+        const struct t_pack_document *document = packDocument(reader, i + 1);
+        XCTAssert(strcmp(packDisplayText(document), text) == 0, @"%@", keys[i]);
+        XCTAssert(document->numberOfHumanVisibleCharacters == visibleCharacters);
+        XCTAssert(document->numberOfRuns == numberOfRuns && memcmp(packRuns(document), runs, numberOfRuns * sizeof(struct t_run)) == 0);
+        XCTAssert(document->numberOfURLs == links.numberOfURLs);
+        for (int u = 0; u < MIN(links.numberOfURLs, (int)document->numberOfURLs); u++) {
+            size_t start;
+            size_t length;
+            XCTAssert(tableSourceForLinkURL(links.urls[u], &start, &length) || strcmp(packLinkURL(document, u + 1), links.urls[u]) == 0);
+        }
+        
+        freeLinkTable(&links);
+        free(runs);
+        free(tags);
+        free(text);
+    }
+    
+    //The table's HTML comes with it, and its link points at that HTML rather than into the input
+    const struct t_pack_document *document = packDocument(reader, 0);
+    XCTAssert(strcmp(packDisplayText(document), "Scores[View table]\nafter") == 0);
+    XCTAssert(document->numberOfTables == 1 && document->numberOfURLs == 2);
+    const struct t_pack_table *packedTable = &packTables(document)[0];
+    XCTAssert(packedTable->startPosition == 6 && packedTable->endPosition == 19);
+    XCTAssert(strcmp(packLinkURL(document, 2), "https://reddit.com") == 0);
+    size_t start;
+    size_t length;
+    bool foundTableLink = false;
+    for (unsigned int u = 1; u <= document->numberOfURLs; u++) {
+        if (tableSourceForLinkURL(packLinkURL(document, u), &start, &length)) {
+            foundTableLink = start == packedTable->htmlOffset && length == packedTable->htmlLength;
+        }
+    }
+    XCTAssert(foundTableLink);
+    XCTAssert(strncmp(packTableHTML(document, packedTable), "<table>", 7) == 0);
+    struct t_table *grid = parseTableHTML(packTableHTML(document, packedTable), packedTable->htmlLength, NULL);
+    XCTAssert(grid->numberOfRows == 2 && grid->numberOfCells == 2 && strcmp(grid->cells[1].content.displayText, "A") == 0);
+    free(grid);
+    
+    closePackReader(reader);
+    
+    //A damaged document count is caught before the writer sizes its index from it
+    FILE *file = fopen(path.fileSystemRepresentation, "r+b");
+    struct t_pack_header header;
+    uint64_t damagedCount = (1ull << 61) - 63;
+    XCTAssert(fread(&header, sizeof(header), 1, file) == 1);
+    XCTAssert(fseeko(file, header.indexOffset, SEEK_SET) == 0 && fwrite(&damagedCount, sizeof(damagedCount), 1, file) == 1);
+    fclose(file);
+    XCTAssert(openPackWriter(path.fileSystemRepresentation) == NULL);
+    XCTAssert(openPackReader(path.fileSystemRepresentation) == NULL);
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+-(void)testVisitorMatchesMakeAttributesLinear {
+    for (NSString *key in _testData) {
+        const char *input = [_testData[key] UTF8String];
+        struct t_parse_result parsed = parseForTest(input, TOKENIZER_OPTION_NONE);
+        
+        struct t_tag *tags;
+        int numberOfTags = 0;
+        int visibleCharacters = 0;
+        char *text = tokenizeForTest(input, TOKENIZER_OPTION_NONE, &tags, &numberOfTags, &visibleCharacters);
+        struct t_expected_runs expected = {parsed.formats, &parsed.links, 0, 0};
+        int numberOfRuns = visitAttributesLinear(tags, numberOfTags, visibleCharacters, checkVisitedRun, &expected, NULL);
+        XCTAssert(numberOfRuns == parsed.numberOfFormats && expected.numberOfVisitedRuns == parsed.numberOfFormats, @"%@", key);
+        XCTAssert(expected.numberOfMismatches == 0, @"%@", key);
+        
+        free(tags);
+        free(text);
+        freeParseForTest(&parsed);
+    }
+}
+
+-(void)testTagKinds {
+    struct t_tag *tags;
+    int numberOfTags = 0;
+    int visibleCharacters = 0;
+    char *text = tokenizeForTest("<strong class=\"x\">a</strong><h3>b</h3><a href=\"https://reddit.com\" title=\"t\">c</a><span>d</span><hr/>", TOKENIZER_OPTION_NONE, &tags, &numberOfTags, &visibleCharacters);
+    
+    XCTAssert(strcmp(text, "abcd") == 0);
+    XCTAssert(numberOfTags == 5);
+    XCTAssert(tags[0].kind == TAG_KIND_STRONG && tags[0].tag == NULL);
+    XCTAssert(tags[1].kind == TAG_KIND_H3 && tags[1].tag == NULL);
+    XCTAssert(tags[2].kind == TAG_KIND_LINK);
+    XCTAssert(tags[3].kind == TAG_KIND_OTHER && tags[3].tag == NULL);
+    XCTAssert(tags[4].kind == TAG_KIND_OTHER && tags[4].startPosition == tags[4].endPosition);
+    
+    freeTags(tags, numberOfTags);
+    free(text);
+}
+
+-(void)testTagAttributes {
+    struct t_tag *tags;
+    int numberOfTags = 0;
+    int visibleCharacters = 0;
+    char *text = tokenizeForTest("<a href=\"https://reddit.com/?a=1&amp;b=2\" title='Reddit &quot;home&quot;'>a</a><p align=center class=x>b</p><a href=\"\">c</a><p>d</p>", TOKENIZER_OPTION_NONE, &tags, &numberOfTags, &visibleCharacters);
+    XCTAssert(numberOfTags == 4);
+    
+    size_t length = 0;
+    const char *href = tagAttribute(&tags[0], TAG_ATTRIBUTE_HREF, &length);
+    XCTAssert(href && strcmp(href, "https://reddit.com/?a=1&b=2") == 0 && length == strlen(href));
+    XCTAssert(tagAttribute(&tags[0], TAG_ATTRIBUTE_TITLE, NULL) && strcmp(tagAttribute(&tags[0], TAG_ATTRIBUTE_TITLE, NULL), "Reddit \"home\"") == 0);
+    XCTAssert(tagAttribute(&tags[0], TAG_ATTRIBUTE_ALIGN, NULL) == NULL);
+    XCTAssert(tagAttribute(&tags[1], TAG_ATTRIBUTE_ALIGN, NULL) && strcmp(tagAttribute(&tags[1], TAG_ATTRIBUTE_ALIGN, NULL), "center") == 0);
+    XCTAssert(tagAttribute(&tags[2], TAG_ATTRIBUTE_HREF, &length) && length == 0);
+    XCTAssert(tags[3].tag == NULL && tagAttribute(&tags[3], TAG_ATTRIBUTE_HREF, NULL) == NULL);
+    
+    freeTags(tags, numberOfTags);
+    free(text);
+}
+
+-(void)testLinkTableDeduplicatesURLs {
+    struct t_parse_result parsed = parseForTest("<a href=\"https://x.com\">a<strong>b</strong><em>c</em></a> <a href=\"https://x.com\">d</a><a href=\"https://y.com\">e</a>", TOKENIZER_OPTION_NONE);
+    struct t_format *formats = parsed.formats;
+    
+    //a, b and c are separate runs of the same link, and so is d
+    XCTAssert(parsed.links.numberOfURLs == 2);
+    XCTAssert(strcmp(parsed.links.urls[0], "https://x.com") == 0 && strcmp(parsed.links.urls[1], "https://y.com") == 0);
+    XCTAssert(parsed.numberOfFormats == 6);
+    XCTAssert(formats[0].linkIndex == 1 && formats[1].linkIndex == 1 && formats[2].linkIndex == 1);
+    XCTAssert(formats[3].linkIndex == 0 && formats[4].linkIndex == 1 && formats[5].linkIndex == 2);
+    XCTAssert(strcmp(linkURLForFormat(&parsed.links, formats[4]), "https://x.com") == 0);
+    XCTAssert(linkURLForFormat(&parsed.links, formats[3]) == NULL);
+    
+    freeParseForTest(&parsed);
+}
+
+-(void)testPackedRunsMatchFormats {
+    XCTAssert(sizeof(struct t_run) == 8);
+    for (NSString *key in _testData) {
+        const char *input = [_testData[key] UTF8String];
+        struct t_parse_result parsed = parseForTest(input, TOKENIZER_OPTION_NONE);
+        
+        //Flattening destroys the tags so tokenize again for each output format
+        struct t_tag *tags;
+        int numberOfTags = 0;
+        int visibleCharacters = 0;
+        char *text = tokenizeForTest(input, TOKENIZER_OPTION_NONE, &tags, &numberOfTags, &visibleCharacters);
+        int maximumRuns = maximumNumberOfSimplifiedTags(numberOfTags, visibleCharacters) + 1;
+        struct t_run *runs = malloc(maximumRuns * sizeof(struct t_run));
+        int numberOfRuns = 0;
+        struct t_link_table runLinks;
+        XCTAssert(makeRunsLinearWithArena(tags, numberOfTags, runs, &numberOfRuns, &runLinks, visibleCharacters, NULL));
+        free(tags);
+        free(text);
+        
+        text = tokenizeForTest(input, TOKENIZER_OPTION_NONE, &tags, &numberOfTags, &visibleCharacters);
+        struct t_run_columns columns = {malloc(maximumRuns * sizeof(unsigned int)), malloc(maximumRuns * sizeof(unsigned short)), malloc(maximumRuns * sizeof(unsigned short)), 0};
+        struct t_link_table columnLinks;
+        XCTAssert(makeRunColumnsLinearWithArena(tags, numberOfTags, &columns, &columnLinks, visibleCharacters, NULL));
+        free(tags);
+        free(text);
+        
+        XCTAssert(numberOfRuns == parsed.numberOfFormats && columns.numberOfRuns == parsed.numberOfFormats, @"%@", key);
+        XCTAssert(runLinks.numberOfURLs == parsed.links.numberOfURLs && columnLinks.numberOfURLs == parsed.links.numberOfURLs, @"%@", key);
+        for (int i = 0; i < MIN(numberOfRuns, parsed.numberOfFormats); i++) {
+            struct t_format format = formatForRun(runs, i, numberOfRuns, visibleCharacters);
+            XCTAssert(t_format_cmp(format, parsed.formats[i]) == 0 && format.startPosition == parsed.formats[i].startPosition && format.endPosition == parsed.formats[i].endPosition, @"%@", key);
+            XCTAssert(columns.startPositions[i] == runs[i].startPosition && columns.styles[i] == runs[i].style && columns.linkIndices[i] == runs[i].linkIndex, @"%@", key);
+        }
+        
+        freeLinkTable(&runLinks);
+        freeLinkTable(&columnLinks);
+        free(columns.startPositions);
+        free(columns.styles);
+        free(columns.linkIndices);
+        free(runs);
+        freeParseForTest(&parsed);
+    }
+}
+
 -(void)testVeryLongTag {
     NSString *longTagName = [@"" stringByPaddingToLength:50000 withString:@"A" startingAtIndex:0];
     NSString *testData = [NSString stringWithFormat:@"<%@>TEST</%@>",longTagName,longTagName];
@@ -223,6 +1202,42 @@
     }];
 }
 
+- (void)testNumericEntityPerformance {
+    //Reddit escapes quotes and apostrophes as numeric references so these make up most of the entities we see
+    const char *entities[] = {"&#39;", "&#x27;", "&#34;", "&#8217;", "&#x1F600;"};
+    char output[8];
+    [self measureBlock:^{
+        for (int i = 0; i < 1000000; i++) {
+            const char *entity = entities[i % 5];
+            decode_html_entity_utf8(output, entity, strlen(entity));
+        }
+    }];
+}
+
+- (void)testNumericEntityStrtoulPerformance {
+    //The same workload through the old strtoul path, for comparison with testNumericEntityPerformance
+    const char *entities[] = {"&#39;", "&#x27;", "&#34;", "&#8217;", "&#x1F600;"};
+    char output[8];
+    [self measureBlock:^{
+        for (int i = 0; i < 1000000; i++) {
+            const char *entity = entities[i % 5];
+            referenceDecodeNumericEntity(output, entity, strlen(entity));
+        }
+    }];
+}
+
+- (void)testSmallStringBatchPerformance {
+    FormatToAttributedString * formatter = [[FormatToAttributedString alloc]init];
+    NSString *testData = [_testData objectForKey:@"SingleChar"];
+    NSMutableArray<NSString *> *inputs = [[NSMutableArray alloc]init];
+    for (int i = 0; i < 5000; i++) {
+        [inputs addObject:testData];
+    }
+    [self measureBlock:^{
+        [formatter attributedStringsForHTML:inputs];
+    }];
+}
+
 - (void)testSmallStringPerformance {
     FormatToAttributedString * formatter = [[FormatToAttributedString alloc]init];
     NSString *testData = [_testData objectForKey:@"SingleChar"];
@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+"""
+Builds the perfect hash used by entities.c to look up named HTML entities.
+
+The entity list in HTMLFastParse/entities.c is the source of truth. This script
+reads the ENTITY("name", "value") lines from it and writes
+HTMLFastParse/entities_hash.h, which maps every name to its index in
+NAMED_ENTITIES with a single probe.
+
+The hash is "hash, displace and compress": names are first split into buckets
+by an unseeded hash. Each bucket then gets a seed (stored in the displacement
+table) which places all of its names in free slots, or, for buckets with one
+name, the slot itself (stored as -slot - 1).
+
+Usage: Scripts/generate_entities_hash.py
+"""
+
+import os
+import re
+import sys
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+ENTITIES_C = os.path.join(ROOT, "HTMLFastParse", "entities.c")
+ENTITIES_HASH_H = os.path.join(ROOT, "HTMLFastParse", "entities_hash.h")
+
+
+def entity_hash(seed, name):
+    """FNV-1a, seeded. Must match entity_hash() in entities.c"""
+    h = (2166136261 ^ seed) & 0xFFFFFFFF
+    for c in name:
+        h ^= c
+        h = (h * 16777619) & 0xFFFFFFFF
+    return h
+
+
+def read_entity_names():
+    with open(ENTITIES_C, encoding="utf-8") as f:
+        source = f.read()
+    return [name.encode("utf-8") for name in re.findall(r'^\tENTITY\("([^"]+)",', source, re.MULTILINE)]
+
+
+def build(names):
+    size = len(names)
+    buckets = [[] for _ in range(size)]
+    for index, name in enumerate(names):
+        buckets[entity_hash(0, name) % size].append(index)
+
+    displacements = [0] * size
+    slots = [-1] * size
+
+    # Place the largest buckets first while there is still plenty of room
+    order = sorted(range(size), key=lambda b: len(buckets[b]), reverse=True)
+    for bucket in order:
+        members = buckets[bucket]
+        if len(members) <= 1:
+            break
+        seed = 1
+        while True:
+            placement = [entity_hash(seed, names[i]) % size for i in members]
+            if len(set(placement)) == len(placement) and all(slots[p] == -1 for p in placement):
+                break
+            seed += 1
+            if seed > 0x7FFF:
+                sys.exit("Unable to find a seed, try a different hash")
+        for index, slot in zip(members, placement):
+            slots[slot] = index
+        displacements[bucket] = seed
+
+    # Buckets with a single name go straight into whatever slots are left
+    free = [slot for slot in range(size) if slots[slot] == -1]
+    for bucket in order:
+        if len(buckets[bucket]) != 1:
+            continue
+        slot = free.pop()
+        slots[slot] = buckets[bucket][0]
+        displacements[bucket] = -slot - 1
+
+    return displacements, slots
+
+
+def format_table(values):
+    lines = []
+    for start in range(0, len(values), 12):
+        lines.append("\t" + ", ".join("%d" % v for v in values[start:start + 12]) + ",")
+    return "\n".join(lines)
+
+
+def main():
+    names = read_entity_names()
+    if len(names) != len(set(names)):
+        sys.exit("Duplicate entity names in entities.c")
+    displacements, slots = build(names)
+
+    # Sanity check the table exactly as entities.c will use it
+    for index, name in enumerate(names):
+        displacement = displacements[entity_hash(0, name) % len(names)]
+        slot = -displacement - 1 if displacement < 0 else entity_hash(displacement, name) % len(names)
+        assert slots[slot] == index
+
+    with open(ENTITIES_HASH_H, "w", encoding="utf-8") as f:
+        f.write("""/*	Generated by Scripts/generate_entities_hash.py from the entity list in
+	entities.c. Do not edit by hand.
+*/
+
+#ifndef DECODE_HTML_ENTITIES_HASH_
+#define DECODE_HTML_ENTITIES_HASH_
+
+#define NAMED_ENTITY_COUNT %d
+
+/*	Indexed by entity_hash(0, name) %% NAMED_ENTITY_COUNT. Negative values are
+	-slot - 1, otherwise the value is the seed to rehash the name with.
+*/
+static const short NAMED_ENTITY_DISPLACEMENTS[NAMED_ENTITY_COUNT] = {
+%s
+};
+
+/*	The index into NAMED_ENTITIES for each slot */
+static const short NAMED_ENTITY_SLOTS[NAMED_ENTITY_COUNT] = {
+%s
+};
+
+#endif
+""" % (len(names), format_table(displacements), format_table(slots)))
+
+
+if __name__ == "__main__":
+    main()